@@ -0,0 +1,340 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define ANKERL_NANOBENCH_IMPLEMENT
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <nanobench.h>
+#include "../bhwinfo.hpp"
+#include "fake_tree.hpp"
+
+namespace nb = ankerl::nanobench;
+
+/** allocation counting, every global operator new goes through here */
+namespace {
+    std::atomic<uint64_t> allocation_count{};
+    std::atomic<uint64_t> allocation_bytes{};
+
+    void* allocate(std::size_t size, std::size_t alignment = 0) {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+
+        if (size == 0) size = 1;
+
+        void* ptr = alignment > alignof(std::max_align_t)
+                ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                : std::malloc(size);
+
+        if (ptr == nullptr) throw std::bad_alloc();
+
+        return ptr;
+    }
+}
+
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t al) { return allocate(size, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return allocate(size, static_cast<std::size_t>(al)); }
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { std::free(ptr); }
+
+namespace {
+    struct Allocations {
+        string name;
+        double count;
+        double bytes;
+    };
+
+    constexpr int allocation_runs = 50;
+
+    //* Average allocations and allocated bytes of one <op>() call
+    template <typename F>
+    Allocations count_allocations(const string& name, F&& op) {
+        const uint64_t count = allocation_count.load();
+        const uint64_t bytes = allocation_bytes.load();
+
+        for (int i = 0; i < allocation_runs; i++) op();
+
+        return {name,
+                static_cast<double>(allocation_count.load() - count) / allocation_runs,
+                static_cast<double>(allocation_bytes.load() - bytes) / allocation_runs};
+    }
+
+    int parse_count(const char* arg, const char* option) {
+        char* end;
+        const long value = std::strtol(arg, &end, 10);
+
+        if (*end != '\0' or value < 1 or value > 65536)
+            throw std::invalid_argument(string("Invalid value for ") + option + ": " + arg);
+
+        return static_cast<int>(value);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int cores = 256;
+    int mounts = 32;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            const string arg = argv[i];
+
+            if ((arg == "-c" or arg == "--cores") and i + 1 < argc) cores = parse_count(argv[++i], "--cores");
+            else if ((arg == "-m" or arg == "--mounts") and i + 1 < argc) mounts = parse_count(argv[++i], "--mounts");
+            else {
+                std::fprintf(stderr, "usage: %s [--cores N] [--mounts N]\n", argv[0]);
+                return arg == "-h" or arg == "--help" ? 0 : 1;
+            }
+        }
+    }
+    catch (const std::invalid_argument& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    bench::FakeTree tree(cores, mounts);
+
+    shared::set_root(tree.get_proc_path(), tree.get_sys_path());
+
+    nb::Bench bench;
+    bench.title("bhwinfo, " + std::to_string(cores) + " cores, " + std::to_string(mounts) + " mounts")
+         .unit("call")
+         .warmup(3);
+
+    vector<Allocations> allocations;
+
+    auto run = [&](const string& name, auto&& op) {
+        bench.run(name, op);
+        allocations.push_back(count_allocations(name, op));
+    };
+
+    /** collectors */
+    run("cpu::DataCollector()", []() {
+        cpu::DataCollector collector;
+        nb::doNotOptimizeAway(collector);
+    });
+
+    cpu::DataCollector cpu_collector;
+    cpu_collector.collect();
+
+    run("cpu::DataCollector::collect()", [&]() {
+        auto data = cpu_collector.collect();
+        nb::doNotOptimizeAway(data);
+    });
+
+    cpu::Data cpu_out;
+    cpu_collector.collect_into(cpu_out);
+
+    run("cpu::DataCollector::collect_into()", [&]() {
+        cpu_collector.collect_into(cpu_out);
+        nb::doNotOptimizeAway(cpu_out);
+    });
+
+    mem::DataCollector mem_collector;
+    mem_collector.collect();
+
+    run("mem::DataCollector::collect()", [&]() {
+        auto data = mem_collector.collect();
+        nb::doNotOptimizeAway(data);
+    });
+
+    mem::Data mem_out;
+    mem_collector.collect_into(mem_out);
+
+    run("mem::DataCollector::collect_into()", [&]() {
+        mem_collector.collect_into(mem_out);
+        nb::doNotOptimizeAway(mem_out);
+    });
+
+    mem::DataCollector sysfs_collector;
+    sysfs_collector.set_io_backend(mem::IoBackend::sysfs);
+    sysfs_collector.collect();
+
+    run("mem::DataCollector::collect(), sysfs IO", [&]() {
+        auto data = sysfs_collector.collect();
+        nb::doNotOptimizeAway(data);
+    });
+
+    cpu::DataCollector cgroup_cpu_collector{cgroup::find_group()};
+    cgroup_cpu_collector.collect();
+
+    run("cpu::DataCollector::collect(), 2 core cgroup", [&]() {
+        auto data = cgroup_cpu_collector.collect();
+        nb::doNotOptimizeAway(data);
+    });
+
+    mem::DataCollector cgroup_mem_collector{cgroup::find_group()};
+    cgroup_mem_collector.collect();
+
+    run("mem::DataCollector::collect(), cgroup", [&]() {
+        auto data = cgroup_mem_collector.collect();
+        nb::doNotOptimizeAway(data);
+    });
+
+    net::DataCollector net_collector;
+    net_collector.collect();
+
+    run("net::DataCollector::collect()", [&]() {
+        auto data = net_collector.collect();
+        nb::doNotOptimizeAway(data);
+    });
+
+    //? Every collect keeps the listed veths and adds one, so the table grows past its capacity of 4 while known
+    //? interfaces are present, then the window moves on to new names and the old ones are released
+    net::DataCollector churn_collector{4};
+    int churn = 0;
+
+    run("net::DataCollector::collect(), veth churn past capacity", [&]() {
+        const int veths = churn % 64 + 1;
+
+        tree.write_interfaces(veths, churn / 64 * 64);
+        churn++;
+
+        auto data = churn_collector.collect();
+
+        if (data.get_interfaces().size() != (size_t) veths + 2)
+            throw std::runtime_error("net::DataCollector lost interfaces while growing");
+
+        nb::doNotOptimizeAway(data);
+    });
+
+    tree.write_interfaces(64);
+
+    bhwinfo::Collector collector;
+    bhwinfo::Sample sample;
+    collector.collect_into(sample);
+
+    run("bhwinfo::Collector::collect_into()", [&]() {
+        collector.collect_into(sample);
+        nb::doNotOptimizeAway(sample);
+    });
+
+    bhwinfo::Rollup rollup;
+    const auto cpu_data = cpu_collector.collect();
+    const auto mem_data = mem_collector.collect();
+
+    run("bhwinfo::Rollup::add(), cpu and mem", [&]() {
+        const auto now = std::chrono::steady_clock::now();
+        rollup.add(cpu_data, now);
+        rollup.add(mem_data, now);
+    });
+
+    bhwinfo::Exposition exposition{{.listen = false}};
+
+    run("bhwinfo::Exposition::render(), cpu and mem", [&]() {
+        exposition.render(cpu_data);
+        exposition.render(mem_data, std::chrono::steady_clock::now());
+    });
+
+    /** fleet merge, every run is a new snapshot of each of 4096 hosts */
+    constexpr size_t fleet_hosts = 4096;
+    bhwinfo::SnapshotWriter snapshot_writer{0};
+    const size_t snapshot_size = bhwinfo::SnapshotWriter::get_size(cpu_data, mem_data);
+    vector<uint64_t> snapshot_storage((snapshot_size + 7) / 8 * fleet_hosts); // 8 byte aligned
+    vector<std::span<const std::byte>> snapshots;
+    vector<bhwinfo::SnapshotHeader*> snapshot_headers;
+
+    for (size_t i = 0; i < fleet_hosts; i++) {
+        const std::span<std::byte> buffer{reinterpret_cast<std::byte*>(snapshot_storage.data() + i * ((snapshot_size + 7) / 8)), snapshot_size};
+
+        snapshot_writer.write(buffer, cpu_data, mem_data);
+        snapshot_headers.push_back(reinterpret_cast<bhwinfo::SnapshotHeader*>(buffer.data()));
+        snapshot_headers.back()->source_id = i;
+        snapshots.emplace_back(buffer);
+    }
+
+    bhwinfo::FleetMerger fleet;
+
+    run("bhwinfo::FleetMerger::ingest(), 4096 snapshots", [&]() {
+        for (auto* header : snapshot_headers) header->timestamp_ns += 1000000000;
+
+        nb::doNotOptimizeAway(fleet.ingest(snapshots));
+    });
+
+    /** per core usage kernel, on synthetic times of every core */
+    const auto kernel_cores = static_cast<size_t>(cores);
+    vector<double> old_times(cpu::kernel::time_rows * kernel_cores);
+    vector<double> new_times(old_times.size());
+    vector<long long> usage(static_cast<size_t>(cpu::CpuField::count) * kernel_cores);
+
+    for (size_t i = 0; i < old_times.size(); i++) {
+        old_times[i] = (double) (4000000 + i * 7);
+        new_times[i] = old_times[i] + (double) (i % 97) * (i / kernel_cores == cpu::kernel::totals_row ? 40 : 1);
+    }
+
+    vector<cpu::kernel::Isa> isas{cpu::kernel::Isa::scalar};
+
+    if (cpu::kernel::get_supported_isa() != cpu::kernel::Isa::scalar) isas.push_back(cpu::kernel::get_supported_isa());
+
+    for (const auto isa : isas) {
+        run("cpu::kernel::compute_usage(), " + string(cpu::kernel::get_isa_name(isa)), [&]() {
+            cpu::kernel::compute_usage(new_times.data(), old_times.data(), kernel_cores, usage.data(), isa);
+            nb::doNotOptimizeAway(usage.data());
+        });
+    }
+
+    /** utils */
+    const fs::path loadavg = shared::proc_path / "loadavg";
+
+    run("ut::file::read(loadavg)", [&]() {
+        auto content = ut::file::read(loadavg);
+        nb::doNotOptimizeAway(content);
+    });
+
+    const string stat_line = "cpu0 4000000 12500 200000 4000000 6250 0 3125 0 0 0";
+
+    run("ut::str::split(stat line)", [&]() {
+        auto fields = ut::str::split(stat_line);
+        nb::doNotOptimizeAway(fields);
+    });
+
+    std::printf("\n| %14s | %14s | %s\n|---------------:|---------------:|:------\n", "allocs/call", "bytes/call", "benchmark");
+
+    for (const auto& [name, count, bytes] : allocations) {
+        std::printf("| %14.1f | %14.1f | `%s`\n", count, bytes, name.c_str());
+    }
+
+    //? Per stage cost of the last collect() of each collector, only with -DBHWINFO_INSTRUMENT=ON
+    if constexpr (ut::stats::enabled) {
+        std::printf("\n| %14s | %14s | stage\n|---------------:|---------------:|:------\n", "collector", "ns");
+
+        for (const auto& [collector_name, stats] : {std::pair{"cpu", &cpu_collector.get_collect_stats()},
+                                                    std::pair{"mem", &mem_collector.get_collect_stats()},
+                                                    std::pair{"net", &net_collector.get_collect_stats()}}) {
+            for (size_t i = 0; i < ut::stats::stage_names.size(); i++) {
+                if (stats->durations[i].count() == 0) continue;
+
+                std::printf("| %14s | %14lld | `%s`\n", collector_name, (long long) stats->durations[i].count(),
+                            string(ut::stats::stage_names[i]).c_str());
+            }
+
+            std::printf("| %14s | %14llu | files opened\n| %14s | %14llu | bytes read\n",
+                        collector_name, (unsigned long long) stats->files_opened,
+                        collector_name, (unsigned long long) stats->bytes_read);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_FAKE_TREE_HPP
+#define HWINFO_FAKE_TREE_HPP
+
+#include <cstdlib>
+#include <fstream>
+#include "../include/ut.hpp"
+
+namespace bench {
+    /**
+     * Throwaway /proc and /sys tree with <cores> cpu lines in stat and cpuinfo, an SMT topology, a coretemp hwmon
+     * with one sensor per physical core and <mounts> ext4 mounts in self/mounts, each backed by a /sys/block stat file
+     * and a /proc/diskstats row, and lo, eth0 and 64 veth interfaces in /proc/net/dev. From 4 cores on they are split
+     * over two NUMA nodes the way two sockets are, each with its own meminfo and vmstat.
+     * Every mountpoint is a directory inside the tree so statvfs() succeeds without touching real filesystems.
+     * Removed again when the FakeTree is destroyed.
+     */
+    class FakeTree {
+    private:
+        fs::path root;
+
+        static void write(const fs::path& path, const string& content) {
+            fs::create_directories(path.parent_path());
+
+            std::ofstream out(path);
+            out << content;
+
+            if (not out.good()) throw std::runtime_error("Failed to write " + path.string());
+        }
+
+        static string cpu_line(const string& name, const long long& base) {
+            return name + ' ' + std::to_string(base * 4) + ' ' + std::to_string(base / 8) + ' ' +
+                   std::to_string(base * 2) + ' ' + std::to_string(base * 40) + ' ' + std::to_string(base / 16) +
+                   " 0 " + std::to_string(base / 32) + " 0 0 0\n";
+        }
+
+    public:
+        FakeTree(const int& cores, const int& mounts) {
+            string tmpl = (fs::temp_directory_path() / "bhwinfo_bench_XXXXXX").string();
+
+            if (mkdtemp(tmpl.data()) == nullptr) throw std::runtime_error("Failed to create " + tmpl);
+
+            root = tmpl;
+
+            const fs::path proc = get_proc_path();
+
+            string stat = cpu_line("cpu", 100000LL * cores);
+            string cpuinfo;
+
+            for (int i = 0; i < cores; i++) {
+                stat += cpu_line("cpu" + std::to_string(i), 100000 + i * 37);
+                cpuinfo += "processor\t: " + std::to_string(i) + "\nvendor_id\t: AuthenticAMD\n"
+                           "model name\t: AMD EPYC 7763 64-Core Processor\ncpu MHz\t\t: 2300.000\n\n";
+            }
+
+            stat += "intr 1234567 0 0 0\nctxt 987654321\nbtime 1700000000\nprocesses 123456\n"
+                    "procs_running 2\nprocs_blocked 0\nsoftirq 1234 0 0 0 0 0 0 0 0 0 0\n";
+
+            write(proc / "stat", stat);
+            write(proc / "cpuinfo", cpuinfo);
+            write(proc / "loadavg", "1.25 0.75 0.50 3/1024 123456\n");
+            write(proc / "uptime", "123456.78 987654.32\n");
+            write(proc / "filesystems", "nodev\tsysfs\nnodev\ttmpfs\nnodev\tproc\n\text4\n\txfs\n\tvfat\n");
+
+            write(proc / "meminfo",
+                  "MemTotal:       263859740 kB\nMemFree:        123456789 kB\nMemAvailable:   200123456 kB\n"
+                  "Buffers:          1234567 kB\nCached:          56789012 kB\nSwapCached:         12345 kB\n"
+                  "Active:          34567890 kB\nInactive:        23456789 kB\nShmem:             345678 kB\n"
+                  "SReclaimable:     2345678 kB\nSUnreclaim:        456789 kB\nSwapTotal:       16777212 kB\n"
+                  "SwapFree:        16700000 kB\nDirty:                1234 kB\nWriteback:               0 kB\n"
+                  "Committed_AS:    78901234 kB\nHugePages_Total:       0\nHugePages_Free:        0\n"
+                  "HugePages_Rsvd:        0\nHugePages_Surp:        0\nHugepagesize:       2048 kB\n");
+
+            string mount_table = "proc /proc proc rw,nosuid,nodev,noexec,relatime 0 0\n"
+                                 "sysfs /sys sysfs rw,nosuid,nodev,noexec,relatime 0 0\n";
+
+            for (int i = 0; i < mounts; i++) {
+                const fs::path mountpoint = root / "mnt" / ("disk" + std::to_string(i));
+                fs::create_directories(mountpoint);
+
+                mount_table += "/dev/fake" + std::to_string(i) + ' ' + mountpoint.string() + " ext4 rw,relatime 0 0\n";
+            }
+
+            write(proc / "self" / "mounts", mount_table);
+
+            const fs::path sys = get_sys_path();
+
+            write(sys / "devices/system/cpu/online", "0-" + std::to_string(cores - 1) + '\n');
+
+            //? Siblings stay on the same node, node 0 gets the first quarter of the cores and their siblings
+            const int nodes = cores >= 4 ? 2 : 1;
+
+            for (int node = 0; node < nodes; node++) {
+                const fs::path dir = sys / "devices/system/node" / ("node" + std::to_string(node));
+                const string prefix = "Node " + std::to_string(node) + ' ';
+                const int quarter = cores / 4;
+
+                write(dir / "cpulist", nodes == 1 ? "0-" + std::to_string(cores - 1) + '\n'
+                        : std::to_string(node * quarter) + '-' + std::to_string(node * quarter + quarter - 1) + ',' +
+                          std::to_string(cores / 2 + node * quarter) + '-' + std::to_string(node == 0 ? cores / 2 + quarter - 1 : cores - 1) + '\n');
+                write(dir / "meminfo", prefix + "MemTotal:       " + std::to_string(67108864 / nodes) + " kB\n" +
+                                       prefix + "MemFree:        " + std::to_string(node == 0 ? 4194304 : 25165824) + " kB\n" +
+                                       prefix + "MemUsed:        " + std::to_string(67108864 / nodes - (node == 0 ? 4194304 : 25165824)) + " kB\n" +
+                                       prefix + "Active(file):    2097152 kB\n" + prefix + "Inactive(file):  1048576 kB\n" +
+                                       prefix + "FilePages:       3145728 kB\n" + prefix + "Slab:             524288 kB\n" +
+                                       prefix + "SReclaimable:     262144 kB\n" + prefix + "SUnreclaim:       262144 kB\n" +
+                                       prefix + "HugePages_Total:     0\n" + prefix + "HugePages_Free:      0\n");
+                write(dir / "vmstat", "nr_free_pages 1048576\nnr_zone_inactive_anon 65536\nnr_zone_active_anon 65536\n"
+                                      "nr_zone_inactive_file 262144\nnr_zone_active_file 524288\nnr_zone_unevictable 0\n"
+                                      "nr_zone_write_pending 16\nnr_mlock 0\nnr_bounce 0\nnr_zspages 0\nnr_free_cma 0\n"
+                                      "numa_hit 123456789\nnuma_miss " + std::to_string(node * 4567) + "\nnuma_foreign 0\n"
+                                      "numa_interleave 1024\nnuma_local 123456789\nnuma_other 0\nnr_inactive_anon 65536\n");
+            }
+
+            //? Two threads per physical core, logical cores i and i + cores / 2 are siblings like on x86
+            const int physical = std::max(cores / 2, 1);
+
+            for (int i = 0; i < cores; i++) {
+                const fs::path topology = sys / "devices/system/cpu" / ("cpu" + std::to_string(i)) / "topology";
+                const int core = i % physical;
+
+                //? One cpufreq policy per core, like intel_pstate
+                const fs::path policy = sys / "devices/system/cpu/cpufreq" / ("policy" + std::to_string(i));
+
+                write(policy / "scaling_cur_freq", std::to_string(2300000 + i % 8 * 100000) + '\n');
+                write(policy / "affected_cpus", std::to_string(i) + '\n');
+
+                write(topology / "physical_package_id", "0\n");
+                write(topology / "core_id", std::to_string(core) + '\n');
+                write(topology / "thread_siblings_list", std::to_string(core) +
+                      (core + physical < cores ? ',' + std::to_string(core + physical) : "") + '\n');
+            }
+
+            //? hwmon entries are symlinks into /sys/devices, like on a real system
+            const fs::path hwmon = sys / "devices/platform/coretemp.0/hwmon/hwmon0";
+
+            write(hwmon / "name", "coretemp\n");
+            write(hwmon / "temp1_label", "Package id 0\n");
+            write(hwmon / "temp1_input", "45000\n");
+            write(hwmon / "temp1_max", "80000\n");
+            write(hwmon / "temp1_crit", "100000\n");
+
+            for (int i = 0; i < physical; i++) {
+                const string sensor = "temp" + std::to_string(i + 2);
+
+                write(hwmon / (sensor + "_label"), "Core " + std::to_string(i) + '\n');
+                write(hwmon / (sensor + "_input"), std::to_string(40000 + i % 20 * 500) + '\n');
+                write(hwmon / (sensor + "_max"), "80000\n");
+                write(hwmon / (sensor + "_crit"), "100000\n");
+            }
+
+            fs::create_directories(sys / "class/hwmon");
+            fs::create_directory_symlink("../../devices/platform/coretemp.0/hwmon/hwmon0", sys / "class/hwmon/hwmon0");
+
+            string diskstats;
+
+            for (int i = 0; i < mounts; i++) {
+                const string name = "fake" + std::to_string(i);
+                const string counters = "   12345        0  2468024     4321   67890        0  9876543    12345        0    23456    34567";
+
+                write(sys / "block" / name / "stat", counters + '\n');
+                write(sys / "block" / name / "dev", "253:" + std::to_string(i) + '\n');
+                diskstats += " 253 " + std::to_string(i) + ' ' + name + counters + " 0 0 0 0 0 0\n";
+            }
+
+            write(proc / "diskstats", diskstats);
+            write_interfaces(64);
+
+            //? A pod limited to 2 cores and 4 GiB, pinned to the first two cores of the first socket
+            const fs::path pod = get_cgroup_path();
+
+            write(sys / "fs/cgroup/cgroup.controllers", "cpuset cpu io memory pids\n");
+            write(pod / "cgroup.controllers", "cpuset cpu io memory pids\n");
+            write(pod / "cpuset.cpus.effective", std::min(cores, 2) > 1 ? "0-1\n" : "0\n");
+            write(pod / "cpu.max", "200000 100000\n");
+            write(pod / "cpu.stat", "usage_usec 123456789\nuser_usec 100000000\nsystem_usec 23456789\n"
+                                    "nr_periods 4567\nnr_throttled 12\nthrottled_usec 345678\n");
+            write(pod / "memory.current", "1073741824\n");
+            write(pod / "memory.max", "4294967296\n");
+            write(pod / "memory.swap.current", "0\n");
+            write(pod / "memory.swap.max", "max\n");
+            write(pod / "memory.stat", "anon 536870912\nfile 402653184\nkernel 67108864\nkernel_stack 1048576\n"
+                                       "pagetables 4194304\nshmem 1048576\nfile_mapped 16777216\nfile_dirty 4096\n"
+                                       "file_writeback 0\nanon_thp 0\ninactive_anon 268435456\nactive_anon 268435456\n"
+                                       "inactive_file 201326592\nactive_file 201326592\nunevictable 0\n"
+                                       "slab_reclaimable 33554432\nslab_unreclaimable 16777216\n");
+            write(pod / "io.stat", "253:0 rbytes=1048576 wbytes=2097152 rios=256 wios=512 dbytes=0 dios=0\n");
+            write(proc / "self" / "cgroup", "0::/kubepods/pod\n");
+        }
+
+        //* List lo, eth0 and the <veths> veth interfaces from <first> on in /proc/net/dev
+        void write_interfaces(const int& veths, const int& first = 0) const {
+            string netdev = "Inter-|   Receive                                                |  Transmit\n"
+                            " face |bytes    packets errs drop fifo frame compressed multicast|"
+                            "bytes    packets errs drop fifo colls carrier compressed\n";
+
+            for (const string name : {"lo", "eth0"}) {
+                netdev += string(6 - name.size(), ' ') + name +
+                          ": 987654321  654321    0    0    0     0          0         0 123456789  321456    0    0    0     0       0          0\n";
+            }
+
+            for (int i = first; i < first + veths; i++) {
+                netdev += "veth" + std::to_string(0x1a2b00 + i) +
+                          ":  12345678   23456    0    2    0     0          0         0  87654321   65432    1    0    0     0       0          0\n";
+            }
+
+            write(get_proc_path() / "net/dev", netdev);
+        }
+
+        ~FakeTree() {
+            std::error_code ec;
+            fs::remove_all(root, ec);
+        }
+
+        FakeTree(const FakeTree&) = delete;
+        FakeTree& operator=(const FakeTree&) = delete;
+
+        [[nodiscard]] fs::path get_proc_path() const {
+            return root / "proc";
+        }
+
+        [[nodiscard]] fs::path get_sys_path() const {
+            return root / "sys";
+        }
+
+        [[nodiscard]] fs::path get_cgroup_path() const {
+            return get_sys_path() / "fs/cgroup/kubepods/pod";
+        }
+    };
+}
+
+#endif //HWINFO_FAKE_TREE_HPP
@@ -17,7 +17,19 @@
 #ifndef HWINFO_LIBHWINFO_HPP
 #define HWINFO_LIBHWINFO_HPP
 
+#include "include/cgroup.hpp"
+#include "include/collector.hpp"
 #include "include/cpu.hpp"
+#include "include/cpu_kernel.hpp"
+#include "include/exposition.hpp"
+#include "include/fleet.hpp"
+#include "include/history_store.hpp"
 #include "include/mem.hpp"
+#include "include/net.hpp"
+#include "include/proc.hpp"
+#include "include/rollup.hpp"
+#include "include/sampler.hpp"
+#include "include/snapshot.hpp"
+#include "include/threshold.hpp"
 
 #endif //HWINFO_LIBHWINFO_HPP
@@ -40,20 +40,24 @@ void set_interval(auto function, int interval) {
 }
 
 int main() {
-    auto cpu_data_collector = cpu::DataCollector{};
-    auto mem_data_collector = mem::DataCollector{};
+    auto sampler = bhwinfo::Sampler{{
+        .cpu_interval = std::chrono::milliseconds(1000),
+        .mem_interval = std::chrono::milliseconds(1000)
+    }};
+
+    sampler.start();
 
     set_interval([&]() {
         system("clear");
 
-        cpu::Data cpu_data = cpu_data_collector.collect();
+        cpu::Data cpu_data = sampler.get_cpu_data();
 
         auto freq = cpu_data.get_cpu_frequency();
         auto load_avg = cpu_data.get_average_load();
         auto core_load = cpu_data.get_core_load();
         auto cpu_usage = cpu_data.get_cpu_usage();
 
-        mem::Data mem_data = mem_data_collector.collect();
+        mem::Data mem_data = sampler.get_mem_data();
 
         vector<ui::Element> cores_ui;
 
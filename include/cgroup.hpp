@@ -0,0 +1,100 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_CGROUP_HPP
+#define HWINFO_CGROUP_HPP
+
+#include "ut.hpp"
+
+namespace cgroup {
+    //* Limit files containing "max"
+    inline constexpr uint64_t unlimited = UINT64_MAX;
+
+    //* Counters of cpu.stat, in µs except for the period counts
+    struct CpuStat {
+        uint64_t usage_usec{};
+        uint64_t user_usec{};
+        uint64_t system_usec{};
+        uint64_t nr_periods{};
+        uint64_t nr_throttled{};
+        uint64_t throttled_usec{};
+    };
+
+    //* One device row of io.stat, counted for whole disks only
+    struct IoStat {
+        uint64_t devno{}; // makedev(major, minor)
+        uint64_t rbytes{};
+        uint64_t wbytes{};
+        uint64_t rios{};
+        uint64_t wios{};
+    };
+
+    //* Group of <pid> from <proc>/<pid>/cgroup under <sys>/fs/cgroup, throws std::runtime_error without a cgroup v2 entry
+    fs::path find_group(const string& pid = "self");
+
+    /**
+     * One cgroup v2 group. Its files stay open between reads like every other collector file, so reading
+     * the counters of a container costs a few pread() calls. cpuset.cpus.effective is inherited from the
+     * closest parent that has one, a group without cpuset controller gets every core.
+     */
+    class Group {
+    public:
+        explicit Group(fs::path path); // throws std::runtime_error when <path> isn't a cgroup v2 group
+
+        Group(const Group&) = delete;
+        Group& operator=(const Group&) = delete;
+
+        [[nodiscard]] const fs::path& get_path() const;
+
+        //* Cores of cpuset.cpus.effective below <core_count>, every one of them when no cpuset applies
+        [[nodiscard]] vector<int> read_cpus(int core_count) const;
+
+        //* Cores worth of cpu time cpu.max allows, 0 without a quota
+        double read_cpu_limit();
+
+        //* Throws std::runtime_error when cpu.stat can't be read
+        const CpuStat& read_cpu_stat();
+        [[nodiscard]] const CpuStat& get_cpu_stat() const; // of the last read_cpu_stat()
+
+        uint64_t read_memory_current(); // throws std::runtime_error when memory.current can't be read
+        uint64_t read_memory_max(); // unlimited for "max" or without memory controller
+        uint64_t read_swap_current(); // 0 without swap accounting
+        uint64_t read_swap_max(); // unlimited for "max" or without swap accounting
+
+        //* memory.stat content, valid until the next call
+        string_view read_memory_stat();
+
+        //* Rows of io.stat, reusing the returned vector
+        const vector<IoStat>& read_io_stat();
+
+    private:
+        fs::path path;
+        ut::file::CachedReader cpu_stat_reader;
+        ut::file::CachedReader cpu_max_reader;
+        ut::file::CachedReader memory_current_reader;
+        ut::file::CachedReader memory_max_reader;
+        ut::file::CachedReader swap_current_reader;
+        ut::file::CachedReader swap_max_reader;
+        ut::file::CachedReader memory_stat_reader;
+        ut::file::CachedReader io_stat_reader;
+        CpuStat cpu_stat;
+        vector<IoStat> io_stat;
+
+        static uint64_t read_limit(ut::file::CachedReader& reader);
+    };
+}
+
+#endif //HWINFO_CGROUP_HPP
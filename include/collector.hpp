@@ -0,0 +1,66 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_COLLECTOR_HPP
+#define HWINFO_COLLECTOR_HPP
+
+#include <chrono>
+#include "cpu.hpp"
+#include "mem.hpp"
+#include "net.hpp"
+
+namespace bhwinfo {
+    /** Values of every subsystem from one Collector pass */
+    struct Sample {
+        std::chrono::steady_clock::time_point time{}; // the time base every rate in the sample was measured against
+        int64_t timestamp_ns{}; // system clock at the same moment, for storing and sending samples
+        uint64_t sequence{}; // number of the pass, starts at 1
+        cpu::Data cpu;
+        mem::Data mem;
+        net::Data net;
+    };
+
+    /**
+     * Runs every collector in a single pass against one steady clock timestamp, so cpu load, disk and
+     * network rates of a Sample cover the same interval. The collectors keep their files open between passes.
+     */
+    class Collector {
+    public:
+        Collector();
+
+        //* Collect for the cgroup v2 group at <cgroup> instead of the host, see cgroup::find_group()
+        //* Network counters stay those of the network namespace the caller runs in
+        explicit Collector(const fs::path& cgroup);
+
+        Sample collect();
+
+        //* Collect into <out> in place, a caller that keeps it and passes it again on every call doesn't allocate
+        void collect_into(Sample& out);
+
+        [[nodiscard]] cpu::DataCollector& get_cpu_collector();
+        [[nodiscard]] mem::DataCollector& get_mem_collector();
+        [[nodiscard]] net::DataCollector& get_net_collector();
+        [[nodiscard]] const uint64_t& get_sequence() const; // passes completed so far
+
+    private:
+        cpu::DataCollector cpu_collector;
+        mem::DataCollector mem_collector;
+        net::DataCollector net_collector;
+        uint64_t sequence{};
+    };
+}
+
+#endif //HWINFO_COLLECTOR_HPP
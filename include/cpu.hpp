@@ -18,7 +18,13 @@
 #ifndef HWINFO_CPU_HPP
 #define HWINFO_CPU_HPP
 
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
 #include "unordered_map"
+#include "cgroup.hpp"
 #include "ut.hpp"
 
 using std::array;
@@ -27,6 +33,19 @@ using namespace std::literals;
 namespace fs = std::filesystem;
 
 namespace cpu {
+    /** Time fields of a /proc/stat cpu line in kernel order, followed by the derived total */
+    enum class CpuField : size_t {
+        user, nice, system, idle, iowait, irq, softirq, steal, guest, guest_nice, total, count
+    };
+
+    //* Number of time fields kept from each /proc/stat cpu line (user..guest_nice)
+    inline constexpr size_t cpu_time_fields = 10;
+
+    inline constexpr array<string_view, static_cast<size_t>(CpuField::count)> cpu_field_names {
+        "user"sv, "nice"sv, "system"sv, "idle"sv, "iowait"sv,
+        "irq"sv, "softirq"sv, "steal"sv, "guest"sv, "guest_nice"sv, "total"sv
+    };
+
     class CpuFrequency {
     private:
         double value{};
@@ -54,19 +73,11 @@ namespace cpu {
     };
 
     class CpuUsage {
-        long long total_percent{};
-        long long user_percent{};
-        long long nice_percent{};
-        long long system_percent{};
-        long long idle_percent{};
-        long long iowait_percent{};
-        long long irq_percent{};
-        long long softirq_percent{};
-        long long steal_percent{};
-        long long guest_percent{};
-        long long guest_nice_percent{};
+        ut::type::enum_array<CpuField, long long> percent{};
 
     public:
+        explicit CpuUsage(const ut::type::enum_array<CpuField, long long>& percent);
+
         CpuUsage(
             const long long int& total_percent,
             const long long int& user_percent,
@@ -92,54 +103,212 @@ namespace cpu {
         [[nodiscard]] const long long int& get_steal_percent() const;
         [[nodiscard]] const long long int& get_guest_percent() const;
         [[nodiscard]] const long long int& get_guest_nice_percent() const;
+        [[nodiscard]] const long long int& get_percent(CpuField field) const;
+    };
+
+    //* Position of one logical core, -1 where the kernel doesn't report it
+    struct CoreTopology {
+        int socket{-1};
+        int core{-1}; // physical core id within the socket
+        int numa_node{-1};
+        vector<int> siblings; // logical cores sharing the physical core, including this one
+    };
+
+    /**
+     * Static identity of the cpu. The name and core count are read once per process for the current
+     * proc and sys roots, the per core sysfs topology scan only runs on the first access to it.
+     */
+    class Topology {
+    public:
+        //* Topology of shared::proc_path and shared::sys_path, built on the first call and then shared
+        static std::shared_ptr<const Topology> get();
+
+        Topology(fs::path proc, fs::path sys);
+
+        [[nodiscard]] const string& get_name() const;
+        [[nodiscard]] const int& get_core_count() const; // logical cores, highest core number + 1
+        [[nodiscard]] const vector<CoreTopology>& get_cores() const;
+        [[nodiscard]] const int& get_physical_core_count() const;
+        [[nodiscard]] const int& get_socket_count() const;
+        [[nodiscard]] const int& get_numa_node_count() const;
+        [[nodiscard]] const vector<int>& get_numa_nodes() const; // number of every node directory in sysfs, ascending
+        [[nodiscard]] const int& get_threads_per_core() const;
+
+    private:
+        struct Layout {
+            vector<CoreTopology> cores;
+            vector<int> numa_nodes;
+            int physical_core_count{1};
+            int socket_count{1};
+            int numa_node_count{1};
+            int threads_per_core{1};
+        };
+
+        fs::path proc;
+        fs::path sys;
+        string name;
+        int core_count{};
+        mutable std::once_flag layout_once;
+        mutable Layout layout;
+
+        static string read_name(const fs::path& proc, const fs::path& sys);
+        static int read_core_count(const fs::path& proc, const fs::path& sys);
+        const Layout& get_layout() const;
     };
 
     class StaticValuesAware {
     protected:
-        string cpu_name;
+        std::shared_ptr<const string> cpu_name; // never null, shared by the collector and every Data it fills
         int core_count{};
         long long critical_temperature{};
 
         StaticValuesAware();
-        StaticValuesAware(const string& cpu_name, int core_count, long long int critical_temperature);
+        StaticValuesAware(std::shared_ptr<const string> cpu_name, int core_count, long long int critical_temperature);
     };
 
     class Data : StaticValuesAware {
+        friend class DataCollector;
+
     private:
         CpuUsage cpu_usage{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-        int64_t cpu_temp;
+        int64_t cpu_temp{};
         CpuAvgLoad cpu_load_avg{0, 0, 0};
         vector<long long> core_load;
+        vector<long long> core_frequency;
+        vector<int64_t> core_temp;
+        vector<long long> core_usage;
+        vector<int> numa_nodes;
+        vector<long long> node_usage;
         CpuFrequency cpu_frequency{0, ""};
 
     public:
+        Data();
+
+        //* The vectors are taken by value, pass them as rvalues to move them in without a copy
         Data(
             const CpuUsage& cpu_usage,
             const int64_t& cpu_temp,
             const CpuAvgLoad& cpu_load_avg,
-            const vector<long long>& core_load,
-            const CpuFrequency& cpu_frequency,
+            vector<long long> core_load,
+            CpuFrequency cpu_frequency,
             const string& cpu_name,
             const int& core_count,
-            const long long& critical_temperature
+            const long long& critical_temperature,
+            vector<long long> core_frequency = {},
+            vector<int64_t> core_temp = {},
+            vector<long long> core_usage = {},
+            vector<int> numa_nodes = {},
+            vector<long long> node_usage = {}
+        );
+
+        //* The same with a name shared with other Data, copying it only copies the pointer
+        Data(
+            const CpuUsage& cpu_usage,
+            const int64_t& cpu_temp,
+            const CpuAvgLoad& cpu_load_avg,
+            vector<long long> core_load,
+            CpuFrequency cpu_frequency,
+            std::shared_ptr<const string> cpu_name,
+            const int& core_count,
+            const long long& critical_temperature,
+            vector<long long> core_frequency = {},
+            vector<int64_t> core_temp = {},
+            vector<long long> core_usage = {},
+            vector<int> numa_nodes = {},
+            vector<long long> node_usage = {}
         );
 
         [[nodiscard]] const CpuUsage& get_cpu_usage() const;
         [[nodiscard]] const int64_t& get_cpu_temp() const;
-        [[nodiscard]] const CpuAvgLoad& get_average_load();
-        [[nodiscard]] const vector<long long>& get_core_load();
-        [[nodiscard]] const CpuFrequency& get_cpu_frequency();
-        [[nodiscard]] const string& get_cpu_mame();
+        [[nodiscard]] const CpuAvgLoad& get_average_load() const;
+        [[nodiscard]] const vector<long long>& get_core_load() const;
+        [[nodiscard]] const vector<long long>& get_core_frequency() const; // kHz per core, 0 where cpufreq doesn't report one
+        [[nodiscard]] const vector<int64_t>& get_core_temp() const; // °C per core, empty without per core sensors
+        [[nodiscard]] std::span<const long long> get_core_usage(CpuField field) const; // percent per core, total is core_load
+        [[nodiscard]] const vector<int>& get_numa_nodes() const; // sysfs number of every node with cores in core_load
+        [[nodiscard]] std::span<const long long> get_node_usage(CpuField field) const; // percent per node, averaged over its cores
+        [[nodiscard]] const CpuFrequency& get_cpu_frequency() const;
+        [[nodiscard]] const string& get_cpu_mame() const;
         [[nodiscard]] const int& get_core_count() const;
         [[nodiscard]] const long long& get_cpu_critical_temperature() const;
     };
 
+    /**
+     * Fixed capacity history of cpu samples in structure of arrays layout:
+     * one contiguous ring per core and one ring per CpuUsage field.
+     * Storage is allocated once, so spans returned by the getters stay valid for the lifetime of the History.
+     */
+    class History {
+    public:
+        //* Ring content in chronological order, <older> samples first, then <newer>
+        struct Window {
+            std::span<const long long> older;
+            std::span<const long long> newer;
+
+            [[nodiscard]] size_t size() const;
+            [[nodiscard]] const long long& operator[](size_t index) const; // 0 is the oldest sample
+            [[nodiscard]] const long long& latest() const; // window must not be empty
+        };
+
+        History() = default;
+        History(size_t capacity, int core_count);
+
+        void push(const ut::type::enum_array<CpuField, long long>& usage, const vector<long long>& core_load);
+        void clear();
+
+        [[nodiscard]] const size_t& get_capacity() const;
+        [[nodiscard]] const size_t& get_size() const;
+        [[nodiscard]] const size_t& get_head() const; // ring slot the next sample is written to
+        [[nodiscard]] const int& get_core_count() const;
+        [[nodiscard]] Window get_core_load(int core) const;
+        [[nodiscard]] Window get_usage(CpuField field) const;
+        [[nodiscard]] std::span<const long long> get_core_ring(int core) const;
+        [[nodiscard]] std::span<const long long> get_usage_ring(CpuField field) const;
+
+    private:
+        size_t capacity{};
+        size_t size{};
+        size_t head{};
+        int core_count{};
+        vector<long long> core_rings;
+        vector<long long> usage_rings;
+
+        [[nodiscard]] Window window(std::span<const long long> ring) const;
+    };
+
     class DataCollector : StaticValuesAware {
     public:
         DataCollector();
 
+        /**
+         * Collect for the cgroup v2 group at <cgroup>, see cgroup::find_group(), an empty path collects the host.
+         * Total usage comes from its cpu.stat against the cores cpu.max and its cpuset allow, only user and system
+         * time are accounted there. Per core values are restricted to cpuset.cpus.effective as read here.
+         */
+        explicit DataCollector(const fs::path& cgroup);
+
         Data collect();
 
+        //* Collect with <now> as the time of the sample instead of the current time, see bhwinfo::Collector
+        Data collect(std::chrono::steady_clock::time_point now);
+
+        //* Collect into <out>, its vectors are reused so a caller keeping it around doesn't allocate once they are sized
+        void collect_into(Data& out);
+        void collect_into(Data& out, std::chrono::steady_clock::time_point now);
+
+        [[nodiscard]] const Topology& get_topology() const;
+        [[nodiscard]] const vector<int>& get_core_ids() const; // host core number of every core in Data
+        [[nodiscard]] const cgroup::Group* get_cgroup() const; // nullptr when collecting the host
+        [[nodiscard]] const vector<string>& get_available_sensors() const;
+        [[nodiscard]] const ut::stats::CollectStats& get_collect_stats() const; // of the last collect(), zeroed without BHWINFO_INSTRUMENT
+
+        //* Rediscover sensors in the background, collect() also does this by itself when hwmon devices are hotplugged
+        void rescan_sensors();
+
+        //* Keep the last <capacity> samples of every collect() in place, 0 disables the history
+        void enable_history(size_t capacity);
+        [[nodiscard]] const History& get_history() const;
+
     private:
         struct Sensor {
             fs::path path;
@@ -147,57 +316,80 @@ namespace cpu {
             int64_t temp{}; // defaults to 0
             int64_t high{}; // defaults to 0
             int64_t crit{}; // defaults to 0
+            ut::file::CachedReader reader{};
+            fs::path dir; // hwmon or thermal zone directory the sensor was found in
+        };
+        //* Result of a sensor discovery pass, only directories not scanned before are read
+        struct SensorScan {
+            vector<fs::path> dirs; // every sensor directory present
+            vector<std::pair<string, Sensor>> added;
+        };
+        //* One cpufreq policy, its scaling_cur_freq applies to every core in affected_cpus
+        struct FreqPolicy {
+            ut::file::CachedReader reader;
+            vector<int> cores;
         };
         struct CpuInfo {
-            std::unordered_map<string, long long> cpu_percent = {
-                    {"total", 0},
-                    {"user", 0},
-                    {"nice", 0},
-                    {"system", 0},
-                    {"idle", 0},
-                    {"iowait", 0},
-                    {"irq", 0},
-                    {"softirq", 0},
-                    {"steal", 0},
-                    {"guest", 0},
-                    {"guest_nice", 0}
-            };
+            ut::type::enum_array<CpuField, long long> cpu_percent{};
             vector<long long> core_percent;
+            vector<long long> core_usage; // CpuField::count rows of core_count percentages
+            vector<long long> node_usage; // CpuField::count rows of one percentage per numa node
+            vector<long long> core_frequency;
+            vector<int64_t> core_temp;
             long long critical_temperature{};
             array<float, 3> load_avg{};
         };
-        std::unordered_map<string, long long> CpuOld = {
-                {"totals", 0},
-                {"idles", 0},
-                {"user", 0},
-                {"nice", 0},
-                {"system", 0},
-                {"idle", 0},
-                {"iowait", 0},
-                {"irq", 0},
-                {"softirq", 0},
-                {"steal", 0},
-                {"guest", 0},
-                {"guest_nice", 0}
+        struct OldTimes {
+            long long totals{};
+            long long idles{};
         };
+        OldTimes cpu_old;
+        array<long long, cpu_time_fields> cpu_old_times{};
         string cpu_sensor;
         vector<string> core_sensors;
-        vector<long long> core_old_totals;
-        vector<long long> core_old_idles;
+        vector<int> core_sensor_map; // core -> index in core_sensors
+        vector<fs::path> sensor_dirs;
+        ut::uevent::Monitor uevents;
+        std::future<SensorScan> rescan;
+        vector<double> core_times; // kernel::time_rows rows of core_count times, filled by the /proc/stat parse
+        vector<double> core_old_times; // the same from the previous collect()
+        ut::file::CachedReader stat_reader;
+        ut::file::CachedReader loadavg_reader;
+        ut::file::CachedReader freq_reader;
+        ut::file::CachedReader cpuinfo_reader;
+        vector<FreqPolicy> freq_policies;
+        double cpuinfo_hz{};
+        std::chrono::steady_clock::time_point cpuinfo_time{};
+        std::shared_ptr<const Topology> topology;
         vector<string> available_sensors = {"Auto"};
         std::unordered_map<string, Sensor> found_sensors;
         CpuInfo current_cpu;
+        History history;
+        ut::stats::CollectStats collect_stats;
         bool got_sensors;
-        const array<string ,10> time_names {
-                "user"s, "nice"s, "system"s, "idle"s, "iowait"s,
-                "irq"s, "softirq"s, "steal"s, "guest"s, "guest_nice"s
-        };
+        std::unique_ptr<cgroup::Group> group;
+        vector<int> core_ids;
+        vector<int> core_slots; // host core number -> index in core_ids, -1 outside the cpuset
+        vector<int> numa_nodes; // sysfs numbers of the nodes that have collected cores
+        vector<int> core_nodes; // index in core_ids -> index in numa_nodes, -1 for cores no node lists
+        vector<int> node_core_counts; // collected cores of every node in numa_nodes
+        cgroup::CpuStat cgroup_old{};
+        std::chrono::steady_clock::time_point cgroup_old_time{};
 
+        //* Parse the time fields of one /proc/stat cpu line into <times>, returns the number of fields kept
+        static size_t parse_stat_line(string_view line, array<long long, cpu_time_fields>& times, long long& totals, long long& idles);
+        static SensorScan scan_sensors(const fs::path& sys, const vector<fs::path>& known, const vector<fs::path>& cpu_dirs);
         bool get_sensors();
+        void merge_sensors(SensorScan scan);
+        void map_core_sensors();
         void update_sensors();
-        int get_core_count();
-        CpuFrequency get_cpu_frequency();
-        string get_cpu_mame();
+        CpuFrequency get_cpu_frequency(std::chrono::steady_clock::time_point now);
+        double read_cpuinfo_frequency(std::chrono::steady_clock::time_point now);
+        void get_freq_policies();
+        void update_core_frequency();
+        void update_cgroup_usage(std::chrono::steady_clock::time_point now);
+        void index_numa_nodes();
+        void update_node_usage();
     };
 }
 
@@ -0,0 +1,49 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_CPU_KERNEL_HPP
+#define HWINFO_CPU_KERNEL_HPP
+
+#include "cpu.hpp"
+
+/**
+ * Per core usage kernel of cpu::DataCollector.
+ *
+ * Core times are kept in structure of arrays layout, one row of <cores> values per time field
+ * followed by a totals and an idles row. A pass over two such blocks turns the deltas between them
+ * into rounded and clamped percentages for every core and every CpuField at once.
+ */
+namespace cpu::kernel {
+    enum class Isa { scalar, avx2, neon };
+
+    inline constexpr size_t totals_row = cpu_time_fields;
+    inline constexpr size_t idles_row = cpu_time_fields + 1;
+    inline constexpr size_t time_rows = cpu_time_fields + 2;
+
+    //* Best instruction set this cpu runs, detected once
+    [[nodiscard]] Isa get_supported_isa();
+    [[nodiscard]] string_view get_isa_name(Isa isa);
+
+    /**
+     * Fill <usage>, CpuField::count rows of <cores> values, with the percentages of the times between
+     * <old> and <current>, both time_rows rows of <cores> values. Times are jiffies stored as doubles,
+     * exact up to 2^53. Throws std::invalid_argument for an <isa> this cpu doesn't support.
+     */
+    void compute_usage(const double* current, const double* old, size_t cores, long long* usage,
+                       Isa isa = get_supported_isa());
+}
+
+#endif //HWINFO_CPU_KERNEL_HPP
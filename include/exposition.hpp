@@ -0,0 +1,119 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_EXPOSITION_HPP
+#define HWINFO_EXPOSITION_HPP
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include "cpu.hpp"
+#include "mem.hpp"
+
+namespace bhwinfo {
+    struct ExpositionConfig {
+        string address{"127.0.0.1"}; // IPv4 or IPv6 address to listen on
+        uint16_t port{9101}; // 0 picks a free one, see Exposition::get_port()
+        bool listen{true}; // false only renders, get_text() can then be served by another server
+    };
+
+    /**
+     * Prometheus text exposition of the latest cpu and mem samples.
+     *
+     * render() turns a sample into its section of the exposition once, metric headers and label sets
+     * for cores and disks are serialized ahead and only rebuilt when the cores or disks change.
+     * Each section is double buffered, a scrape is answered from a tiny epoll loop that hands the
+     * current buffers to one scatter write, so scrapes cost the same however many scrapers there are.
+     */
+    class Exposition {
+    public:
+        explicit Exposition(const ExpositionConfig& config = {}); // throws std::runtime_error when the address can't be listened on
+        ~Exposition();
+
+        Exposition(const Exposition&) = delete;
+        Exposition& operator=(const Exposition&) = delete;
+
+        //* Render calls must come from one thread at a time, scrapes are served from any number of connections
+        void render(const cpu::Data& cpu);
+
+        //* <time> is when the sample was collected, it turns the disk IO bytes since the previous sample into rates
+        void render(const mem::Data& mem, std::chrono::steady_clock::time_point time);
+
+        [[nodiscard]] string get_text() const; // the body a scrape gets right now
+        [[nodiscard]] const ExpositionConfig& get_config() const;
+        [[nodiscard]] const uint16_t& get_port() const; // the bound port, 0 without a listener
+        [[nodiscard]] uint64_t get_scrapes() const; // responses sent
+
+    private:
+        //* One metric family: its # HELP and # TYPE lines and the name and labels of every series
+        struct Family {
+            string header;
+            vector<string> series;
+        };
+
+        //* Published buffer and the one the next render fills, the spare is reused once no connection holds it
+        struct Section {
+            std::shared_ptr<const string> front{std::make_shared<string>()};
+            std::shared_ptr<string> back;
+        };
+
+        struct Connection {
+            string request;
+            string header; // of the response
+            std::shared_ptr<const string> cpu;
+            std::shared_ptr<const string> mem;
+            size_t sent{};
+            bool responding{};
+            std::chrono::steady_clock::time_point active;
+        };
+
+        ExpositionConfig config;
+        Section cpu_section;
+        Section mem_section;
+        mutable std::mutex mutex; // guards the front buffers
+        int cpu_cores{-1};
+        bool cpu_core_temps{};
+        vector<Family> cpu_families;
+        vector<Family> mem_families;
+        vector<Family> disk_families;
+        vector<std::pair<string, string>> disk_labels; // handle and path of every disk in disk_families
+        std::chrono::steady_clock::time_point old_mem_time{};
+        uint16_t port{};
+        int listen_fd{-1};
+        int epoll_fd{-1};
+        int stop_fd{-1};
+        std::atomic<uint64_t> scrapes{};
+        std::thread server;
+
+        string& begin(Section& section);
+        void publish(Section& section);
+        void build_cpu_families(int cores, bool core_temps);
+        void build_disk_families(const vector<mem::StorageUnit>& disks);
+
+        void open_listener();
+        void close_fds();
+        void run();
+        void accept_connections(std::unordered_map<int, Connection>& connections);
+        bool read_request(int fd, Connection& connection); // false once the connection is done with
+        void prepare_response(Connection& connection);
+        bool write_response(int fd, Connection& connection);
+    };
+}
+
+#endif //HWINFO_EXPOSITION_HPP
@@ -0,0 +1,223 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_FLEET_HPP
+#define HWINFO_FLEET_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include "snapshot.hpp"
+
+namespace bhwinfo {
+    struct FleetConfig {
+        size_t workers{std::max(std::thread::hardware_concurrency(), 2u) - 1}; // besides the ingesting thread, 0 ingests on it alone
+        size_t batch_size{256}; // snapshots per task a worker takes or steals
+        size_t shards{64}; // host table shards, rounded up to a power of 2
+        size_t initial_hosts{1024}; // hosts the table holds before it grows
+    };
+
+    //* Latest state of one host, taken from its newest snapshot
+    struct FleetHost {
+        uint64_t source_id{};
+        uint64_t sequence{};
+        int64_t timestamp_ns{}; // 0 for a host that was assigned but hasn't sent a snapshot yet
+        uint32_t rack{};
+        uint32_t cluster{};
+        uint32_t core_count{};
+        int32_t cpu_percent{}; // total usage
+        int64_t load_milli{}; // 1 minute load average * 1000
+        uint64_t ram_total{};
+        uint64_t ram_used{};
+        uint64_t disk_total{};
+        uint64_t disk_used{};
+        uint64_t io_read{}; // bytes per second since the host's previous snapshot
+        uint64_t io_write{};
+    };
+
+    //* Sums over the latest state of a set of hosts, hosts without a snapshot aren't counted
+    struct FleetTotals {
+        uint64_t hosts{};
+        uint64_t cores{};
+        uint64_t busy_core_percent{}; // cpu percent of every host times its cores
+        int64_t load_milli{};
+        uint64_t ram_total{};
+        uint64_t ram_used{};
+        uint64_t disk_total{};
+        uint64_t disk_used{};
+        uint64_t io_read{}; // bytes per second
+        uint64_t io_write{};
+
+        void add(const FleetHost& host);
+        void remove(const FleetHost& host);
+        void merge(const FleetTotals& other);
+
+        [[nodiscard]] double get_cpu_percent() const; // share of every core that was busy, 0 without hosts
+        [[nodiscard]] double get_ram_percent() const;
+    };
+
+    //* Totals of one rack or cluster
+    struct FleetGroup {
+        uint32_t id{};
+        FleetTotals totals;
+    };
+
+    /**
+     * Merges snapshots of many hosts into their latest state and fleet wide, per rack and per cluster totals.
+     *
+     * Hosts are kept in shards of open addressing tables keyed by SnapshotHeader::source_id, every shard
+     * keeps its part of the totals so an update only locks the shard of its host. ingest() splits a batch
+     * into tasks of FleetConfig::batch_size snapshots for a pool of work stealing workers, and a task applies
+     * its snapshots grouped by shard with one lock per shard. The totals are updated by taking the previous
+     * state of a host out of them, so reading them costs one pass over the shards however many hosts there are.
+     * Safe to use from any thread.
+     */
+    class FleetMerger {
+    public:
+        static constexpr uint32_t max_groups = 65536; // rack and cluster ids must be below
+
+        explicit FleetMerger(const FleetConfig& config = {}); // throws std::invalid_argument for a batch size of 0
+        ~FleetMerger();
+
+        FleetMerger(const FleetMerger&) = delete;
+        FleetMerger& operator=(const FleetMerger&) = delete;
+
+        /**
+         * Apply every snapshot of <snapshots> and return once all of them are merged. Malformed snapshots and ones
+         * not newer than the state of their host, by timestamp and then sequence, are counted and skipped.
+         * Returns the number of snapshots merged.
+         */
+        size_t ingest(std::span<const std::span<const std::byte>> snapshots);
+
+        //* Put a host into <rack> and <cluster>, it is counted there from its next snapshot on. Throws std::out_of_range
+        void assign(uint64_t source_id, uint32_t rack, uint32_t cluster);
+
+        bool remove(uint64_t source_id);
+        size_t expire(int64_t before_ns); // removes hosts whose latest snapshot is older, returns how many
+
+        [[nodiscard]] FleetTotals get_totals() const;
+
+        //* Replace the content of <out> with the groups that have hosts, ordered by id
+        void get_racks(vector<FleetGroup>& out) const;
+        void get_clusters(vector<FleetGroup>& out) const;
+
+        //* Replace the content of <out> with the state of every host, in no particular order
+        void get_hosts(vector<FleetHost>& out) const;
+
+        [[nodiscard]] bool get_host(uint64_t source_id, FleetHost& out) const;
+        [[nodiscard]] size_t get_host_count() const;
+        [[nodiscard]] const FleetConfig& get_config() const;
+        [[nodiscard]] uint64_t get_merged() const;
+        [[nodiscard]] uint64_t get_rejected() const; // malformed snapshots
+        [[nodiscard]] uint64_t get_outdated() const; // snapshots older than the state of their host
+
+    private:
+        /** Open addressing table with linear probing, deletes shift the following entries back instead of leaving tombstones */
+        class HostTable {
+        public:
+            explicit HostTable(size_t capacity);
+
+            FleetHost* find(uint64_t source_id);
+            [[nodiscard]] const FleetHost* find(uint64_t source_id) const;
+            FleetHost& insert(uint64_t source_id, bool& inserted);
+            bool erase(uint64_t source_id);
+
+            template <typename F>
+            void for_each(F&& visit) const {
+                for (size_t i = 0; i < slots.size(); i++)
+                    if (used[i]) visit(slots[i]);
+            }
+
+            [[nodiscard]] const size_t& get_size() const;
+
+        private:
+            vector<FleetHost> slots;
+            vector<uint8_t> used;
+            size_t mask{};
+            size_t size{};
+
+            [[nodiscard]] size_t locate(uint64_t source_id) const; // slot of <source_id> or the free one it would go into
+            void grow();
+        };
+
+        struct alignas(64) Shard {
+            mutable std::mutex mutex;
+            HostTable hosts;
+            FleetTotals totals;
+            vector<FleetTotals> racks;
+            vector<FleetTotals> clusters;
+
+            explicit Shard(size_t capacity) : hosts(capacity) {}
+
+            void count(const FleetHost& host, bool add);
+        };
+
+        //* Snapshots ingest() waits for, shared by its tasks
+        struct Batch {
+            std::span<const std::span<const std::byte>> snapshots;
+            std::atomic<size_t> remaining{};
+            std::atomic<size_t> merged{};
+            std::mutex mutex;
+            std::condition_variable done;
+        };
+
+        struct Task {
+            Batch* batch;
+            size_t begin;
+            size_t end;
+        };
+
+        struct alignas(64) Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        //* A parsed snapshot waiting for its shard's lock
+        struct Update {
+            size_t shard;
+            FleetHost host;
+        };
+
+        FleetConfig config;
+        vector<std::unique_ptr<Shard>> shards;
+        size_t shard_bits{};
+        vector<std::unique_ptr<Queue>> queues; // one per worker and one for the ingesting threads
+        std::atomic<size_t> next_queue{};
+        std::atomic<size_t> queued{};
+        std::mutex wake_mutex;
+        std::condition_variable wake;
+        bool stopping{};
+        vector<std::thread> workers;
+        std::atomic<uint64_t> merged{};
+        std::atomic<uint64_t> rejected{};
+        std::atomic<uint64_t> outdated{};
+
+        [[nodiscard]] Shard& get_shard(uint64_t source_id) const;
+        [[nodiscard]] size_t get_shard_index(uint64_t source_id) const;
+
+        void run(size_t worker);
+        bool try_run(size_t queue); // runs one task, its own queue first and then steals from the others
+        void process(const Task& task);
+        size_t apply(Shard& shard, std::span<const Update> updates);
+        void get_groups(vector<FleetGroup>& out, vector<FleetTotals> Shard::* groups) const;
+    };
+}
+
+#endif //HWINFO_FLEET_HPP
@@ -0,0 +1,142 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_HISTORY_STORE_HPP
+#define HWINFO_HISTORY_STORE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include "cpu.hpp"
+#include "mem.hpp"
+
+namespace bhwinfo {
+    /** Columns of a HistoryRecord, every value is an int64_t */
+    enum class HistoryColumn : size_t {
+        timestamp, // system clock, ns
+        cpu_total, cpu_user, cpu_nice, cpu_system, cpu_idle, cpu_iowait, cpu_irq, cpu_softirq, cpu_steal, // percent
+        load_1, load_5, load_15, // load average * 100
+        cpu_temp, // °C
+        cpu_frequency, // kHz, mean over the cores cpufreq reports
+        ram_used, ram_available, ram_cached, ram_free, swap_used, dirty, // bytes
+        count
+    };
+
+    inline constexpr array<string_view, static_cast<size_t>(HistoryColumn::count)> history_column_names {
+        "timestamp"sv, "cpu_total"sv, "cpu_user"sv, "cpu_nice"sv, "cpu_system"sv, "cpu_idle"sv, "cpu_iowait"sv,
+        "cpu_irq"sv, "cpu_softirq"sv, "cpu_steal"sv, "load_1"sv, "load_5"sv, "load_15"sv, "cpu_temp"sv,
+        "cpu_frequency"sv, "ram_used"sv, "ram_available"sv, "ram_cached"sv, "ram_free"sv, "swap_used"sv, "dirty"sv
+    };
+
+    using HistoryRecord = ut::type::enum_array<HistoryColumn, int64_t>;
+
+    struct HistoryStoreConfig {
+        fs::path dir;
+        std::chrono::hours retention{72}; // segments that ended longer ago are removed
+        uint32_t max_records{36000}; // per segment, a full segment is continued in a new one
+        uint32_t keyframe_interval{64}; // records between full values, bounds how far a query has to decode
+    };
+
+    /**
+     * Append-only time series of HistoryRecords in hourly, memory mapped segment files.
+     *
+     * Columns are stored as zigzag varints of their delta to the previous record, the timestamp as the
+     * delta of its delta. Every <keyframe_interval> records the deltas restart from zero and the record
+     * goes into the segment's index, so a range query only decodes from the keyframe before its start.
+     * A record becomes visible once the committed length in the segment header covers it. Whatever the
+     * process got to commit before it crashed stays readable, the page cache writes it back.
+     *
+     * The kernel may write the header back before the records it counts, a power loss can then leave
+     * zeroed or torn bytes under the committed length. Every record ends in a checksum and a query stops
+     * reading a segment at the first record that fails it. flush() only starts the write back, sync() and
+     * the destructor wait for it.
+     */
+    class HistoryStore {
+    public:
+        explicit HistoryStore(HistoryStoreConfig config);
+        ~HistoryStore();
+
+        HistoryStore(const HistoryStore&) = delete;
+        HistoryStore& operator=(const HistoryStore&) = delete;
+
+        [[nodiscard]] static HistoryRecord make_record(int64_t timestamp_ns, const cpu::Data& cpu, const mem::Data& mem);
+
+        //* Only writes to the mapping, except when the record starts a new segment. Timestamps should not go back
+        void append(const HistoryRecord& record);
+
+        //* Schedule write back of the current segment without waiting for it
+        void flush();
+
+        //* Write back the records appended since the last sync() and wait for it, they survive a power loss
+        void sync();
+
+        //* Records with timestamps in [<from_ns>, <to_ns>) from the segments in <dir>, oldest first
+        [[nodiscard]] static vector<HistoryRecord> query(const fs::path& dir, int64_t from_ns, int64_t to_ns);
+
+        [[nodiscard]] const HistoryStoreConfig& get_config() const;
+        [[nodiscard]] const fs::path& get_segment_path() const; // empty before the first append
+
+    private:
+        struct IndexEntry {
+            int64_t timestamp;
+            uint32_t offset; // into the data area
+            uint32_t record;
+        };
+
+        static constexpr size_t index_capacity = 1024;
+
+        struct SegmentHeader {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t column_count;
+            uint32_t data_offset; // from the start of the file
+            uint32_t keyframe_interval;
+            uint64_t capacity; // data area bytes
+            int64_t start_ns; // the hour this segment belongs to
+            std::atomic<int64_t> last_ns; // timestamp of the last committed record
+            std::atomic<uint64_t> committed; // data area bytes holding complete records
+            std::atomic<uint32_t> record_count;
+            std::atomic<uint32_t> index_count;
+            array<IndexEntry, index_capacity> index;
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free and std::atomic<uint32_t>::is_always_lock_free);
+
+        //* Previous values the deltas are taken against
+        struct Cursor {
+            HistoryRecord last{};
+            int64_t last_interval{};
+        };
+
+        HistoryStoreConfig config;
+        fs::path segment_path;
+        int fd{-1};
+        std::byte* map{};
+        size_t map_size{};
+        uint64_t synced{}; // committed bytes of the current segment written back by sync()
+        Cursor cursor;
+
+        [[nodiscard]] SegmentHeader& header() const;
+        void open_segment(int64_t timestamp_ns);
+        void close_segment();
+        void remove_expired(int64_t now_ns);
+
+        static size_t encode(const HistoryRecord& record, Cursor& cursor, std::byte* out);
+        static bool decode(const std::byte*& data, const std::byte* end, Cursor& cursor, HistoryRecord& record);
+    };
+}
+
+#endif //HWINFO_HISTORY_STORE_HPP
@@ -18,10 +18,71 @@
 #ifndef HWINFO_MEM_HPP
 #define HWINFO_MEM_HPP
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
+#include "cgroup.hpp"
 #include "ut.hpp"
 
 namespace mem {
+    /** Memory and swap values tracked from /proc/meminfo */
+    enum class MemField : size_t {
+        used, available, cached, free, swap_total, swap_used, swap_free, count
+    };
+
+    inline constexpr array<string_view, static_cast<size_t>(MemField::count)> mem_field_names {
+        "used"sv, "available"sv, "cached"sv, "free"sv, "swap_total"sv, "swap_used"sv, "swap_free"sv
+    };
+
+    /** Fields parsed from /proc/meminfo, values are in bytes except for the HugePages_ page counts */
+    enum class MemInfoField : size_t {
+        mem_total, mem_free, mem_available, buffers, cached, swap_cached,
+        active, inactive, active_anon, inactive_anon, active_file, inactive_file, unevictable, mlocked,
+        swap_total, swap_free, dirty, writeback, anon_pages, mapped, shmem,
+        kreclaimable, slab, sreclaimable, sunreclaim, kernel_stack, page_tables,
+        commit_limit, committed_as, vmalloc_used, anon_huge_pages,
+        huge_pages_total, huge_pages_free, huge_pages_rsvd, huge_pages_surp, hugepagesize, hugetlb,
+        count
+    };
+
+    //* /proc/meminfo labels of every MemInfoField, without the trailing colon
+    inline constexpr array<string_view, static_cast<size_t>(MemInfoField::count)> meminfo_field_names {
+        "MemTotal"sv, "MemFree"sv, "MemAvailable"sv, "Buffers"sv, "Cached"sv, "SwapCached"sv,
+        "Active"sv, "Inactive"sv, "Active(anon)"sv, "Inactive(anon)"sv, "Active(file)"sv, "Inactive(file)"sv,
+        "Unevictable"sv, "Mlocked"sv, "SwapTotal"sv, "SwapFree"sv, "Dirty"sv, "Writeback"sv,
+        "AnonPages"sv, "Mapped"sv, "Shmem"sv, "KReclaimable"sv, "Slab"sv, "SReclaimable"sv, "SUnreclaim"sv,
+        "KernelStack"sv, "PageTables"sv, "CommitLimit"sv, "Committed_AS"sv, "VmallocUsed"sv, "AnonHugePages"sv,
+        "HugePages_Total"sv, "HugePages_Free"sv, "HugePages_Rsvd"sv, "HugePages_Surp"sv, "Hugepagesize"sv, "Hugetlb"sv
+    };
+
+    /** Page allocation counters of a NUMA node, from its vmstat or its numastat on older kernels */
+    enum class NumaField : size_t {
+        hit, miss, foreign, interleave, local, other, count
+    };
+
+    //* Labels in a node's vmstat, numastat labels the last three interleave_hit, local_node and other_node
+    inline constexpr array<string_view, static_cast<size_t>(NumaField::count)> numa_field_names {
+        "numa_hit"sv, "numa_miss"sv, "numa_foreign"sv, "numa_interleave"sv, "numa_local"sv, "numa_other"sv
+    };
+
+    /** Memory of one NUMA node from /sys/devices/system/node/node<n>, values are in bytes */
+    struct NodeMemory {
+        int node{}; // number of its node directory
+        uint64_t total{};
+        uint64_t free{};
+        uint64_t available{}; // free, inactive page cache and reclaimable slab, nodes have no MemAvailable of their own
+        uint64_t used{}; // total - available
+        long long used_percent{};
+        long long available_percent{};
+        ut::type::enum_array<MemInfoField, uint64_t> meminfo{}; // fields without a per node value stay 0
+        ut::type::enum_array<NumaField, uint64_t> numa_rates{}; // pages per second since the previous collect
+    };
+
     class GenericMemUnit {
     private:
         uint64_t bytes;
@@ -29,6 +90,7 @@ namespace mem {
     public:
         explicit GenericMemUnit(const uint64_t& bytes);
 
+        [[nodiscard]] const uint64_t& get_bytes() const;
         [[nodiscard]] double to_gigabytes() const;
         [[nodiscard]] double to_megabytes() const;
         [[nodiscard]] double to_kilobytes() const;
@@ -44,18 +106,28 @@ namespace mem {
         [[nodiscard]] const long long& to_percent() const;
     };
 
+    /** Identity strings of a mounted disk, stored once per mount */
+    struct DiskIdentity {
+        string mountpoint;
+        string handle;
+        string fs_type;
+        fs::path path;
+    };
+
     class StorageUnit {
         GenericMemUnit total;
         GenericMemUnit used;
         GenericMemUnit free;
         int used_percent;
         int free_percent;
-        string handle;
-        string fs_type;
+        std::shared_ptr<const DiskIdentity> identity; // never null, copying the unit doesn't copy its strings
         long long io_read;
         long long io_write;
         long long io_activity;
-        fs::path path;
+        bool stale;
+        long long iops;
+        long long io_in_flight;
+        long long io_weighted;
 
     public:
         StorageUnit(
@@ -69,7 +141,28 @@ namespace mem {
             const long long& io_read,
             const long long& io_write,
             const long long& io_activity,
-            fs::path path
+            fs::path path,
+            const bool& stale = false,
+            const long long& iops = 0,
+            const long long& io_in_flight = 0,
+            const long long& io_weighted = 0
+        );
+
+        //* The same with the names of a disk the collector already holds, see DataCollector::get_disk_identity()
+        StorageUnit(
+            const GenericMemUnit &total,
+            const GenericMemUnit &used,
+            const GenericMemUnit &free,
+            const int& usedPercent,
+            const int& freePercent,
+            std::shared_ptr<const DiskIdentity> identity,
+            const long long& io_read,
+            const long long& io_write,
+            const long long& io_activity,
+            const bool& stale = false,
+            const long long& iops = 0,
+            const long long& io_in_flight = 0,
+            const long long& io_weighted = 0
         );
 
         [[nodiscard]] const GenericMemUnit& get_total() const;
@@ -83,6 +176,11 @@ namespace mem {
         [[nodiscard]] const long long int& get_io_write() const;
         [[nodiscard]] const long long int& get_io_activity() const;
         [[nodiscard]] const fs::path& get_path() const;
+        [[nodiscard]] const string& get_mountpoint() const; // empty for a unit built from its strings
+        [[nodiscard]] const bool& is_stale() const; // usage values are from an earlier collect, statvfs missed its deadline
+        [[nodiscard]] const long long& get_iops() const; // reads and writes completed per second
+        [[nodiscard]] const long long& get_io_in_flight() const; // requests issued but not completed yet
+        [[nodiscard]] const long long& get_io_weighted() const; // ms of weighted IO time per second, 1000 is an average queue depth of 1
     };
 
     class StaticValuesAware {
@@ -91,21 +189,28 @@ namespace mem {
     };
 
     class Data : StaticValuesAware {
+        friend class DataCollector;
+
     private:
         RamUnit available_ram_amount{0, 0};
         RamUnit cached_ram_amount{0, 0};
         RamUnit free_ram_amount{0, 0};
         RamUnit used_ram_amount{0, 0};
         vector<StorageUnit> disks;
+        ut::type::enum_array<MemInfoField, uint64_t> meminfo{};
+        vector<NodeMemory> numa_nodes;
 
     public:
+        Data();
         Data(
             const GenericMemUnit& total_ram_amount,
             const RamUnit& available_ram_amount,
             const RamUnit& cached_ram_amount,
             const RamUnit& free_ram_amount,
             const RamUnit& used_ram_amount,
-            const vector<StorageUnit>& disks
+            vector<StorageUnit> disks, // pass as an rvalue to move it in without a copy
+            const ut::type::enum_array<MemInfoField, uint64_t>& meminfo = {},
+            vector<NodeMemory> numa_nodes = {}
         );
 
         [[nodiscard]] const GenericMemUnit& get_total_ram_amount() const;
@@ -114,55 +219,272 @@ namespace mem {
         [[nodiscard]] const RamUnit& get_free_ram_amount() const;
         [[nodiscard]] const RamUnit& get_used_ram_amount() const;
         [[nodiscard]] const vector<StorageUnit>& get_disks() const;
+        [[nodiscard]] const uint64_t& get_meminfo(MemInfoField field) const;
+        [[nodiscard]] const vector<NodeMemory>& get_numa_nodes() const; // ascending by node, empty when collecting a cgroup
+        [[nodiscard]] GenericMemUnit get_buffers_amount() const;
+        [[nodiscard]] GenericMemUnit get_shared_ram_amount() const;
+        [[nodiscard]] GenericMemUnit get_reclaimable_slab_amount() const;
+        [[nodiscard]] GenericMemUnit get_dirty_amount() const;
+        [[nodiscard]] GenericMemUnit get_writeback_amount() const;
+        [[nodiscard]] GenericMemUnit get_swap_total_amount() const;
+        [[nodiscard]] GenericMemUnit get_swap_free_amount() const;
+        [[nodiscard]] GenericMemUnit get_swap_cached_amount() const;
+        [[nodiscard]] GenericMemUnit get_committed_amount() const;
+        [[nodiscard]] const uint64_t& get_huge_pages_total() const;
+        [[nodiscard]] const uint64_t& get_huge_pages_free() const;
+        [[nodiscard]] const uint64_t& get_huge_pages_reserved() const;
+        [[nodiscard]] const uint64_t& get_huge_pages_surplus() const;
+        [[nodiscard]] GenericMemUnit get_huge_page_size() const;
+    };
+
+    //* Interned disk index, stable while the mount stays present. Ids of removed disks are reused by later mounts
+    using DiskId = uint32_t;
+
+    /** Usage and IO values of one disk, see DataCollector::get_disk_identity() for its names */
+    struct DiskUpdate {
+        DiskId id;
+        uint64_t total;
+        uint64_t used;
+        uint64_t free;
+        int used_percent;
+        int free_percent;
+        long long io_read;
+        long long io_write;
+        long long io_activity;
+        bool stale;
+        long long iops;
+        long long io_in_flight;
+        long long io_weighted;
+
+        bool operator==(const DiskUpdate&) const = default;
+    };
+
+    /** RAM values and only the disks that changed since the previous DataCollector::collect_delta() */
+    class DataDelta : StaticValuesAware {
+        friend class DataCollector;
+
+    private:
+        RamUnit available_ram_amount{0, 0};
+        RamUnit cached_ram_amount{0, 0};
+        RamUnit free_ram_amount{0, 0};
+        RamUnit used_ram_amount{0, 0};
+        vector<DiskUpdate> changed_disks;
+        vector<DiskId> added_disks;
+        vector<DiskId> removed_disks;
+        ut::type::enum_array<MemInfoField, uint64_t> meminfo{};
+
+    public:
+        [[nodiscard]] const GenericMemUnit& get_total_ram_amount() const;
+        [[nodiscard]] const RamUnit& get_available_ram_amount() const;
+        [[nodiscard]] const RamUnit& get_cached_ram_amount() const;
+        [[nodiscard]] const RamUnit& get_free_ram_amount() const;
+        [[nodiscard]] const RamUnit& get_used_ram_amount() const;
+        [[nodiscard]] const vector<DiskUpdate>& get_changed_disks() const; // includes the added disks
+        [[nodiscard]] const vector<DiskId>& get_added_disks() const;
+        [[nodiscard]] const vector<DiskId>& get_removed_disks() const; // apply before the added ones, a removed id can come back as a new disk
+        [[nodiscard]] const uint64_t& get_meminfo(MemInfoField field) const;
+    };
+
+    //* Where DataCollector gets disk IO counters from
+    enum class IoBackend {
+        sysfs, // one /sys/block stat file per disk
+        diskstats, // /proc/diskstats once per collect, disks without a row in it fall back to sysfs
+        cgroup // io.stat of the collected cgroup, bytes and operations of the group only, no activity or queue values
     };
 
     class DataCollector : StaticValuesAware {
     public:
         DataCollector();
 
+        /**
+         * Collect for the cgroup v2 group at <cgroup>, see cgroup::find_group(), an empty path collects the host.
+         * RAM values come from memory.current, memory.max and memory.stat, the host bounds a group without limit,
+         * swap from memory.swap.current and memory.swap.max. Disk IO defaults to IoBackend::cgroup.
+         */
+        explicit DataCollector(const fs::path& cgroup);
+
+        //* Defaults to IoBackend::diskstats when /proc/diskstats can be read, IoBackend::cgroup needs a cgroup
+        void set_io_backend(IoBackend backend);
+        [[nodiscard]] const IoBackend& get_io_backend() const;
+
+        /**
+         * Run statvfs64() for every disk on <workers> background threads, waiting at most <timeout> per collect.
+         * Disks that miss the deadline keep their previous usage values and are reported as stale, the ones still
+         * hung from an earlier collect right away, so a collect only waits for mounts that answered before.
+         * 0 workers goes back to serial statvfs64() calls on the collecting thread.
+         */
+        void set_parallel_disk_stats(size_t workers, std::chrono::milliseconds timeout);
+
     private:
+        /** One statvfs64() request, shared between the collector and the worker that runs it */
+        struct StatvfsJob {
+            string mountpoint;
+            std::atomic<bool> pending{}; // true while queued or running
+            int result{};
+            int error{};
+            uint64_t blocks{};
+            uint64_t bavail{};
+            uint64_t frsize{};
+        };
+
         struct DiskInfo {
             std::filesystem::path dev;
             string name;
             string fstype{};
             std::filesystem::path stat{};
+            ut::file::CachedReader stat_reader{};
             uint64_t total{};
             uint64_t used{};
             uint64_t free{};
             int used_percent{};
             int free_percent{};
 
-            array<uint64_t, 3> old_io = {0, 0, 0};
+            //? sectors read, sectors written, io ticks, reads and writes completed, weighted io ticks
+            array<uint64_t, 5> old_io = {0, 0, 0, 0, 0};
             long long io_read = {};
             long long io_write = {};
             long long io_activity = {};
+            long long iops = {};
+            long long io_in_flight = {};
+            long long io_weighted = {};
+            uint64_t devno{}; // major:minor from the stat file's dev, 0 if unknown
+            uint64_t disk_devno{}; // the same of the whole disk a partition is on, io.stat only counts disks
+            bool io_updated{};
+
+            DiskId id{};
+            std::shared_ptr<const DiskIdentity> identity{}; // set by add_disk()
+            bool reported{};
+            DiskUpdate last_update{};
+            bool stale{};
+            std::shared_ptr<StatvfsJob> statvfs_job{};
+        };
+
+        /**
+         * Worker threads for statvfs64(), owned and joined on shutdown. A mount hung in the kernel pins the worker
+         * running its job, so the pool starts a spare one per hung job, up to max_spare_workers, and the spares
+         * retire once the hung jobs return.
+         */
+        class StatvfsPool {
+        public:
+            explicit StatvfsPool(size_t workers);
+            ~StatvfsPool();
+
+            StatvfsPool(const StatvfsPool&) = delete;
+            StatvfsPool& operator=(const StatvfsPool&) = delete;
+
+            void submit(const std::shared_ptr<StatvfsJob>& job);
+
+            //* Keep a spare worker for each of <hung> jobs still pending from an earlier collect
+            void set_hung(size_t hung);
+
+            //* Wait until none of <jobs> is pending or <deadline> passes
+            void wait(const vector<std::shared_ptr<StatvfsJob>>& jobs, std::chrono::steady_clock::time_point deadline);
+
+        private:
+            static constexpr size_t max_spare_workers = 16;
+
+            struct State {
+                std::mutex mutex;
+                std::condition_variable queued;
+                std::condition_variable finished;
+                std::deque<std::shared_ptr<StatvfsJob>> queue;
+                size_t target{}; // workers wanted, the ones above it retire when idle
+                size_t live{}; // workers not retired yet
+                vector<std::thread::id> busy; // running statvfs64()
+                vector<std::thread::id> retired; // exited, waiting to be joined
+                bool stopping{};
+            };
+
+            size_t workers;
+            std::shared_ptr<State> state = std::make_shared<State>();
+            vector<std::thread> threads;
+
+            void start(); // with the lock held
+            void reap(); // join retired workers, with the lock held
+        };
+
+        /** Files of one NUMA node, found once by the constructor */
+        struct NodeFiles {
+            ut::file::CachedReader meminfo;
+            ut::file::CachedReader vmstat;
+            ut::file::CachedReader numastat;
+            bool use_numastat{}; // vmstat has no numa counters on older kernels
+            ut::type::enum_array<NumaField, uint64_t> old_numa{};
         };
 
         struct MemInfo {
-            std::unordered_map<string, uint64_t> stats =
-                    {{"used", 0}, {"available", 0}, {"cached", 0}, {"free", 0},
-                     {"swap_total", 0}, {"swap_used", 0}, {"swap_free", 0}};
-            std::unordered_map<string, long long> percent =
-                    {{"used", {}}, {"available", {}}, {"cached", {}}, {"free", {}},
-                     {"swap_total", {}}, {"swap_used", {}}, {"swap_free", {}}};
+            ut::type::enum_array<MemField, uint64_t> stats{};
+            ut::type::enum_array<MemField, long long> percent{};
+            ut::type::enum_array<MemInfoField, uint64_t> meminfo{};
+            vector<NodeMemory> nodes; // parallel to node_files
             std::unordered_map<string, DiskInfo> disks;
-            vector<string> disks_order;
         };
 
         bool has_swap{}; // defaults to false
-        vector<string> fstab;
+        ut::str::string_set fstypes;
+        ut::str::string_set fstab;
+        ut::str::string_set ignore_list;
         fs::file_time_type fstab_time;
+        ut::file::CachedReader meminfo_reader;
+        ut::file::CachedReader mounts_reader;
+        ut::file::CachedReader mtab_reader;
+        ut::file::CachedReader diskstats_reader;
+        vector<NodeFiles> node_files;
+        IoBackend io_backend{IoBackend::sysfs};
+        std::unordered_map<uint64_t, DiskInfo*> disks_by_devno; // rebuilt whenever the mount table is parsed
+        std::unordered_multimap<uint64_t, DiskInfo*> disks_by_disk_devno; // the same, every partition of a disk
+        std::unique_ptr<cgroup::Group> group;
+        bool mount_table_valid{};
         int disk_ios{}; // defaults to 0
         vector<string> last_found;
         MemInfo current_mem{};
-        const array<string, 4> mem_names { "used"s, "available"s, "cached"s, "free"s };
-        const array<string, 2> swap_names { "swap_used"s, "swap_free"s };
-        double old_uptime;
+        static constexpr array<MemField, 4> mem_names { MemField::used, MemField::available, MemField::cached, MemField::free };
+        static constexpr array<MemField, 2> swap_names { MemField::swap_used, MemField::swap_free };
+        std::chrono::steady_clock::time_point old_time; // of the previous disk IO counters
+        DataDelta current_delta;
+        vector<std::shared_ptr<const DiskIdentity>> disk_identities; // indexed by DiskId
+        vector<DiskId> free_disk_ids;
+        vector<DiskId> removed_disks; // reported disks released since the last collect_delta()
+        std::unique_ptr<StatvfsPool> statvfs_pool;
+        std::chrono::milliseconds statvfs_timeout{};
+        vector<std::shared_ptr<StatvfsJob>> statvfs_batch;
+        ut::stats::CollectStats collect_stats;
+
+        //* Parse all of /proc/meminfo in one pass, returns a bit mask of the MemInfoField values found
+        uint64_t parse_meminfo();
 
-        uint64_t get_total_ram_amount();
+        //* Replace the host values parse_meminfo() found with the ones of the cgroup, returns the same mask
+        uint64_t parse_cgroup_memory();
+        void find_numa_nodes();
+        void update_numa_nodes(double elapsed);
+        void update(std::chrono::steady_clock::time_point now);
+        bool mounts_changed();
+        void update_fstab();
+        void update_disk_usage(const string& mountpoint, DiskInfo& disk, int result, int error, uint64_t blocks, uint64_t bavail, uint64_t frsize);
+        DiskInfo& add_disk(const string& mountpoint, DiskInfo&& disk);
+        void release_disk(const DiskInfo& disk);
+        void index_disks();
+        void read_diskstats(double elapsed);
+        void read_cgroup_io(double elapsed);
+        static uint64_t read_devno(const fs::path& stat, const fs::path& dev);
+        static bool update_disk_io(DiskInfo& disk, string_view stat, double elapsed);
 
     public:
         Data collect();
+
+        //* Collect with IO rates measured up to <now> instead of the current time, see bhwinfo::Collector
+        Data collect(std::chrono::steady_clock::time_point now);
+
+        //* Collect into <out>, its disk vector is reused and disk names are shared, so a kept <out> doesn't allocate
+        void collect_into(Data& out);
+        void collect_into(Data& out, std::chrono::steady_clock::time_point now);
+
+        //* Collect like collect() but only report disks whose usage or IO counters changed, reusing the returned object
+        const DataDelta& collect_delta();
+        const DataDelta& collect_delta(std::chrono::steady_clock::time_point now);
+        [[nodiscard]] const DiskIdentity& get_disk_identity(const DiskId& id) const;
+        [[nodiscard]] const ut::stats::CollectStats& get_collect_stats() const; // of the last collect, zeroed without BHWINFO_INSTRUMENT
+        [[nodiscard]] const cgroup::Group* get_cgroup() const; // nullptr when collecting the host
     };
 }
 
@@ -0,0 +1,138 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_NET_HPP
+#define HWINFO_NET_HPP
+
+#include <chrono>
+#include "ut.hpp"
+
+namespace net {
+    /** Counters tracked from /proc/net/dev for every interface */
+    enum class NetField : size_t {
+        rx_bytes, rx_packets, rx_errors, rx_drops, tx_bytes, tx_packets, tx_errors, tx_drops, count
+    };
+
+    inline constexpr array<string_view, static_cast<size_t>(NetField::count)> net_field_names {
+        "rx_bytes"sv, "rx_packets"sv, "rx_errors"sv, "rx_drops"sv, "tx_bytes"sv, "tx_packets"sv, "tx_errors"sv, "tx_drops"sv
+    };
+
+    //* Interned interface index, stable while the interface stays present. Ids of removed interfaces are reused by later ones
+    using InterfaceId = uint32_t;
+
+    //* Interface names are at most IFNAMSIZ - 1 characters, short enough to never leave the small string buffer
+    inline constexpr size_t max_name_length = 15;
+
+    class InterfaceUnit {
+    private:
+        InterfaceId id;
+        string name;
+        ut::type::enum_array<NetField, uint64_t> totals;
+        ut::type::enum_array<NetField, uint64_t> rates;
+
+    public:
+        InterfaceUnit(
+            const InterfaceId& id,
+            string name,
+            const ut::type::enum_array<NetField, uint64_t>& totals,
+            const ut::type::enum_array<NetField, uint64_t>& rates
+        );
+
+        [[nodiscard]] const InterfaceId& get_id() const;
+        [[nodiscard]] const string& get_name() const;
+        [[nodiscard]] const uint64_t& get_total(NetField field) const; // counter value since the interface came up
+        [[nodiscard]] const uint64_t& get_rate(NetField field) const; // per second since the previous collect, 0 on the first
+    };
+
+    class Data {
+        friend class DataCollector;
+
+    private:
+        vector<InterfaceUnit> interfaces;
+
+    public:
+        Data();
+        explicit Data(vector<InterfaceUnit> interfaces);
+
+        [[nodiscard]] const vector<InterfaceUnit>& get_interfaces() const; // in /proc/net/dev order
+        [[nodiscard]] const InterfaceUnit* find_interface(string_view name) const; // nullptr when not present
+        [[nodiscard]] uint64_t get_rate_sum(NetField field, bool include_loopback = false) const; // of every interface
+    };
+
+    /**
+     * Reads /proc/net/dev once per collect() into a table indexed by InterfaceId. Interfaces that disappear give
+     * their slot back to the next new one, so veth pairs coming and going don't grow or reallocate the table
+     * while no more than its capacity are present at once.
+     */
+    class DataCollector {
+    public:
+        //* Room for <capacity> interfaces present at the same time, the table only grows past it when more show up
+        explicit DataCollector(size_t capacity = 256);
+
+        Data collect();
+
+        //* Collect with rates measured up to <now> instead of the current time, see bhwinfo::Collector
+        Data collect(std::chrono::steady_clock::time_point now);
+
+        //* Collect into <out>, its interface vector is reused and names fit the small string buffer, a kept <out> doesn't allocate
+        void collect_into(Data& out);
+        void collect_into(Data& out, std::chrono::steady_clock::time_point now);
+
+        [[nodiscard]] size_t get_capacity() const;
+        [[nodiscard]] const ut::stats::CollectStats& get_collect_stats() const; // of the last collect, zeroed without BHWINFO_INSTRUMENT
+
+    private:
+        static constexpr uint32_t empty_slot = UINT32_MAX;
+        static constexpr size_t netdev_columns = 16; // after the interface name, 8 receive counters and 8 transmit counters
+
+        struct InterfaceInfo {
+            array<char, max_name_length + 1> name{};
+            uint8_t name_length{};
+            bool present{};
+            uint64_t seen{}; // collect the interface was last listed in
+            ut::type::enum_array<NetField, uint64_t> old{};
+            ut::type::enum_array<NetField, uint64_t> rates{};
+
+            [[nodiscard]] string_view get_name() const;
+        };
+
+        //* A row of an interface that wasn't in the table yet, added once the ones that are gone are released
+        struct PendingRow {
+            string_view name;
+            array<uint64_t, netdev_columns> columns;
+            size_t position; // in order
+        };
+
+        ut::file::CachedReader dev_reader;
+        vector<InterfaceInfo> interfaces; // indexed by InterfaceId
+        vector<InterfaceId> free_ids;
+        vector<InterfaceId> order; // present interfaces in /proc/net/dev order
+        vector<PendingRow> pending;
+        vector<uint32_t> index; // open addressing name -> InterfaceId, linear probing, empty_slot when free
+        size_t index_mask{};
+        uint64_t ticks{};
+        std::chrono::steady_clock::time_point old_time;
+        ut::stats::CollectStats collect_stats;
+
+        void update(std::chrono::steady_clock::time_point now);
+        InterfaceId add(string_view name);
+        void release(InterfaceId id);
+        void reserve(size_t capacity);
+        [[nodiscard]] size_t locate(string_view name) const; // index slot of <name> or the free one it would go into
+    };
+}
+
+#endif //HWINFO_NET_HPP
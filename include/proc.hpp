@@ -0,0 +1,117 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_PROC_HPP
+#define HWINFO_PROC_HPP
+
+#include <chrono>
+#include <sys/types.h>
+#include "ut.hpp"
+
+namespace proc {
+    enum class SortField { cpu, memory, pid };
+
+    /** One process of a proc::Data, values are from the collect() that produced it */
+    struct Process {
+        pid_t pid;
+        pid_t ppid;
+        string name; // comm, at most 15 characters
+        string user; // of the effective uid, from passwd, the numeric uid if it isn't listed
+        char state; // R, S, D, Z, ...
+        double cpu_percent; // since the previous collect, 100 is one core fully used
+        uint64_t cpu_time; // user and system time, in clock ticks
+        uint64_t mem_bytes; // resident set size
+        uint64_t shared_bytes; // resident pages backed by files or shared memory
+        long threads;
+    };
+
+    class Data {
+    private:
+        vector<Process> processes;
+        size_t process_count{};
+
+    public:
+        Data();
+        Data(vector<Process> processes, const size_t& process_count);
+
+        [[nodiscard]] const vector<Process>& get_processes() const; // the top processes by the collector's sort field
+        [[nodiscard]] const size_t& get_process_count() const; // every process seen by the scan
+    };
+
+    /**
+     * Scans every /proc/[pid] per collect() and keeps the top processes by a sort field.
+     *
+     * The /proc directory is read with getdents64() into a reused buffer and the state of every pid
+     * lives in an open addressing table, so a scan over tens of thousands of processes doesn't
+     * allocate in steady state. Only the top <count> are sorted and turned into Process values.
+     */
+    class DataCollector {
+    public:
+        DataCollector();
+        ~DataCollector();
+
+        DataCollector(const DataCollector&) = delete;
+        DataCollector& operator=(const DataCollector&) = delete;
+
+        //* Report the top <count> processes by <field>, 50 by cpu usage by default
+        void set_top(size_t count, SortField field);
+
+        Data collect();
+
+        //* Collect with cpu usage measured up to <now> instead of the current time, see bhwinfo::Collector
+        Data collect(std::chrono::steady_clock::time_point now);
+
+    private:
+        //* Per pid state, pid 0 marks an empty slot and -1 one whose process exited
+        struct Slot {
+            pid_t pid{};
+            uint64_t generation{}; // scan that last saw the pid
+            uint64_t start_time{}; // tells a reused pid apart from the process that had it before
+            uint64_t cpu_time{};
+            double cpu_percent{};
+            uint64_t mem_bytes{};
+            uint64_t shared_bytes{};
+            pid_t ppid{};
+            long threads{};
+            char state{};
+            array<char, 16> name{};
+        };
+
+        int proc_fd{-1};
+        vector<char> dirents;
+        vector<pid_t> pids; // found by the current scan
+        vector<Slot> table; // capacity is a power of two
+        size_t used{}; // slots holding a pid or a tombstone
+        size_t live{};
+        uint64_t generation{};
+        vector<uint32_t> candidates; // slot indexes of this scan, partially sorted for the top
+        size_t top_count{50};
+        SortField sort_field{SortField::cpu};
+        std::chrono::steady_clock::time_point old_time{};
+        std::unordered_map<uid_t, string> users;
+        fs::file_time_type passwd_time{};
+
+        void list_pids();
+        Slot& find_slot(pid_t pid);
+        void rehash(size_t capacity);
+        void sweep();
+        void update_users();
+        bool read_process(pid_t pid, Slot& slot, double elapsed_ticks);
+        [[nodiscard]] string get_user(uid_t uid) const;
+    };
+}
+
+#endif //HWINFO_PROC_HPP
@@ -0,0 +1,151 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_ROLLUP_HPP
+#define HWINFO_ROLLUP_HPP
+
+#include <chrono>
+#include <mutex>
+#include "cpu.hpp"
+#include "mem.hpp"
+
+namespace bhwinfo {
+    struct RollupConfig {
+        double relative_accuracy{0.02}; // of get_quantile(), within the range the sketch bins cover
+        size_t sketch_bins{128}; // per Aggregate, 128 bins at 2% cover values from x to 160x
+    };
+
+    /**
+     * Streaming summary of one metric: count, mean and variance by Welford's method, min, max and a
+     * DDSketch for quantiles. The sketch keeps a fixed number of logarithmic bins and collapses the
+     * lowest ones when a value beyond the highest arrives, so memory never grows with the sample count
+     * and the upper quantiles stay accurate. Values <= 0 are counted in a separate zero bin.
+     */
+    class Aggregate {
+    public:
+        Aggregate();
+        Aggregate(double relative_accuracy, size_t bins); // throws std::invalid_argument for an accuracy outside (0, 1) or no bins
+
+        void add(double value);
+        void reset();
+
+        [[nodiscard]] const uint64_t& get_count() const;
+        [[nodiscard]] const double& get_mean() const; // 0 without samples
+        [[nodiscard]] double get_variance() const; // sample variance, 0 below two samples
+        [[nodiscard]] double get_stddev() const;
+        [[nodiscard]] const double& get_min() const; // 0 without samples
+        [[nodiscard]] const double& get_max() const;
+        [[nodiscard]] double get_quantile(double q) const; // <q> in [0, 1], 0 without samples
+        [[nodiscard]] const double& get_relative_accuracy() const;
+        [[nodiscard]] size_t get_bin_count() const;
+
+    private:
+        uint64_t count{};
+        double mean{};
+        double m2{};
+        double min{};
+        double max{};
+        double relative_accuracy;
+        double gamma;
+        double log_gamma;
+        uint64_t zero_count{};
+        uint64_t binned_count{};
+        int offset{}; // sketch key of bins[0]
+        vector<uint32_t> bins;
+
+        void add_key(int key);
+    };
+
+    //* Per disk rates a RollupWindow aggregates
+    enum class DiskRate : size_t {
+        read, write, // bytes per second
+        activity, // percent
+        iops,
+        count
+    };
+
+    inline constexpr array<string_view, static_cast<size_t>(DiskRate::count)> disk_rate_names {
+        "read"sv, "write"sv, "activity"sv, "iops"sv
+    };
+
+    using DiskAggregates = ut::type::enum_array<DiskRate, Aggregate>;
+
+    /** Aggregates of every sample a Rollup received between two take_window() calls */
+    class RollupWindow {
+        friend class Rollup;
+
+    private:
+        RollupConfig config;
+        ut::type::enum_array<cpu::CpuField, Aggregate> cpu_usage;
+        vector<Aggregate> core_usage; // CpuField::count rows of core_count aggregates
+        int core_count{};
+        ut::type::enum_array<mem::MemField, Aggregate> ram; // bytes
+        ut::str::string_map<DiskAggregates> disks; // by StorageUnit::get_path(), the device IO is counted for
+        int64_t start_ns{};
+        int64_t end_ns{};
+        std::chrono::steady_clock::time_point first_time{};
+        std::chrono::steady_clock::time_point last_time{};
+
+        void reset(const RollupConfig& rollup_config, int64_t now);
+        void resize_cores(int cores);
+        void add_time(std::chrono::steady_clock::time_point time);
+
+    public:
+        RollupWindow();
+
+        [[nodiscard]] const Aggregate& get_cpu_usage(cpu::CpuField field) const;
+        [[nodiscard]] const Aggregate& get_core_usage(int core, cpu::CpuField field) const; // throws std::out_of_range
+        [[nodiscard]] const int& get_core_count() const;
+        [[nodiscard]] const Aggregate& get_ram(mem::MemField field) const;
+        [[nodiscard]] const ut::str::string_map<DiskAggregates>& get_disks() const;
+        [[nodiscard]] const int64_t& get_start_ns() const; // system clock, when the window was started
+        [[nodiscard]] const int64_t& get_end_ns() const; // system clock, when it was taken
+        [[nodiscard]] std::chrono::nanoseconds get_sampled_duration() const; // from the first to the last sample
+    };
+
+    /**
+     * Rolls cpu and mem samples up into a RollupWindow as they arrive. take_window() hands the
+     * current window out and starts an empty one, memory depends on the core and disk count only.
+     * Safe to use from any thread.
+     */
+    class Rollup {
+    public:
+        explicit Rollup(const RollupConfig& config = {});
+
+        Rollup(const Rollup&) = delete;
+        Rollup& operator=(const Rollup&) = delete;
+
+        //* <time> is when the sample was collected, it bounds get_sampled_duration()
+        void add(const cpu::Data& cpu, std::chrono::steady_clock::time_point time);
+
+        //* <time> also turns the bytes between two samples into rates, the first sample adds no read and write rates
+        void add(const mem::Data& mem, std::chrono::steady_clock::time_point time);
+
+        //* Swap the current window into <out> and reuse the old storage of <out> for the next one
+        void take_window(RollupWindow& out);
+        [[nodiscard]] RollupWindow take_window();
+
+        [[nodiscard]] const RollupConfig& get_config() const;
+
+    private:
+        RollupConfig config;
+        std::mutex mutex;
+        RollupWindow current;
+        std::chrono::steady_clock::time_point old_mem_time{};
+    };
+}
+
+#endif //HWINFO_ROLLUP_HPP
@@ -0,0 +1,231 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_SAMPLER_HPP
+#define HWINFO_SAMPLER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <memory>
+#include "cpu.hpp"
+#include "exposition.hpp"
+#include "history_store.hpp"
+#include "mem.hpp"
+#include "rollup.hpp"
+#include "threshold.hpp"
+
+namespace bhwinfo {
+    //* When a published value was collected, on both clocks
+    struct SampleTime {
+        std::chrono::steady_clock::time_point time{}; // for intervals between samples
+        int64_t timestamp_ns{}; // system clock, for storing and sending samples
+    };
+
+    /**
+     * Latest value slot with one writer and any number of readers.
+     * The writer fills a buffer no reader has pinned and publishes it with a single atomic store,
+     * readers pin the published buffer through its reader count. Neither side locks or waits for the other.
+     */
+    template <typename T, size_t Buffers = 4>
+    class SnapshotSlot {
+        static_assert(Buffers >= 2, "SnapshotSlot needs a buffer to publish and one to fill");
+
+    private:
+        struct alignas(64) Buffer {
+            std::atomic<uint32_t> readers{};
+            T value{};
+            SampleTime time{};
+        };
+
+        mutable array<Buffer, Buffers> buffers;
+        std::atomic<size_t> latest{};
+        std::atomic<uint64_t> version{};
+
+    public:
+        //* Fill a free buffer through <fill>(T&) and publish it with <time>, false if readers pin every other buffer
+        template <typename F>
+        bool publish(F&& fill, const SampleTime& time = {}) {
+            const size_t current = latest.load();
+
+            for (size_t i = 1; i < Buffers; i++) {
+                auto& buffer = buffers[(current + i) % Buffers];
+
+                if (buffer.readers.load() != 0) continue;
+
+                fill(buffer.value);
+                buffer.time = time;
+
+                latest.store((current + i) % Buffers);
+                version.fetch_add(1);
+
+                return true;
+            }
+
+            return false;
+        }
+
+        //* Call <visit>(const T&) or <visit>(const T&, const SampleTime&) on the latest published value and return its result
+        template <typename F>
+        decltype(auto) read(F&& visit) const {
+            Buffer* buffer;
+
+            //? Pin the buffer first, then make sure it is still the published one
+            for (;;) {
+                const size_t index = latest.load();
+                buffer = &buffers[index];
+                buffer->readers.fetch_add(1);
+
+                if (latest.load() == index) break;
+
+                buffer->readers.fetch_sub(1);
+            }
+
+            struct Unpin {
+                Buffer* buffer;
+
+                ~Unpin() {
+                    buffer->readers.fetch_sub(1, std::memory_order_release);
+                }
+            } unpin{buffer};
+
+            if constexpr (std::is_invocable_v<F, const T&, const SampleTime&>)
+                return visit(std::as_const(buffer->value), std::as_const(buffer->time));
+            else
+                return visit(std::as_const(buffer->value));
+        }
+
+        [[nodiscard]] T load() const {
+            return read([](const T& value) { return value; });
+        }
+
+        //* Number of values published so far, 0 means load() returns a default constructed T
+        [[nodiscard]] uint64_t get_version() const {
+            return version.load();
+        }
+    };
+
+    /**
+     * Lets the sampler stretch an interval while samples stay within the noise floors. After <quiet_samples>
+     * quiet samples in a row the interval doubles, up to <max_backoff> times the configured one. The first
+     * sample that moves more than a floor, or crosses a threshold, drops back to the configured interval.
+     */
+    struct AdaptiveSampling {
+        double cpu_noise_floor{2}; // percentage points, total and per core load
+        double mem_noise_floor{1}; // percentage points of used and cached RAM
+        double io_noise_floor{2}; // percentage points of disk io_activity
+        uint32_t quiet_samples{10};
+        uint32_t max_backoff{16};
+    };
+
+    struct SamplerConfig {
+        std::chrono::milliseconds cpu_interval{100}; // with adaptive sampling the fastest cpu interval
+        std::chrono::milliseconds mem_interval{2000};
+        fs::path history_dir; // records cpu and mem samples into a HistoryStore there, empty to disable
+        std::chrono::milliseconds history_interval{1000};
+        std::chrono::milliseconds history_flush_interval{10000}; // starts write back of new records, stop() waits for it
+        std::chrono::hours history_retention{72};
+        std::optional<AdaptiveSampling> adaptive; // fixed intervals without
+        std::optional<RollupConfig> rollup; // rolls every sample up into a Rollup, see get_rollup()
+        std::optional<ExpositionConfig> exposition; // renders every sample for Prometheus scrapes
+        fs::path cgroup; // cgroup v2 group to collect for, see cgroup::find_group(), empty for the host
+    };
+
+    /**
+     * Runs the cpu and mem collectors on a background thread, each on its own steady clock schedule,
+     * and publishes every result into a SnapshotSlot that readers can access from any thread.
+     */
+    class Sampler {
+    public:
+        Sampler();
+        explicit Sampler(const SamplerConfig& config);
+        ~Sampler();
+
+        Sampler(const Sampler&) = delete;
+        Sampler& operator=(const Sampler&) = delete;
+
+        void start();
+        void stop();
+
+        [[nodiscard]] bool is_running() const;
+        [[nodiscard]] const SamplerConfig& get_config() const;
+        [[nodiscard]] cpu::Data get_cpu_data() const;
+        [[nodiscard]] mem::Data get_mem_data() const;
+        [[nodiscard]] const SnapshotSlot<cpu::Data>& get_cpu_slot() const;
+        [[nodiscard]] const SnapshotSlot<mem::Data>& get_mem_slot() const;
+        [[nodiscard]] uint64_t get_failed_samples() const; // collect() calls that threw
+        [[nodiscard]] uint64_t get_dropped_samples() const; // samples not published because readers pinned every buffer
+        [[nodiscard]] std::chrono::milliseconds get_cpu_interval() const; // current ones, they only change with adaptive sampling
+        [[nodiscard]] std::chrono::milliseconds get_mem_interval() const;
+        [[nodiscard]] const HistoryStore* get_history_store() const; // nullptr without a history_dir
+        [[nodiscard]] Rollup* get_rollup(); // nullptr without a rollup config
+        [[nodiscard]] const Exposition* get_exposition() const; // nullptr without an exposition config
+
+        //* Subscriptions evaluated against every sample on the sampling thread, before it is published
+        [[nodiscard]] ThresholdMonitor& get_thresholds();
+
+    private:
+        //* Interval of one collector and what its adaptive backoff compares the next sample against
+        struct Schedule {
+            std::chrono::milliseconds base;
+            std::atomic<std::chrono::milliseconds::rep> interval;
+            std::chrono::steady_clock::time_point next{};
+            uint32_t quiet{};
+        };
+
+        SamplerConfig config;
+        Schedule cpu_schedule;
+        Schedule mem_schedule;
+        vector<long long> old_core_load;
+        long long old_cpu_total{};
+        array<long long, 2> old_ram_percent{};
+        ut::str::string_map<std::pair<long long, uint64_t>> old_io_activity; // by mountpoint, io_activity and mem sample it was in
+        uint64_t mem_samples{};
+        cpu::DataCollector cpu_collector;
+        mem::DataCollector mem_collector;
+        cpu::Data cpu_data; // collected into in place, then copied into a free slot buffer
+        mem::Data mem_data;
+        SnapshotSlot<cpu::Data> cpu_slot;
+        SnapshotSlot<mem::Data> mem_slot;
+        std::unique_ptr<HistoryStore> history;
+        std::unique_ptr<Rollup> rollup;
+        std::unique_ptr<Exposition> exposition;
+        ThresholdMonitor thresholds;
+        std::atomic<uint64_t> failed_samples{};
+        std::atomic<uint64_t> dropped_samples{};
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping{};
+
+        void run();
+
+        template <typename T, typename C>
+        void sample(SnapshotSlot<T>& slot, C& collector, Schedule& schedule, T& data);
+
+        //* Largest change since the previous sample, in multiples of its noise floor
+        double get_activity(const cpu::Data& cpu);
+        double get_activity(const mem::Data& mem);
+        void adapt(Schedule& schedule, double activity, bool crossed);
+
+        void record_history();
+    };
+}
+
+#endif //HWINFO_SAMPLER_HPP
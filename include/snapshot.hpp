@@ -0,0 +1,240 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_SNAPSHOT_HPP
+#define HWINFO_SNAPSHOT_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <span>
+#include "cpu.hpp"
+#include "mem.hpp"
+
+/**
+ * Flat binary snapshots of cpu::Data and mem::Data.
+ *
+ * A snapshot is a SnapshotHeader followed by its SnapshotCore and SnapshotDisk arrays, all fixed layout
+ * in host byte order, so a reader can use it in place after SnapshotView checked the sizes.
+ * Strings are replaced by ids into a separate string table that only has to be sent again when
+ * SnapshotWriter::strings_changed() says so, every snapshot names the table version its ids refer to.
+ */
+namespace bhwinfo {
+    inline constexpr uint32_t snapshot_magic = 0x53574842; // "BHWS"
+    inline constexpr uint32_t string_table_magic = 0x54574842; // "BHWT"
+    inline constexpr uint32_t snapshot_ring_magic = 0x52574842; // "BHWR"
+    inline constexpr uint16_t snapshot_version = 1;
+
+    //* String id of an empty or missing string
+    inline constexpr uint32_t no_string = UINT32_MAX;
+
+    //* SnapshotDisk::flags
+    inline constexpr uint32_t snapshot_disk_stale = 1u << 0;
+
+    struct SnapshotHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t header_size;
+        uint32_t size; // header and both arrays, in bytes
+        uint32_t core_count;
+        uint32_t core_offset; // from the start of the header
+        uint32_t disk_count;
+        uint32_t disk_offset;
+        uint32_t cpu_name; // string id
+        uint64_t source_id; // chosen by the writer, e.g. a host id
+        uint64_t sequence;
+        uint64_t string_table_version; // oldest string table that resolves every id used here
+        int64_t timestamp_ns; // system clock, when the snapshot was written
+
+        /** cpu */
+        ut::type::enum_array<cpu::CpuField, int64_t> cpu_percent;
+        int64_t cpu_temp;
+        int64_t cpu_critical_temp;
+        array<float, 3> load_avg;
+        uint32_t cpu_frequency_units; // string id
+        double cpu_frequency;
+
+        /** mem, ram values are indexed by MemField::used, available, cached and free */
+        uint64_t ram_total;
+        ut::type::enum_array<mem::MemField, uint64_t, 4> ram_bytes;
+        ut::type::enum_array<mem::MemField, int64_t, 4> ram_percent;
+        ut::type::enum_array<mem::MemInfoField, uint64_t> meminfo;
+    };
+
+    struct SnapshotCore {
+        int64_t load;
+        int64_t frequency_khz;
+        int64_t temp; // 0 without per core sensors
+    };
+
+    struct SnapshotDisk {
+        uint32_t handle; // string ids
+        uint32_t fs_type;
+        uint32_t path;
+        uint32_t flags;
+        uint64_t total;
+        uint64_t used;
+        uint64_t free;
+        int32_t used_percent;
+        int32_t free_percent;
+        int64_t io_read;
+        int64_t io_write;
+        int64_t io_activity;
+    };
+
+    //* Followed by <count> + 1 uint32_t offsets into the character data that comes after them
+    struct StringTableHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t header_size;
+        uint32_t size; // header, offsets and character data, in bytes
+        uint32_t count;
+        uint64_t source_id;
+        uint64_t table_version;
+    };
+
+    static_assert(std::is_trivially_copyable_v<SnapshotHeader> and std::is_standard_layout_v<SnapshotHeader>);
+    static_assert(sizeof(SnapshotHeader) % 8 == 0 and sizeof(SnapshotCore) == 24 and sizeof(SnapshotDisk) == 72);
+    static_assert(sizeof(StringTableHeader) == 32);
+
+    /** Turns Data objects into snapshots and keeps the string table they refer to */
+    class SnapshotWriter {
+    public:
+        explicit SnapshotWriter(uint64_t source_id);
+
+        //* Bytes a snapshot of <cpu> and <mem> takes
+        [[nodiscard]] static size_t get_size(const cpu::Data& cpu, const mem::Data& mem);
+
+        //* Write a snapshot into <buffer>, which must be 8 byte aligned, and return its size. Throws std::length_error if it doesn't fit
+        size_t write(std::span<std::byte> buffer, const cpu::Data& cpu, const mem::Data& mem);
+
+        //* True when the table changed since the last write_strings(), every change bumps its version
+        [[nodiscard]] bool strings_changed() const;
+        [[nodiscard]] size_t get_strings_size() const;
+        [[nodiscard]] const uint64_t& get_strings_version() const;
+
+        //* Write the string table into <buffer> and return its size. Throws std::length_error if it doesn't fit
+        size_t write_strings(std::span<std::byte> buffer);
+
+        [[nodiscard]] const uint64_t& get_source_id() const;
+        [[nodiscard]] const uint64_t& get_sequence() const; // sequence of the next snapshot
+
+    private:
+        //? Start over once churning mounts have left this many strings behind
+        static constexpr size_t max_strings = 4096;
+
+        uint64_t source_id;
+        uint64_t sequence{};
+        uint64_t table_version{1};
+        uint64_t written_version{};
+        vector<string> strings;
+        ut::str::string_map<uint32_t> ids;
+
+        uint32_t intern(string_view str);
+    };
+
+    /** Checked, zero copy view of a snapshot in a buffer */
+    class SnapshotView {
+    public:
+        //* Throws std::runtime_error if <buffer> doesn't start with a complete snapshot of a known version
+        explicit SnapshotView(std::span<const std::byte> buffer);
+
+        [[nodiscard]] const SnapshotHeader& get_header() const;
+        [[nodiscard]] std::span<const SnapshotCore> get_cores() const;
+        [[nodiscard]] std::span<const SnapshotDisk> get_disks() const;
+
+    private:
+        const SnapshotHeader* header;
+    };
+
+    /** Checked, zero copy view of a string table in a buffer */
+    class StringTableView {
+    public:
+        //* Throws std::runtime_error if <buffer> doesn't start with a complete string table of a known version
+        explicit StringTableView(std::span<const std::byte> buffer);
+
+        [[nodiscard]] const StringTableHeader& get_header() const;
+        [[nodiscard]] string_view get(uint32_t id) const; // empty for no_string and unknown ids
+
+    private:
+        const StringTableHeader* header;
+        const uint32_t* offsets;
+        const char* chars;
+    };
+
+    /**
+     * Ring of fixed size snapshot slots in a shared file mapping, with one writing process and
+     * any number of reading processes. Slots and the string table region carry a sequence counter
+     * that is odd while they are written, readers copy out and retry if it moved underneath them.
+     */
+    class SnapshotRing {
+    public:
+        //* Create or truncate <path> for writing
+        SnapshotRing(const fs::path& path, uint32_t slot_size, uint32_t slot_count, uint32_t strings_size = 65536);
+
+        //* Open an existing ring for reading, throws std::runtime_error if <path> isn't one
+        explicit SnapshotRing(const fs::path& path);
+
+        ~SnapshotRing();
+
+        SnapshotRing(const SnapshotRing&) = delete;
+        SnapshotRing& operator=(const SnapshotRing&) = delete;
+
+        //* Write a snapshot into the next slot, and the string table first if it changed
+        void write(SnapshotWriter& writer, const cpu::Data& cpu, const mem::Data& mem);
+
+        //* Copy the latest complete snapshot into <out>, false if there is none or writes kept overtaking the copy
+        bool read_latest(vector<std::byte>& out) const;
+        bool read_strings(vector<std::byte>& out) const;
+
+        [[nodiscard]] uint32_t get_slot_size() const; // usable bytes per slot
+        [[nodiscard]] uint32_t get_slot_count() const;
+        [[nodiscard]] uint64_t get_head() const; // number of snapshots written
+
+    private:
+        struct RingHeader {
+            uint32_t magic;
+            uint16_t version;
+            uint16_t header_size;
+            uint32_t slot_size; // including the SlotHeader
+            uint32_t slot_count;
+            uint32_t strings_size; // including the SlotHeader
+            uint32_t reserved;
+            std::atomic<uint64_t> head;
+        };
+
+        struct SlotHeader {
+            std::atomic<uint64_t> sequence;
+            uint32_t size;
+            uint32_t reserved;
+        };
+
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring counters are shared between processes");
+
+        std::byte* map{};
+        size_t map_size{};
+        bool writable{};
+        uint64_t strings_version{}; // version of the table in the strings region
+
+        [[nodiscard]] RingHeader& ring() const;
+        [[nodiscard]] SlotHeader& strings_slot() const;
+        [[nodiscard]] SlotHeader& slot(uint64_t index) const;
+
+        static void write_slot(SlotHeader& slot, const auto& fill);
+        static bool read_slot(const SlotHeader& slot, size_t capacity, vector<std::byte>& out);
+    };
+}
+
+#endif //HWINFO_SNAPSHOT_HPP
@@ -0,0 +1,132 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HWINFO_THRESHOLD_HPP
+#define HWINFO_THRESHOLD_HPP
+
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include "cpu.hpp"
+#include "mem.hpp"
+
+namespace bhwinfo {
+    enum class Metric {
+        cpu_total, // CpuUsage::get_total_percent()
+        cpu_temp, // °C
+        cpu_temp_critical, // cpu_temp in percent of get_cpu_critical_temperature(), 0 without one
+        ram_used, // percent
+        disk_used // StorageUnit::get_used_percent(), per disk
+    };
+
+    /**
+     * Becomes active once the metric reaches <raise> and inactive again when it falls below <clear>,
+     * so a value hovering around the limit doesn't flap. <clear> defaults to <raise>.
+     */
+    struct Threshold {
+        Metric metric;
+        double raise;
+        std::optional<double> clear;
+        string disk; // mountpoint path or handle for Metric::disk_used, empty matches every disk
+    };
+
+    using SubscriptionId = uint32_t;
+
+    struct ThresholdEvent {
+        SubscriptionId id;
+        Metric metric;
+        bool active; // true when the threshold was crossed upwards
+        double value;
+        string disk; // mountpoint of the disk that crossed, its handle when it has none, empty for other metrics
+        int64_t timestamp_ns; // system clock, of the sample that crossed when the Sampler evaluates
+    };
+
+    /**
+     * Threshold subscriptions, evaluated against every sample by the Sampler. Subscribers only hear
+     * about transitions, ticks that don't cross anything never touch them.
+     */
+    class ThresholdMonitor {
+    public:
+        ThresholdMonitor() = default;
+        ~ThresholdMonitor();
+
+        ThresholdMonitor(const ThresholdMonitor&) = delete;
+        ThresholdMonitor& operator=(const ThresholdMonitor&) = delete;
+
+        //* Call <callback> on the sampling thread for every transition, it must not block
+        SubscriptionId subscribe(const Threshold& threshold, std::function<void(const ThresholdEvent&)> callback);
+
+        //* Queue transitions and signal the eventfd from get_fd(), read them with take_events()
+        SubscriptionId subscribe(const Threshold& threshold);
+
+        void unsubscribe(SubscriptionId id);
+
+        //* eventfd of a queueing subscription, readable while events are queued. -1 for unknown ids and callbacks
+        [[nodiscard]] int get_fd(SubscriptionId id) const;
+
+        //* Move the queued events of <id> into <out> and reset its eventfd, returns the number of events
+        size_t take_events(SubscriptionId id, vector<ThresholdEvent>& out);
+
+        //* Returns the number of transitions, over all subscriptions. Events are stamped with the current time
+        size_t evaluate(const cpu::Data& cpu);
+        size_t evaluate(const mem::Data& mem);
+
+        //* The same, stamping events with <timestamp_ns> of the system clock, e.g. SampleTime::timestamp_ns of the sample
+        size_t evaluate(const cpu::Data& cpu, int64_t timestamp_ns);
+        size_t evaluate(const mem::Data& mem, int64_t timestamp_ns);
+
+    private:
+        //? Oldest events are dropped beyond this, a subscriber that stopped reading can't grow the queue forever
+        static constexpr size_t max_queued = 1024;
+
+        //* Hysteresis state of one disk of a Metric::disk_used subscription
+        struct DiskState {
+            bool active{};
+            double value{}; // used percent of the last evaluate that wasn't stale
+            uint64_t seen{}; // evaluate of mem::Data the disk was last listed in
+        };
+
+        struct Subscription {
+            SubscriptionId id;
+            Threshold threshold;
+            double clear;
+            std::function<void(const ThresholdEvent&)> callback;
+            int fd{-1};
+            bool active{};
+            ut::str::string_map<DiskState> disks; // by mountpoint
+            std::deque<ThresholdEvent> queued;
+        };
+
+        struct Notification {
+            std::function<void(const ThresholdEvent&)> callback;
+            ThresholdEvent event;
+        };
+
+        mutable std::mutex mutex;
+        vector<Subscription> subscriptions;
+        SubscriptionId next_id{1};
+        vector<Notification> notifications; // collected under the lock, delivered after it
+        uint64_t mem_evaluations{};
+
+        SubscriptionId add(const Threshold& threshold, std::function<void(const ThresholdEvent&)> callback, int fd);
+        bool check(Subscription& subscription, bool& active, double value, const string& disk, int64_t timestamp);
+        void deliver(Subscription& subscription, ThresholdEvent event);
+        void notify();
+    };
+}
+
+#endif //HWINFO_THRESHOLD_HPP
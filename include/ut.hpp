@@ -21,9 +21,17 @@
 #include <filesystem>
 #include <utility>
 #include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cerrno>
 #include <fstream>
 #include <ranges>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
 #include <unistd.h>
+#include <linux/netlink.h>
+#include <sys/socket.h>
 #include <vector>
 
 using std::string;
@@ -37,7 +45,8 @@ namespace fs = std::filesystem;
 namespace rng = std::ranges;
 
 namespace shared {
-    inline fs::path proc_path, passwd_path;
+    inline fs::path proc_path, sys_path, passwd_path;
+    inline fs::path proc_root{"/proc"}, sys_root{"/sys"};
     inline long page_size, clk_tck;
     inline fs::path freq_path;
     inline bool is_init{};
@@ -47,15 +56,19 @@ namespace shared {
 
         // Shared global variables init
         proc_path =
-                (fs::is_directory(fs::path("/proc")) and access("/proc", R_OK) != -1) ? "/proc" : "";
+                (fs::is_directory(proc_root) and access(proc_root.c_str(), R_OK) != -1) ? proc_root : "";
 
         if (proc_path.empty())
             throw std::runtime_error("Proc filesystem not found or no permission to read from it!");
 
+        //? Only collectors that can't do without sysfs require it, the others skip what they'd read from there
+        sys_path =
+                (fs::is_directory(sys_root) and access(sys_root.c_str(), R_OK) != -1) ? sys_root : "";
+
         passwd_path =
                 (fs::is_regular_file(fs::path("/etc/passwd")) and access("/etc/passwd", R_OK) != -1) ? "/etc/passwd" : "";
 
-        freq_path = "/sys/devices/system/cpu/cpufreq/policy0/scaling_cur_freq";
+        freq_path = sys_path.empty() ? "" : sys_path / "devices/system/cpu/cpufreq/policy0/scaling_cur_freq";
 
         page_size = sysconf(_SC_PAGE_SIZE);
 
@@ -71,6 +84,28 @@ namespace shared {
 
         is_init = true;
     }
+
+    //* sys_path for the callers that need sysfs, throws when init() couldn't find it
+    inline const fs::path& require_sys_path() {
+        if (sys_path.empty())
+            throw std::runtime_error("Sys filesystem not found or no permission to read from it!");
+
+        return sys_path;
+    }
+
+    //* Read procfs and sysfs from <proc>/<sys> instead, e.g. /host/proc or a captured snapshot. Affects collectors created afterwards
+    inline void set_root(const fs::path& proc, const fs::path& sys) {
+        proc_root = proc;
+        sys_root = sys;
+        is_init = false;
+
+        init();
+    }
+
+    //* True when the collectors read the procfs of this process rather than a host mount or snapshot
+    inline bool is_local_root() {
+        return proc_path == "/proc";
+    }
 }
 
 
@@ -94,30 +129,22 @@ namespace ut {
         throw std::runtime_error("Failed get uptime from from " + string{shared::proc_path} + "/uptime");
     }
 
-    /** file utils */
-    namespace file {
-        inline string read(const std::filesystem::path& path, const string& fallback = "");
-
-        inline string read(const std::filesystem::path& path, const string& fallback) {
-            if (not fs::exists(path)) return fallback;
-
-            string out;
-
-            try {
-                std::ifstream file(path);
+    /** string utils */
+    namespace str {
+        //* Transparent string hash, lets string keyed containers be searched with a string_view
+        struct hash {
+            using is_transparent = void;
 
-                for (string readstr; getline(file, readstr); out += readstr);
-            }
-            catch (const std::exception& e) {
-                return fallback;
+            size_t operator()(string_view str) const {
+                return std::hash<string_view>{}(str);
             }
+        };
 
-            return (out.empty() ? fallback : out);
-        }
-    }
+        using string_set = std::unordered_set<string, hash, std::equal_to<>>;
+
+        template <typename T>
+        using string_map = std::unordered_map<string, T, hash, std::equal_to<>>;
 
-    /** string utils */
-    namespace str {
         inline string capitalize(string str) {
             str.at(0) = toupper(str.at(0));
 
@@ -175,6 +202,56 @@ namespace ut {
             return ltrim(rtrim(str, t_str), t_str);
         }
 
+        //* Return next line of <str> without the trailing newline and advance <str> past it
+        inline string_view next_line(string_view& str) {
+            const size_t end = str.find('\n');
+            const string_view line = str.substr(0, end);
+
+            str.remove_prefix(end == string_view::npos ? str.size() : end + 1);
+
+            return line;
+        }
+
+        //* Parse the next blank separated number of <str> into <out> and advance <str> past it
+        template <typename T>
+        inline bool next_number(string_view& str, T& out) {
+            while (not str.empty() and (str.front() == ' ' or str.front() == '\t'))
+                str.remove_prefix(1);
+
+            const auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.size(), out);
+
+            if (ec != std::errc{}) return false;
+
+            str.remove_prefix(ptr - str.data());
+
+            return true;
+        }
+
+        //* Parse a sysfs cpu list like "0-3,8,10-11" or "0 1 2 3" into the listed numbers, in order
+        inline vector<int> parse_list(string_view str) {
+            vector<int> out;
+
+            while (not str.empty()) {
+                if (str.front() == ',' or str.front() == ' ' or str.front() == '\n') {
+                    str.remove_prefix(1);
+                    continue;
+                }
+
+                int first, last;
+                if (not next_number(str, first) or first < 0) break;
+
+                last = first;
+                if (str.starts_with('-')) {
+                    str.remove_prefix(1);
+                    if (not next_number(str, last) or last < first) break;
+                }
+
+                for (int i = first; i <= last; i++) out.push_back(i);
+            }
+
+            return out;
+        }
+
         //* Return <str> with only lowercase characters
         inline string to_lower(string str) {
             std::ranges::for_each(str, [](char& c) { c = ::tolower(c); } );
@@ -183,6 +260,364 @@ namespace ut {
         }
     }
 
+    /**
+     * Collect instrumentation, compiled in with -DBHWINFO_INSTRUMENT (cmake -DBHWINFO_INSTRUMENT=ON).
+     * Without it every hook below is an empty inline function and CollectStats stays zeroed.
+     */
+    namespace stats {
+#ifdef BHWINFO_INSTRUMENT
+        inline constexpr bool enabled = true;
+#else
+        inline constexpr bool enabled = false;
+#endif
+
+        enum class CollectStage : size_t {
+            loadavg, stat, sensors, freq, // cpu::DataCollector
+            meminfo, mounts, statvfs, diskstats, numa, // mem::DataCollector
+            netdev, // net::DataCollector
+            count
+        };
+
+        inline constexpr array<string_view, static_cast<size_t>(CollectStage::count)> stage_names {
+            "loadavg"sv, "stat"sv, "sensors"sv, "freq"sv, "meminfo"sv, "mounts"sv, "statvfs"sv, "diskstats"sv, "numa"sv, "netdev"sv
+        };
+
+        //* Cost of one collect() call, stages the collector doesn't have stay at 0
+        struct CollectStats {
+            array<std::chrono::nanoseconds, static_cast<size_t>(CollectStage::count)> durations{};
+            uint64_t files_opened{};
+            uint64_t bytes_read{};
+
+            std::chrono::nanoseconds& operator[](CollectStage stage) {
+                return durations[static_cast<size_t>(stage)];
+            }
+
+            const std::chrono::nanoseconds& operator[](CollectStage stage) const {
+                return durations[static_cast<size_t>(stage)];
+            }
+        };
+
+        //? Stats of the collect() running on this thread, file reads made anywhere else aren't counted
+        inline thread_local CollectStats* current = nullptr;
+
+        inline void count_open() {
+            if constexpr (enabled) {
+                if (current != nullptr) current->files_opened++;
+            }
+        }
+
+        inline void count_read(ssize_t bytes) {
+            if constexpr (enabled) {
+                if (current != nullptr and bytes > 0) current->bytes_read += bytes;
+            }
+        }
+
+        /**
+         * Resets <stats> and makes it the target of this thread's counters until destroyed,
+         * while timing the stages that are entered through next() one after another.
+         */
+        class Scope {
+        private:
+            [[maybe_unused]] CollectStats* target;
+            [[maybe_unused]] CollectStats* previous;
+            [[maybe_unused]] CollectStage stage{CollectStage::count};
+            [[maybe_unused]] std::chrono::steady_clock::time_point started{};
+
+        public:
+            explicit Scope(CollectStats& stats) : target(&stats), previous(enabled ? current : nullptr) {
+                if constexpr (enabled) {
+                    stats = {};
+                    current = &stats;
+                }
+            }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+            ~Scope() {
+                if constexpr (enabled) {
+                    stop();
+                    current = previous;
+                }
+            }
+
+            //* End the running stage and start timing <next_stage>, stages entered again add up
+            void next(CollectStage next_stage) {
+                if constexpr (enabled) {
+                    const auto now = std::chrono::steady_clock::now();
+
+                    if (stage != CollectStage::count) (*target)[stage] += now - started;
+
+                    stage = next_stage;
+                    started = now;
+                }
+            }
+
+            void stop() {
+                if constexpr (enabled) {
+                    if (stage != CollectStage::count) (*target)[stage] += std::chrono::steady_clock::now() - started;
+
+                    stage = CollectStage::count;
+                }
+            }
+        };
+    }
+
+    /** file utils */
+    namespace file {
+        inline string read(const std::filesystem::path& path, const string& fallback = "");
+
+        inline string read(const std::filesystem::path& path, const string& fallback) {
+            if (not fs::exists(path)) return fallback;
+
+            string out;
+
+            try {
+                std::ifstream file(path);
+
+                if (file.is_open()) stats::count_open();
+
+                for (string readstr; getline(file, readstr); out += readstr);
+
+                stats::count_read((ssize_t) out.size());
+            }
+            catch (const std::exception& e) {
+                return fallback;
+            }
+
+            return (out.empty() ? fallback : out);
+        }
+
+        /**
+         * Keeps a procfs/sysfs file open and re-reads it from offset 0 with pread() into a reusable buffer.
+         * The buffer only grows when the file outgrows it, so steady state reads do not allocate.
+         */
+        class CachedReader {
+        private:
+            fs::path path;
+            int fd{-1};
+            size_t capacity{};
+            vector<char> buffer;
+
+        public:
+            CachedReader() = default;
+
+            //* The buffer of <capacity> bytes is only allocated by the first read()
+            explicit CachedReader(fs::path path, size_t capacity = 4096) : path(std::move(path)), capacity(capacity) {}
+
+            CachedReader(const CachedReader&) = delete;
+            CachedReader& operator=(const CachedReader&) = delete;
+
+            CachedReader(CachedReader&& other) noexcept :
+            path(std::move(other.path)),
+            fd(std::exchange(other.fd, -1)),
+            capacity(other.capacity),
+            buffer(std::move(other.buffer)) {}
+
+            CachedReader& operator=(CachedReader&& other) noexcept {
+                if (this != &other) {
+                    close();
+                    path = std::move(other.path);
+                    fd = std::exchange(other.fd, -1);
+                    capacity = other.capacity;
+                    buffer = std::move(other.buffer);
+                }
+
+                return *this;
+            }
+
+            ~CachedReader() {
+                close();
+            }
+
+            [[nodiscard]] const fs::path& get_path() const {
+                return path;
+            }
+
+            [[nodiscard]] bool is_open() const {
+                return fd >= 0;
+            }
+
+            [[nodiscard]] int get_fd() const {
+                return fd;
+            }
+
+            bool open() {
+                if (fd < 0 and not path.empty()) {
+                    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+                    if (fd >= 0) stats::count_open();
+                }
+
+                return fd >= 0;
+            }
+
+            void close() {
+                if (fd >= 0) ::close(fd);
+
+                fd = -1;
+            }
+
+            //* Return the current file content, empty view on failure. Valid until the next read()
+            string_view read() {
+                if (not open()) return {};
+
+                if (buffer.empty()) buffer.resize(std::max(capacity, (size_t) 64));
+
+                for (;;) {
+                    const ssize_t size = pread(fd, buffer.data(), buffer.size(), 0);
+
+                    stats::count_read(size);
+
+                    if (size < 0) {
+                        if (errno == EINTR) continue;
+
+                        return {};
+                    }
+
+                    //? A full buffer means the file might be longer, grow and read it again from the start
+                    if ((size_t) size == buffer.size()) {
+                        buffer.resize(buffer.size() * 2);
+                        continue;
+                    }
+
+                    return {buffer.data(), (size_t) size};
+                }
+            }
+
+            //* Return at most the first <capacity> bytes of the file, for long files where only the start matters
+            string_view read_head() {
+                if (not open()) return {};
+
+                if (buffer.empty()) buffer.resize(std::max(capacity, (size_t) 64));
+
+                ssize_t size;
+
+                do size = pread(fd, buffer.data(), buffer.size(), 0); while (size < 0 and errno == EINTR);
+
+                stats::count_read(size);
+
+                if (size <= 0) return {};
+
+                return {buffer.data(), (size_t) size};
+            }
+
+            //* Parse the number at the start of the file, <fallback> on failure. Reads into a stack buffer
+            template <typename T>
+            T read_number(const T& fallback = {}) {
+                if (not open()) return fallback;
+
+                char buf[64];
+                ssize_t size;
+
+                do size = pread(fd, buf, sizeof buf, 0); while (size < 0 and errno == EINTR);
+
+                stats::count_read(size);
+
+                if (size <= 0) return fallback;
+
+                string_view str{buf, (size_t) size};
+                T out;
+
+                return str::next_number(str, out) ? out : fallback;
+            }
+        };
+    }
+
+    /** kernel uevent utils */
+    namespace uevent {
+        /**
+         * Non-blocking listener on the NETLINK_KOBJECT_UEVENT socket, lets collectors notice hotplugged
+         * devices without rescanning sysfs on every collect
+         */
+        class Monitor {
+        private:
+            int fd{-1};
+
+        public:
+            Monitor() = default;
+
+            Monitor(const Monitor&) = delete;
+            Monitor& operator=(const Monitor&) = delete;
+
+            Monitor(Monitor&& other) noexcept : fd(std::exchange(other.fd, -1)) {}
+
+            Monitor& operator=(Monitor&& other) noexcept {
+                if (this != &other) {
+                    close();
+                    fd = std::exchange(other.fd, -1);
+                }
+
+                return *this;
+            }
+
+            ~Monitor() {
+                close();
+            }
+
+            [[nodiscard]] bool is_open() const {
+                return fd >= 0;
+            }
+
+            //* Subscribe to kernel uevents, false if netlink is unavailable (e.g. no permission in a sandbox)
+            bool open() {
+                if (fd >= 0) return true;
+
+                fd = ::socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+
+                if (fd < 0) return false;
+
+                sockaddr_nl addr{};
+                addr.nl_family = AF_NETLINK;
+                addr.nl_groups = 1; // kernel events
+
+                if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) < 0) close();
+
+                return fd >= 0;
+            }
+
+            void close() {
+                if (fd >= 0) ::close(fd);
+
+                fd = -1;
+            }
+
+            //* Drain all pending events, true if any of them came from one of <subsystems> or events were lost
+            bool poll(std::initializer_list<string_view> subsystems) {
+                if (fd < 0) return false;
+
+                bool matched = false;
+                char buf[8192];
+
+                for (;;) {
+                    const ssize_t size = ::recv(fd, buf, sizeof buf, 0);
+
+                    if (size < 0) {
+                        if (errno == EINTR) continue;
+
+                        //? The socket buffer overflowed, anything could have changed
+                        if (errno == ENOBUFS) matched = true;
+
+                        return matched;
+                    }
+
+                    //? Payload is "action@devpath" followed by NUL separated KEY=value pairs
+                    string_view event{buf, (size_t) size};
+
+                    while (not matched and not event.empty()) {
+                        const size_t end = event.find('\0');
+                        const string_view pair = event.substr(0, end);
+
+                        if (pair.starts_with("SUBSYSTEM="))
+                            matched = rng::find(subsystems, pair.substr(10)) != subsystems.end();
+
+                        event.remove_prefix(end == string_view::npos ? event.size() : end + 1);
+                    }
+                }
+            }
+        };
+    }
+
     /** vector utils */
     namespace vec {
         template <typename T, typename T2>
@@ -198,6 +633,18 @@ namespace ut {
 
     /** type utils */
     namespace type {
+        //* std::array indexed by the enumerators of <E>, sized by its trailing <E>::count enumerator
+        template <typename E, typename T, size_t N = static_cast<size_t>(E::count)>
+        struct enum_array : array<T, N> {
+            constexpr T& operator[](E e) {
+                return array<T, N>::operator[](static_cast<size_t>(e));
+            }
+
+            constexpr const T& operator[](E e) const {
+                return array<T, N>::operator[](static_cast<size_t>(e));
+            }
+        };
+
         template<typename First, typename ... T>
         inline bool is_in(const First& first, const T& ... t) {
             return ((first == t) or ...);
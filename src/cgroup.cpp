@@ -0,0 +1,217 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/sysmacros.h>
+#include <numeric>
+#include "../include/cgroup.hpp"
+
+namespace cgroup {
+    namespace {
+        //* Mount point of the unified hierarchy, /sys/fs/cgroup/unified on hybrid cgroup v1 hosts
+        fs::path get_root() {
+            std::error_code ec;
+            const fs::path root = shared::require_sys_path() / "fs/cgroup";
+
+            if (not fs::exists(root / "cgroup.controllers", ec) and fs::exists(root / "unified/cgroup.controllers", ec))
+                return root / "unified";
+
+            return root;
+        }
+
+        //* Parse the "key value" lines of <str>, calling <visit>(key, value) for each
+        template <typename F>
+        void parse_keyed(string_view str, F&& visit) {
+            while (not str.empty()) {
+                string_view line = ut::str::next_line(str);
+                const string_view key = line.substr(0, line.find(' '));
+                uint64_t value;
+
+                line.remove_prefix(key.size());
+
+                if (ut::str::next_number(line, value)) visit(key, value);
+            }
+        }
+    }
+
+    fs::path find_group(const string& pid) {
+        shared::init();
+
+        const string content = ut::file::read(shared::proc_path / pid / "cgroup");
+        string_view cgroups = content;
+
+        //? cgroup v2 has a single "0::<path>" line, v1 controllers are listed with their own hierarchy ids
+        while (not cgroups.empty()) {
+            string_view line = ut::str::next_line(cgroups);
+
+            if (not line.starts_with("0::")) continue;
+
+            line.remove_prefix(3);
+
+            while (line.starts_with('/')) line.remove_prefix(1);
+
+            return get_root() / line;
+        }
+
+        throw std::runtime_error("No cgroup v2 group in " + (shared::proc_path / pid / "cgroup").string());
+    }
+
+    Group::Group(fs::path path) :
+    path(std::move(path)),
+    cpu_stat_reader(this->path / "cpu.stat", 512),
+    cpu_max_reader(this->path / "cpu.max", 64),
+    memory_current_reader(this->path / "memory.current", 64),
+    memory_max_reader(this->path / "memory.max", 64),
+    swap_current_reader(this->path / "memory.swap.current", 64),
+    swap_max_reader(this->path / "memory.swap.max", 64),
+    memory_stat_reader(this->path / "memory.stat", 2048),
+    io_stat_reader(this->path / "io.stat", 1024) {
+        std::error_code ec;
+
+        if (not fs::exists(this->path / "cgroup.controllers", ec))
+            throw std::runtime_error(this->path.string() + " is not a cgroup v2 group");
+    }
+
+    const fs::path& Group::get_path() const {
+        return path;
+    }
+
+    vector<int> Group::read_cpus(int core_count) const {
+        const fs::path root = get_root();
+        vector<int> cpus;
+
+        //? The file only exists where the cpuset controller is enabled, parents restrict their children the same way
+        for (fs::path dir = path; cpus.empty(); dir = dir.parent_path()) {
+            cpus = ut::str::parse_list(ut::file::read(dir / "cpuset.cpus.effective"));
+
+            if (dir == root or dir == dir.parent_path() or not dir.native().starts_with(root.native())) break;
+        }
+
+        std::erase_if(cpus, [&](const int& cpu) { return cpu >= core_count; });
+
+        if (cpus.empty()) {
+            cpus.resize(core_count);
+            std::iota(cpus.begin(), cpus.end(), 0);
+        }
+
+        rng::sort(cpus);
+        cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+
+        return cpus;
+    }
+
+    double Group::read_cpu_limit() {
+        //? "<quota> <period>" in µs, or "max <period>" without a quota
+        string_view max = cpu_max_reader.read();
+        uint64_t quota, period;
+
+        if (not ut::str::next_number(max, quota) or not ut::str::next_number(max, period) or period == 0) return 0;
+
+        return (double) quota / (double) period;
+    }
+
+    const CpuStat& Group::read_cpu_stat() {
+        const string_view stat = cpu_stat_reader.read();
+
+        if (stat.empty()) throw std::runtime_error("Failed to read " + cpu_stat_reader.get_path().string());
+
+        parse_keyed(stat, [this](string_view key, uint64_t value) {
+            if (key == "usage_usec") cpu_stat.usage_usec = value;
+            else if (key == "user_usec") cpu_stat.user_usec = value;
+            else if (key == "system_usec") cpu_stat.system_usec = value;
+            else if (key == "nr_periods") cpu_stat.nr_periods = value;
+            else if (key == "nr_throttled") cpu_stat.nr_throttled = value;
+            else if (key == "throttled_usec") cpu_stat.throttled_usec = value;
+        });
+
+        return cpu_stat;
+    }
+
+    const CpuStat& Group::get_cpu_stat() const {
+        return cpu_stat;
+    }
+
+    uint64_t Group::read_memory_current() {
+        string_view current = memory_current_reader.read();
+        uint64_t bytes;
+
+        if (not ut::str::next_number(current, bytes))
+            throw std::runtime_error("Failed to read " + memory_current_reader.get_path().string());
+
+        return bytes;
+    }
+
+    uint64_t Group::read_memory_max() {
+        return read_limit(memory_max_reader);
+    }
+
+    uint64_t Group::read_swap_current() {
+        return swap_current_reader.read_number<uint64_t>(0);
+    }
+
+    uint64_t Group::read_swap_max() {
+        return read_limit(swap_max_reader);
+    }
+
+    string_view Group::read_memory_stat() {
+        return memory_stat_reader.read();
+    }
+
+    const vector<IoStat>& Group::read_io_stat() {
+        string_view stat = io_stat_reader.read();
+
+        io_stat.clear();
+
+        //? Rows are "<major>:<minor> rbytes=<n> wbytes=<n> rios=<n> wios=<n> dbytes=<n> dios=<n>"
+        while (not stat.empty()) {
+            string_view line = ut::str::next_line(stat);
+            unsigned int major, minor;
+
+            if (not ut::str::next_number(line, major) or not line.starts_with(':')) continue;
+
+            line.remove_prefix(1);
+
+            if (not ut::str::next_number(line, minor)) continue;
+
+            IoStat& row = io_stat.emplace_back(IoStat{makedev(major, minor)});
+
+            while (not line.empty()) {
+                while (line.starts_with(' ')) line.remove_prefix(1);
+
+                const string_view key = line.substr(0, line.find('='));
+
+                line.remove_prefix(std::min(key.size() + 1, line.size()));
+
+                uint64_t value = 0;
+                ut::str::next_number(line, value);
+                line.remove_prefix(std::min(line.find(' '), line.size()));
+
+                if (key == "rbytes") row.rbytes = value;
+                else if (key == "wbytes") row.wbytes = value;
+                else if (key == "rios") row.rios = value;
+                else if (key == "wios") row.wios = value;
+            }
+        }
+
+        return io_stat;
+    }
+
+    uint64_t Group::read_limit(ut::file::CachedReader& reader) {
+        string_view limit = reader.read();
+        uint64_t bytes;
+
+        return ut::str::next_number(limit, bytes) ? bytes : unlimited;
+    }
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "../include/collector.hpp"
+
+namespace bhwinfo {
+    Collector::Collector() = default;
+
+    Collector::Collector(const fs::path& cgroup) : cpu_collector(cgroup), mem_collector(cgroup) {}
+
+    Sample Collector::collect() {
+        Sample sample;
+        collect_into(sample);
+
+        return sample;
+    }
+
+    void Collector::collect_into(Sample& out) {
+        //? Both clocks are read once, every collector measures its rates up to the same point
+        out.time = std::chrono::steady_clock::now();
+        out.timestamp_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+
+        cpu_collector.collect_into(out.cpu, out.time);
+        mem_collector.collect_into(out.mem, out.time);
+        net_collector.collect_into(out.net, out.time);
+        out.sequence = ++sequence;
+    }
+
+    cpu::DataCollector& Collector::get_cpu_collector() {
+        return cpu_collector;
+    }
+
+    mem::DataCollector& Collector::get_mem_collector() {
+        return mem_collector;
+    }
+
+    net::DataCollector& Collector::get_net_collector() {
+        return net_collector;
+    }
+
+    const uint64_t& Collector::get_sequence() const {
+        return sequence;
+    }
+}
@@ -17,9 +17,11 @@
 
 #include <unistd.h>
 #include <fstream>
+#include <map>
 #include <numeric>
 #include "cmath"
 #include "../include/cpu.hpp"
+#include "../include/cpu_kernel.hpp"
 
 using std::round;
 using std::clamp;
@@ -57,6 +59,8 @@ namespace cpu {
         return fifteen_min;
     }
     
+    CpuUsage::CpuUsage(const ut::type::enum_array<CpuField, long long>& percent) : percent(percent) {}
+
     CpuUsage::CpuUsage(
         const long long int& total_percent,
         const long long int& user_percent,
@@ -69,90 +73,131 @@ namespace cpu {
         const long long int& steal_percent,
         const long long int& guest_percent,
         const long long int& guest_nice_percent
-    ) :
-    total_percent(total_percent),
-    user_percent(user_percent),
-    nice_percent(nice_percent),
-    system_percent(system_percent),
-    idle_percent(idle_percent),
-    iowait_percent(iowait_percent),
-    irq_percent(irq_percent),
-    softirq_percent(softirq_percent),
-    steal_percent(steal_percent),
-    guest_percent(guest_percent),
-    guest_nice_percent(guest_nice_percent) {}
+    ) {
+        percent[CpuField::total] = total_percent;
+        percent[CpuField::user] = user_percent;
+        percent[CpuField::nice] = nice_percent;
+        percent[CpuField::system] = system_percent;
+        percent[CpuField::idle] = idle_percent;
+        percent[CpuField::iowait] = iowait_percent;
+        percent[CpuField::irq] = irq_percent;
+        percent[CpuField::softirq] = softirq_percent;
+        percent[CpuField::steal] = steal_percent;
+        percent[CpuField::guest] = guest_percent;
+        percent[CpuField::guest_nice] = guest_nice_percent;
+    }
 
     const long long int& CpuUsage::get_total_percent() const {
-        return total_percent;
+        return percent[CpuField::total];
     }
 
     const long long int& CpuUsage::get_user_percent() const {
-        return user_percent;
+        return percent[CpuField::user];
     }
 
     const long long int& CpuUsage::get_nice_percent() const {
-        return nice_percent;
+        return percent[CpuField::nice];
     }
 
     const long long int& CpuUsage::get_system_percent() const {
-        return system_percent;
+        return percent[CpuField::system];
     }
 
     const long long int& CpuUsage::get_idle_percent() const {
-        return idle_percent;
+        return percent[CpuField::idle];
     }
 
     const long long int& CpuUsage::get_iowait_percent() const {
-        return iowait_percent;
+        return percent[CpuField::iowait];
     }
 
     const long long int& CpuUsage::get_irq_percent() const {
-        return irq_percent;
+        return percent[CpuField::irq];
     }
 
     const long long int& CpuUsage::get_softirq_percent() const {
-        return softirq_percent;
+        return percent[CpuField::softirq];
     }
 
     const long long int& CpuUsage::get_steal_percent() const {
-        return steal_percent;
+        return percent[CpuField::steal];
     }
 
     const long long int& CpuUsage::get_guest_percent() const {
-        return guest_percent;
+        return percent[CpuField::guest];
     }
 
     const long long int& CpuUsage::get_guest_nice_percent() const {
-        return guest_nice_percent;
+        return percent[CpuField::guest_nice];
+    }
+
+    const long long int& CpuUsage::get_percent(CpuField field) const {
+        return percent[field];
     }
 
     StaticValuesAware::StaticValuesAware(
-        const string& cpu_name, 
-        int core_count, 
+        std::shared_ptr<const string> cpu_name,
+        int core_count,
         long long int critical_temperature
-    ) : 
-    cpu_name(cpu_name), 
-    core_count(core_count), 
+    ) :
+    cpu_name(cpu_name ? std::move(cpu_name) : StaticValuesAware().cpu_name),
+    core_count(core_count),
     critical_temperature(critical_temperature) {}
 
-    StaticValuesAware::StaticValuesAware() = default;
+    StaticValuesAware::StaticValuesAware() {
+        //? Default constructed Data all point to the same empty name
+        static const auto empty_name = std::make_shared<const string>();
+
+        cpu_name = empty_name;
+    }
+
+    Data::Data() = default;
 
     Data::Data(
         const CpuUsage& cpu_usage,
         const int64_t& cpu_temp,
         const CpuAvgLoad& cpu_load_avg,
-        const vector<long long>& core_load,
-        const CpuFrequency& cpu_frequency,
+        vector<long long> core_load,
+        CpuFrequency cpu_frequency,
         const string& cpu_name,
         const int& core_count,
-        const long long& critical_temperature
+        const long long& critical_temperature,
+        vector<long long> core_frequency,
+        vector<int64_t> core_temp,
+        vector<long long> core_usage,
+        vector<int> numa_nodes,
+        vector<long long> node_usage
     ) :
-    StaticValuesAware(cpu_name, core_count, critical_temperature),
+    Data(cpu_usage, cpu_temp, cpu_load_avg, std::move(core_load), std::move(cpu_frequency),
+         std::make_shared<const string>(cpu_name), core_count, critical_temperature,
+         std::move(core_frequency), std::move(core_temp), std::move(core_usage), std::move(numa_nodes), std::move(node_usage)) {}
+
+    Data::Data(
+        const CpuUsage& cpu_usage,
+        const int64_t& cpu_temp,
+        const CpuAvgLoad& cpu_load_avg,
+        vector<long long> core_load,
+        CpuFrequency cpu_frequency,
+        std::shared_ptr<const string> cpu_name,
+        const int& core_count,
+        const long long& critical_temperature,
+        vector<long long> core_frequency,
+        vector<int64_t> core_temp,
+        vector<long long> core_usage,
+        vector<int> numa_nodes,
+        vector<long long> node_usage
+    ) :
+    StaticValuesAware(std::move(cpu_name), core_count, critical_temperature),
     cpu_usage(cpu_usage),
     cpu_temp(cpu_temp),
     cpu_load_avg(cpu_load_avg),
-    core_load(core_load),
-    cpu_frequency(cpu_frequency) {}
+    core_load(std::move(core_load)),
+    core_frequency(std::move(core_frequency)),
+    core_temp(std::move(core_temp)),
+    core_usage(std::move(core_usage)),
+    numa_nodes(std::move(numa_nodes)),
+    node_usage(std::move(node_usage)),
+    cpu_frequency(std::move(cpu_frequency)) {}
 
     const CpuUsage& Data::get_cpu_usage() const {
         return cpu_usage;
@@ -162,20 +207,44 @@ namespace cpu {
         return cpu_temp;
     }
 
-    const CpuAvgLoad& Data::get_average_load() {
+    const CpuAvgLoad& Data::get_average_load() const {
         return cpu_load_avg;
     }
 
-    const vector<long long>& Data::get_core_load() {
+    const vector<long long>& Data::get_core_load() const {
         return core_load;
     }
 
-    const CpuFrequency& Data::get_cpu_frequency() {
+    const vector<long long>& Data::get_core_frequency() const {
+        return core_frequency;
+    }
+
+    const vector<int64_t>& Data::get_core_temp() const {
+        return core_temp;
+    }
+
+    std::span<const long long> Data::get_core_usage(CpuField field) const {
+        const size_t cores = core_usage.size() / static_cast<size_t>(CpuField::count);
+
+        return std::span{core_usage}.subspan(static_cast<size_t>(field) * cores, cores);
+    }
+
+    const vector<int>& Data::get_numa_nodes() const {
+        return numa_nodes;
+    }
+
+    std::span<const long long> Data::get_node_usage(CpuField field) const {
+        const size_t nodes = node_usage.size() / static_cast<size_t>(CpuField::count);
+
+        return std::span{node_usage}.subspan(static_cast<size_t>(field) * nodes, nodes);
+    }
+
+    const CpuFrequency& Data::get_cpu_frequency() const {
         return cpu_frequency;
     }
 
-    const string& Data::get_cpu_mame() {
-        return cpu_name;
+    const string& Data::get_cpu_mame() const {
+        return *cpu_name;
     }
 
     const int& Data::get_core_count() const {
@@ -186,36 +255,399 @@ namespace cpu {
         return critical_temperature;
     }
 
-    DataCollector::DataCollector() {
+    size_t History::Window::size() const {
+        return older.size() + newer.size();
+    }
+
+    const long long& History::Window::operator[](size_t index) const {
+        return index < older.size() ? older[index] : newer[index - older.size()];
+    }
+
+    const long long& History::Window::latest() const {
+        return newer.empty() ? older.back() : newer.back();
+    }
+
+    History::History(size_t capacity, int core_count) :
+    capacity(capacity),
+    core_count(core_count),
+    core_rings(capacity * core_count),
+    usage_rings(capacity * static_cast<size_t>(CpuField::count)) {}
+
+    void History::push(const ut::type::enum_array<CpuField, long long>& usage, const vector<long long>& core_load) {
+        if (capacity == 0) return;
+
+        for (size_t field = 0; field < usage.size(); field++) {
+            usage_rings[field * capacity + head] = usage[CpuField(field)];
+        }
+
+        const size_t cores = std::min(core_load.size(), (size_t) core_count);
+
+        for (size_t core = 0; core < cores; core++) {
+            core_rings[core * capacity + head] = core_load[core];
+        }
+
+        head = (head + 1) % capacity;
+        size = std::min(size + 1, capacity);
+    }
+
+    void History::clear() {
+        head = 0;
+        size = 0;
+    }
+
+    const size_t& History::get_capacity() const {
+        return capacity;
+    }
+
+    const size_t& History::get_size() const {
+        return size;
+    }
+
+    const size_t& History::get_head() const {
+        return head;
+    }
+
+    const int& History::get_core_count() const {
+        return core_count;
+    }
+
+    History::Window History::get_core_load(int core) const {
+        return window(get_core_ring(core));
+    }
+
+    History::Window History::get_usage(CpuField field) const {
+        return window(get_usage_ring(field));
+    }
+
+    std::span<const long long> History::get_core_ring(int core) const {
+        if (core < 0 or core >= core_count) throw std::out_of_range("History core index out of range");
+
+        return std::span{core_rings}.subspan(core * capacity, capacity);
+    }
+
+    std::span<const long long> History::get_usage_ring(CpuField field) const {
+        return std::span{usage_rings}.subspan(static_cast<size_t>(field) * capacity, capacity);
+    }
+
+    History::Window History::window(std::span<const long long> ring) const {
+        //? Until the ring wraps around the samples are stored from slot 0 up to head
+        if (size < capacity) return {ring.first(size), {}};
+
+        return {ring.subspan(head), ring.first(head)};
+    }
+
+    std::shared_ptr<const Topology> Topology::get() {
+        static std::mutex mutex;
+        static std::shared_ptr<const Topology> cached;
+
+        std::lock_guard lock(mutex);
+
+        //? Rebuilt when shared::set_root() pointed the collectors somewhere else
+        if (not cached or cached->proc != shared::proc_path or cached->sys != shared::sys_path)
+            cached = std::make_shared<const Topology>(shared::proc_path, shared::sys_path);
+
+        return cached;
+    }
+
+    Topology::Topology(fs::path proc, fs::path sys) : proc(std::move(proc)), sys(std::move(sys)) {
+        name = read_name(this->proc, this->sys);
+        core_count = read_core_count(this->proc, this->sys);
+    }
+
+    const string& Topology::get_name() const {
+        return name;
+    }
+
+    const int& Topology::get_core_count() const {
+        return core_count;
+    }
+
+    const vector<CoreTopology>& Topology::get_cores() const {
+        return get_layout().cores;
+    }
+
+    const int& Topology::get_physical_core_count() const {
+        return get_layout().physical_core_count;
+    }
+
+    const int& Topology::get_socket_count() const {
+        return get_layout().socket_count;
+    }
+
+    const int& Topology::get_numa_node_count() const {
+        return get_layout().numa_node_count;
+    }
+
+    const vector<int>& Topology::get_numa_nodes() const {
+        return get_layout().numa_nodes;
+    }
+
+    const int& Topology::get_threads_per_core() const {
+        return get_layout().threads_per_core;
+    }
+
+    const Topology::Layout& Topology::get_layout() const {
+        std::call_once(layout_once, [this]() {
+            auto& cores = layout.cores;
+            cores.resize(core_count);
+
+            //? Without sysfs every core keeps the -1 defaults, one socket and no NUMA nodes
+            if (sys.empty()) {
+                layout.physical_core_count = core_count;
+                return;
+            }
+
+            const fs::path cpu_path = sys / "devices/system/cpu";
+
+            for (int i = 0; i < core_count; i++) {
+                const fs::path topology = cpu_path / ("cpu" + std::to_string(i)) / "topology";
+                auto& core = cores[i];
+
+                //? Offline cores have no topology directory and keep the -1 defaults
+                if (ut::file::CachedReader package{topology / "physical_package_id", 64}; package.open())
+                    core.socket = package.read_number<int>(-1);
+
+                if (ut::file::CachedReader core_id{topology / "core_id", 64}; core_id.open())
+                    core.core = core_id.read_number<int>(-1);
+
+                core.siblings = ut::str::parse_list(ut::file::read(topology / "thread_siblings_list"));
+            }
+
+            std::error_code ec;
+            for (const auto& d : fs::directory_iterator(sys / "devices/system/node", ec)) {
+                const string dirname = d.path().filename();
+
+                if (not dirname.starts_with("node") or dirname.size() == 4) continue;
+
+                int node;
+                string_view id = string_view{dirname}.substr(4);
+                if (not ut::str::next_number(id, node) or not id.empty()) continue;
+
+                layout.numa_node_count = max(layout.numa_node_count, node + 1);
+                layout.numa_nodes.push_back(node);
+
+                for (const int core : ut::str::parse_list(ut::file::read(d.path() / "cpulist")))
+                    if (core < core_count) cores[core].numa_node = node;
+            }
+
+            rng::sort(layout.numa_nodes);
+
+            //? Every physical core has its own sibling list, cores without topology are offline or unreported
+            std::unordered_set<int> sockets, physical;
+
+            for (const auto& core : cores) {
+                if (core.socket >= 0) sockets.insert(core.socket);
+                if (core.siblings.empty()) continue;
+
+                physical.insert(core.siblings.front());
+                layout.threads_per_core = max(layout.threads_per_core, (int) core.siblings.size());
+            }
+
+            layout.socket_count = max(1, (int) sockets.size());
+            layout.physical_core_count = physical.empty() ? core_count : (int) physical.size();
+        });
+
+        return layout;
+    }
+
+    int Topology::read_core_count(const fs::path& proc, const fs::path& sys) {
+        int core_count = 0;
+
+        //? sysconf() describes the local system, only trust it when reading the local /proc
+        if (proc == "/proc") {
+            core_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+            if (core_count < 1) core_count = sysconf(_SC_NPROCESSORS_CONF);
+        }
+
+        //? Offline cores leave gaps in the numbering, make room for the highest core listed
+        if (not sys.empty()) {
+            for (const int core : ut::str::parse_list(ut::file::read(sys / "devices/system/cpu/online")))
+                core_count = max(core_count, core + 1);
+        }
+
+        const string stat = ut::file::read(proc / "stat");
+        string_view view = stat;
+        ut::str::next_line(view);
+
+        while (view.starts_with("cpu")) {
+            string_view line = ut::str::next_line(view);
+            line.remove_prefix(3);
+
+            int core;
+            if (ut::str::next_number(line, core)) core_count = max(core_count, core + 1);
+        }
+
+        return max(core_count, 1);
+    }
+
+    string Topology::read_name(const fs::path& proc, const fs::path& sys) {
+        string name;
+        std::ifstream cpu_info(proc / "cpuinfo");
+
+        if (cpu_info.good()) {
+            for (string instr; getline(cpu_info, instr, ':') and not instr.starts_with("model name");)
+                cpu_info.ignore(ut::maxStreamSize, '\n');
+
+            if (cpu_info.bad()) return name;
+            else if (not cpu_info.eof()) {
+                cpu_info.ignore(1);
+                getline(cpu_info, name);
+            }
+            else if (not sys.empty() and fs::exists(sys / "devices")) {
+                for (const auto& d : fs::directory_iterator(sys / "devices")) {
+                    if (string(d.path().filename()).starts_with("arm")) {
+                        name = d.path().filename();
+                        break;
+                    }
+                }
+                if (not name.empty()) {
+                    auto name_vec = ut::str::split(name, '_');
+
+                    if (name_vec.size() < 2) return ut::str::capitalize(name);
+                    else
+                        return
+                                ut::str::capitalize(name_vec.at(1))+
+                                (name_vec.size() > 2 ? ' '+
+                                                       ut::str::capitalize(name_vec.at(2)) : "");
+                }
+
+            }
+
+            auto name_vec = ut::str::split(name);
+
+            if ((ut::str::contains(name, "Xeon"s) or
+                 ut::vec::contains(name_vec, "Duo"s)) and
+                ut::vec::contains(name_vec, "CPU"s)
+                    ) {
+                auto cpu_pos = ut::vec::index(name_vec, "CPU"s);
+
+                if (cpu_pos < name_vec.size() - 1 and not name_vec.at(cpu_pos + 1).ends_with(')'))
+                    name = name_vec.at(cpu_pos + 1);
+                else
+                    name.clear();
+            }
+            else if (ut::vec::contains(name_vec, "Ryzen"s)) {
+                auto ryz_pos = ut::vec::index(name_vec, "Ryzen"s);
+
+                name = "Ryzen"	+ (ryz_pos < name_vec.size() - 1 ? ' ' + name_vec.at(ryz_pos + 1) : "")
+                       + (ryz_pos < name_vec.size() - 2 ? ' ' + name_vec.at(ryz_pos + 2) : "");
+            }
+            else if (ut::str::contains(name, "Intel"s) and ut::vec::contains(name_vec, "CPU"s)) {
+                auto cpu_pos = ut::vec::index(name_vec, "CPU"s);
+
+                if (cpu_pos < name_vec.size() - 1 and not
+                        name_vec.at(cpu_pos + 1).ends_with(')') and
+                    name_vec.at(cpu_pos + 1) != "@")  name = name_vec.at(cpu_pos + 1);
+                else
+                    name.clear();
+            }
+            else
+                name.clear();
+
+            if (name.empty() and not name_vec.empty()) {
+                for (const auto& n : name_vec) {
+                    if (n == "@") break;
+                    name += n + ' ';
+                }
+
+                name.pop_back();
+
+                for (const auto& r : {"Processor", "CPU", "(R)", "(TM)", "Intel", "AMD", "Core"}) {
+                    name = ut::str::replace(name, r, "");
+                    name = ut::str::replace(name, "  ", " ");
+                }
+                name = ut::str::trim(name);
+            }
+        }
+
+        return name;
+    }
+
+    DataCollector::DataCollector() : DataCollector(fs::path{}) {}
+
+    DataCollector::DataCollector(const fs::path& cgroup) {
         shared::init();
 
-        if (not fs::exists(shared::freq_path) or access(shared::freq_path.c_str(), R_OK) == -1)
+        //? policy0 belongs to cpu0, fall back to the first other policy when it can't be read
+        if (not shared::sys_path.empty() and (not fs::exists(shared::freq_path) or access(shared::freq_path.c_str(), R_OK) == -1)) {
             shared::freq_path.clear();
 
+            std::error_code ec;
+            for (const auto& d : fs::directory_iterator(shared::sys_path / "devices/system/cpu/cpufreq", ec)) {
+                const fs::path path = d.path() / "scaling_cur_freq";
+
+                if (string(d.path().filename()).starts_with("policy") and access(path.c_str(), R_OK) == 0) {
+                    shared::freq_path = path;
+                    break;
+                }
+            }
+        }
+
         /** static values */
-        cpu_name = get_cpu_mame();
-        core_count = get_core_count();
+        topology = Topology::get();
+        cpu_name = std::make_shared<const string>(topology->get_name());
+        core_count = topology->get_core_count();
+        core_slots.assign(core_count, -1);
+
+        if (cgroup.empty()) {
+            core_ids.resize(core_count);
+            std::iota(core_ids.begin(), core_ids.end(), 0);
+        }
+        else {
+            group = std::make_unique<cgroup::Group>(cgroup);
+            core_ids = group->read_cpus(core_count);
+            cgroup_old = group->read_cpu_stat();
+            cgroup_old_time = std::chrono::steady_clock::now();
+        }
+
+        for (int i = 0; i < (int) core_ids.size(); i++) core_slots[core_ids[i]] = i;
+
+        core_count = (int) core_ids.size();
+
+        stat_reader = ut::file::CachedReader{shared::proc_path / "stat", 16384};
+        loadavg_reader = ut::file::CachedReader{shared::proc_path / "loadavg", 128};
+        freq_reader = ut::file::CachedReader{shared::freq_path};
+        cpuinfo_reader = ut::file::CachedReader{shared::proc_path / "cpuinfo", 4096};
 
         current_cpu.core_percent.insert(current_cpu.core_percent.begin(), core_count, {});
-        core_old_totals.insert(core_old_totals.begin(),  core_count, 0);
-        core_old_idles.insert(core_old_idles.begin(),  core_count, 0);
+        current_cpu.core_frequency.insert(current_cpu.core_frequency.begin(), core_count, {});
+        current_cpu.core_usage.resize(static_cast<size_t>(CpuField::count) * core_count);
+        index_numa_nodes();
+        core_times.resize(kernel::time_rows * core_count);
+        core_old_times.resize(kernel::time_rows * core_count);
+
+        get_freq_policies();
 
         got_sensors = get_sensors();
+    }
 
-        for (const auto& [sensor, ignored] : found_sensors) {
-            available_sensors.push_back(sensor);
-        }
+    void DataCollector::enable_history(size_t capacity) {
+        history = History{capacity, core_count};
     }
 
-    bool DataCollector::get_sensors() {
+    const History& DataCollector::get_history() const {
+        return history;
+    }
+
+    DataCollector::SensorScan DataCollector::scan_sensors(
+        const fs::path& sys,
+        const vector<fs::path>& known,
+        const vector<fs::path>& cpu_dirs
+    ) {
+        SensorScan scan;
         bool got_cpu = false, got_core_temp = false;
 
-        vector<fs::path> search_paths;
+        if (sys.empty()) return scan;
+
+        auto& search_paths = scan.dirs;
 
         try {
             //? Setup up paths to search for sensors
-            if (fs::exists(fs::path("/sys/class/hwmon")) and access("/sys/class/hwmon", R_OK) != -1) {
-                for (const auto& dir :fs::directory_iterator(fs::path("/sys/class/hwmon"))) {
+            const fs::path hwmon = sys / "class/hwmon";
+
+            if (fs::exists(hwmon) and access(hwmon.c_str(), R_OK) != -1) {
+                for (const auto& dir :fs::directory_iterator(hwmon)) {
                     fs::path add_path = fs::canonical(dir.path());
 
                     if (ut::vec::contains(search_paths, add_path)
@@ -246,8 +678,10 @@ namespace cpu {
                 }
             }
 
-            if (not got_core_temp and fs::exists(fs::path("/sys/devices/platform/coretemp.0/hwmon"))) {
-                for (auto& d :fs::directory_iterator(fs::path("/sys/devices/platform/coretemp.0/hwmon"))) {
+            const fs::path coretemp = sys / "devices/platform/coretemp.0/hwmon";
+
+            if (not got_core_temp and fs::exists(coretemp)) {
+                for (auto& d :fs::directory_iterator(coretemp)) {
                     fs::path add_path = fs::canonical(d.path());
 
                     for (const auto& file : fs::directory_iterator(add_path)) {
@@ -263,57 +697,59 @@ namespace cpu {
                 }
             }
 
-            //? Scan any found directories for temperature sensors
-            if (not search_paths.empty()) {
-                for (const auto& path : search_paths) {
-                    const string pname = ut::file::read(path / "name", path.filename());
-                    for (const auto & file : fs::directory_iterator(path)) {
+            //? A package sensor in a directory that is still present keeps the thermal zones out of the picture
+            for (const auto& path : cpu_dirs)
+                if (ut::vec::contains(search_paths, path)) got_cpu = true;
 
-                        const string file_suffix = "input";
-                        const int file_id = atoi(file.path().filename().c_str() + 4); // skip "temp" prefix
-                        string file_path = file.path();
+            //? Scan directories found for the first time for temperature sensors
+            for (const auto& path : search_paths) {
+                if (ut::vec::contains(known, path)) continue;
 
-                        if (!ut::str::contains(file_path, file_suffix)) {
-                            continue;
-                        }
+                const string pname = ut::file::read(path / "name", path.filename());
+                for (const auto & file : fs::directory_iterator(path)) {
 
-                        const string basepath =
-                                file_path.erase(file_path.find(file_suffix), file_suffix.length());
-                        const string label =
-                                ut::file::read(fs::path(basepath + "label"), "temp" + std::to_string(file_id));
-                        const string sensor_name =
-                                pname + "/" + label;
-                        const int64_t temp =
-                                stol(ut::file::read(fs::path(basepath + "input"), "0")) / 1000;
-                        const int64_t high =
-                                stol(ut::file::read(fs::path(basepath + "max"), "80000")) / 1000;
-                        const int64_t crit =
-                                stol(ut::file::read(fs::path(basepath + "crit"), "95000")) / 1000;
-
-                        found_sensors[sensor_name] = {fs::path(basepath + "input"), label, temp, high, crit};
-
-                        if (not got_cpu and (label.starts_with("Package id") or label.starts_with("Tdie"))) {
-                            got_cpu = true;
-                            cpu_sensor = sensor_name;
-                        }
-                        else if (label.starts_with("Core") or label.starts_with("Tccd")) {
-                            got_core_temp = true;
+                    const string file_suffix = "input";
+                    const int file_id = atoi(file.path().filename().c_str() + 4); // skip "temp" prefix
+                    string file_path = file.path();
 
-                            if (not ut::vec::contains(core_sensors, sensor_name))
-                                core_sensors.push_back(sensor_name);
-                        }
+                    if (!ut::str::contains(file_path, file_suffix)) {
+                        continue;
                     }
+
+                    const string basepath =
+                            file_path.erase(file_path.find(file_suffix), file_suffix.length());
+                    const string label =
+                            ut::file::read(fs::path(basepath + "label"), "temp" + std::to_string(file_id));
+                    const string sensor_name =
+                            pname + "/" + label;
+                    const int64_t temp =
+                            stol(ut::file::read(fs::path(basepath + "input"), "0")) / 1000;
+                    const int64_t high =
+                            stol(ut::file::read(fs::path(basepath + "max"), "80000")) / 1000;
+                    const int64_t crit =
+                            stol(ut::file::read(fs::path(basepath + "crit"), "95000")) / 1000;
+
+                    scan.added.emplace_back(sensor_name, Sensor{fs::path(basepath + "input"), label, temp, high, crit,
+                                                                ut::file::CachedReader{basepath + "input", 64}, path});
+
+                    if (label.starts_with("Package id") or label.starts_with("Tdie"))
+                        got_cpu = true;
                 }
             }
+
             //? If no good candidate for cpu temp has been found scan /sys/class/thermal
-            if (not got_cpu and fs::exists(fs::path("/sys/class/thermal"))) {
-                const string rootpath = fs::path("/sys/class/thermal/thermal_zone");
+            if (not got_cpu and fs::exists(sys / "class/thermal")) {
+                const string rootpath = sys / "class/thermal/thermal_zone";
 
                 for (int i = 0; fs::exists(fs::path(rootpath + std::to_string(i))); i++) {
                     const fs::path basepath = rootpath + std::to_string(i);
 
                     if (not fs::exists(basepath / "temp")) continue;
 
+                    search_paths.push_back(basepath);
+
+                    if (ut::vec::contains(known, basepath)) continue;
+
                     const string label =ut::file::read(basepath / "type", "temp" + std::to_string(i));
                     const string sensor_name = "thermal" + std::to_string(i) + "/" + label;
                     const int64_t temp = stol(ut::file::read(basepath / "temp", "0")) / 1000;
@@ -334,13 +770,67 @@ namespace cpu {
                     if (high < 1) high = 80;
                     if (crit < 1) crit = 95;
 
-                    found_sensors[sensor_name] = {basepath / "temp", label, temp, high, crit};
+                    scan.added.emplace_back(sensor_name, Sensor{basepath / "temp", label, temp, high, crit,
+                                                                ut::file::CachedReader{basepath / "temp", 64}, basepath});
                 }
             }
 
         }
         catch (...) {}
 
+        return scan;
+    }
+
+    bool DataCollector::get_sensors() {
+        merge_sensors(scan_sensors(shared::sys_path, {}, {}));
+
+        //? Hotplugged hwmon devices trigger a rescan from collect(), without netlink only rescan_sensors() does
+        uevents.open();
+
+        return got_sensors;
+    }
+
+    void DataCollector::rescan_sensors() {
+        if (rescan.valid()) return;
+
+        vector<fs::path> cpu_dirs;
+        for (const auto& [name, sensor] : found_sensors) {
+            if (sensor.label.starts_with("Package id") or sensor.label.starts_with("Tdie"))
+                cpu_dirs.push_back(sensor.dir);
+        }
+
+        rescan = std::async(std::launch::async, scan_sensors, shared::sys_path, sensor_dirs, std::move(cpu_dirs));
+    }
+
+    void DataCollector::merge_sensors(SensorScan scan) {
+        //? Drop sensors of directories that disappeared, the ones still present keep their open fds
+        std::erase_if(found_sensors, [&](const auto& entry) {
+            return not ut::vec::contains(scan.dirs, entry.second.dir);
+        });
+
+        std::erase_if(core_sensors, [this](const string& name) { return not found_sensors.contains(name); });
+
+        if (not found_sensors.contains(cpu_sensor)) cpu_sensor.clear();
+
+        for (auto& [name, sensor] : scan.added) {
+            string sensor_name = name;
+
+            //? Sensors of identical devices, e.g. one coretemp per socket, share names
+            if (const auto it = found_sensors.find(sensor_name); it != found_sensors.end() and it->second.dir != sensor.dir)
+                sensor_name += " (" + string(sensor.dir.filename()) + ")";
+
+            if (cpu_sensor.empty() and (sensor.label.starts_with("Package id") or sensor.label.starts_with("Tdie")))
+                cpu_sensor = sensor_name;
+            else if (sensor.label.starts_with("Core") or sensor.label.starts_with("Tccd")) {
+                if (not ut::vec::contains(core_sensors, sensor_name))
+                    core_sensors.push_back(sensor_name);
+            }
+
+            found_sensors.insert_or_assign(sensor_name, std::move(sensor));
+        }
+
+        sensor_dirs = std::move(scan.dirs);
+
         if (cpu_sensor.empty() and not found_sensors.empty()) {
             for (const auto& [name, sensor] : found_sensors) {
                 if (ut::str::contains(ut::str::to_lower(name), "cpu") or
@@ -355,32 +845,93 @@ namespace cpu {
             }
         }
 
-        return not found_sensors.empty();
+        available_sensors = {"Auto"};
+
+        for (const auto& [sensor, ignored] : found_sensors) {
+            available_sensors.push_back(sensor);
+        }
+
+        got_sensors = not found_sensors.empty();
+
+        map_core_sensors();
+    }
+
+    void DataCollector::map_core_sensors() {
+        core_sensor_map.assign(core_count, -1);
+        current_cpu.core_temp.clear();
+
+        if (core_sensors.empty()) return;
+
+        current_cpu.core_temp.assign(core_count, 0);
+
+        //? Intel labels are "Core <core id>", with one hwmon per socket identified by its "Package id <socket>"
+        std::map<std::pair<int, int>, int> by_id;
+
+        for (int i = 0; i < (int) core_sensors.size(); i++) {
+            const auto& sensor = found_sensors.at(core_sensors[i]);
+
+            string_view label = sensor.label;
+            if (not label.starts_with("Core ")) continue;
+
+            label.remove_prefix(5);
+
+            int socket = 0, core;
+            if (not ut::str::next_number(label, core)) continue;
+
+            for (const auto& [name, other] : found_sensors) {
+                string_view package = other.label;
+
+                if (other.dir == sensor.dir and package.starts_with("Package id ")) {
+                    package.remove_prefix(11);
+                    ut::str::next_number(package, socket);
+                    break;
+                }
+            }
+
+            by_id.emplace(std::pair{socket, core}, i);
+        }
+
+        const vector<CoreTopology> none;
+        const auto& cores = by_id.empty() ? none : topology->get_cores();
+
+        for (int i = 0; i < core_count; i++) {
+            const int id = core_ids[i];
+
+            if (id < (int) cores.size()) {
+                const auto it = by_id.find({max(cores[id].socket, 0), cores[id].core});
+
+                if (it != by_id.end()) {
+                    core_sensor_map[i] = it->second;
+                    continue;
+                }
+            }
+
+            //? No matching id (e.g. AMD Tccd sensors per chiplet), spread the cores evenly over the sensors
+            core_sensor_map[i] = (int) ((long long) id * (long long) core_sensors.size() / (long long) core_slots.size());
+        }
     }
 
     void DataCollector::update_sensors() {
         if (cpu_sensor.empty()) return;
 
-        const auto& cpu_s = cpu_sensor;
+        auto& sensor = found_sensors.at(cpu_sensor);
 
-        found_sensors.at(cpu_s).temp = stol(ut::file::read(found_sensors.at(cpu_s).path, "0")) / 1000;
-        current_cpu.critical_temperature = found_sensors.at(cpu_s).crit;
-    }
+        sensor.temp = sensor.reader.read_number<int64_t>(0) / 1000;
+        current_cpu.critical_temperature = sensor.crit;
 
-    int DataCollector::get_core_count() {
-        int core_count = sysconf(_SC_NPROCESSORS_ONLN);
+        //? Every core sensor is read once, cores sharing a sensor get the same value
+        for (const auto& name : core_sensors) {
+            auto& core_sensor = found_sensors.at(name);
 
-        if (core_count < 1) {
-            core_count = sysconf(_SC_NPROCESSORS_CONF);
-            if (core_count < 1) {
-                core_count = 1;
-            }
+            core_sensor.temp = core_sensor.reader.read_number<int64_t>(0) / 1000;
         }
 
-        return core_count;
+        for (int i = 0; i < (int) core_sensor_map.size() and not current_cpu.core_temp.empty(); i++) {
+            current_cpu.core_temp[i] = found_sensors.at(core_sensors[core_sensor_map[i]]).temp;
+        }
     }
 
-    CpuFrequency DataCollector::get_cpu_frequency() {
+    CpuFrequency DataCollector::get_cpu_frequency(std::chrono::steady_clock::time_point now) {
         static int failed{}; // defaults to 0
         double value{};
         string units{};
@@ -393,33 +944,18 @@ namespace cpu {
 
             // Try to get freq from /sys/devices/system/cpu/cpufreq/policy first (faster)
             if (not shared::freq_path.empty()) {
-                hz = stod(ut::file::read(shared::freq_path, "0.0")) / 1000;
+                hz = freq_reader.read_number<double>(0.0) / 1000;
 
                 if (hz <= 0.0 and ++failed >= 2)
                     shared::freq_path.clear();
             }
 
             // If freq from /sys failed or is missing try to use /proc/cpuinfo
-            if (hz <= 0.0) {
-                std::ifstream cpufreq(shared::proc_path / "cpuinfo");
-
-                if (cpufreq.good()) {
-                    while (cpufreq.ignore(ut::maxStreamSize, '\n')) {
-                        if (cpufreq.peek() == 'c') {
-                            cpufreq.ignore(ut::maxStreamSize, ' ');
-                            if (cpufreq.peek() == 'M') {
-                                cpufreq.ignore(ut::maxStreamSize, ':');
-                                cpufreq.ignore(1);
-                                cpufreq >> hz;
-                                break;
-                            }
-                        }
-                    }
-                }
-            }
+            if (hz <= 0.0) hz = read_cpuinfo_frequency(now);
 
             if (hz <= 1 or hz >= 1000000)
-                throw std::runtime_error("Failed to read /sys/devices/system/cpu/cpufreq/policy and /proc/cpuinfo.");
+                throw std::runtime_error("Failed to read " + string{shared::sys_path} + "/devices/system/cpu/cpufreq/policy and "
+                                         + string{shared::proc_path} + "/cpuinfo.");
 
             if (hz >= 1000) {
                 if (hz >= 10000) value = round(hz / 1000);
@@ -440,209 +976,340 @@ namespace cpu {
         return CpuFrequency{value, units};
     }
 
-    string DataCollector::get_cpu_mame() {
-        string name;
-        std::ifstream cpu_info(shared::proc_path / "cpuinfo");
+    void DataCollector::get_freq_policies() {
+        std::error_code ec;
 
-        if (cpu_info.good()) {
-            for (string instr; getline(cpu_info, instr, ':') and not instr.starts_with("model name");)
-                cpu_info.ignore(ut::maxStreamSize, '\n');
+        if (shared::sys_path.empty()) return;
 
-            if (cpu_info.bad()) return name;
-            else if (not cpu_info.eof()) {
-                cpu_info.ignore(1);
-                getline(cpu_info, name);
-            }
-            else if (fs::exists("/sys/devices")) {
-                for (const auto& d : fs::directory_iterator("/sys/devices")) {
-                    if (string(d.path().filename()).starts_with("arm")) {
-                        name = d.path().filename();
-                        break;
-                    }
-                }
-                if (not name.empty()) {
-                    auto name_vec = ut::str::split(name, '_');
+        for (const auto& d : fs::directory_iterator(shared::sys_path / "devices/system/cpu/cpufreq", ec)) {
+            if (not string(d.path().filename()).starts_with("policy")) continue;
 
-                    if (name_vec.size() < 2) return ut::str::capitalize(name);
-                    else
-                        return
-                                ut::str::capitalize(name_vec.at(1))+
-                                (name_vec.size() > 2 ? ' '+
-                                                       ut::str::capitalize(name_vec.at(2)) : "");
-                }
+            FreqPolicy policy{ut::file::CachedReader{d.path() / "scaling_cur_freq", 64},
+                              ut::str::parse_list(ut::file::read(d.path() / "affected_cpus"))};
 
-            }
+            //? Cores outside the cpuset are dropped, the others are stored by their index in core_ids
+            std::erase_if(policy.cores, [this](const int& core) { return core >= (int) core_slots.size() or core_slots[core] < 0; });
 
-            auto name_vec = ut::str::split(name);
+            for (int& core : policy.cores) core = core_slots[core];
 
-            if ((ut::str::contains(name, "Xeon"s) or
-                 ut::vec::contains(name_vec, "Duo"s)) and
-                ut::vec::contains(name_vec, "CPU"s)
-                    ) {
-                auto cpu_pos = ut::vec::index(name_vec, "CPU"s);
+            if (policy.cores.empty() or not policy.reader.open()) continue;
 
-                if (cpu_pos < name_vec.size() - 1 and not name_vec.at(cpu_pos + 1).ends_with(')'))
-                    name = name_vec.at(cpu_pos + 1);
-                else
-                    name.clear();
-            }
-            else if (ut::vec::contains(name_vec, "Ryzen"s)) {
-                auto ryz_pos = ut::vec::index(name_vec, "Ryzen"s);
+            freq_policies.push_back(std::move(policy));
+        }
 
-                name = "Ryzen"	+ (ryz_pos < name_vec.size() - 1 ? ' ' + name_vec.at(ryz_pos + 1) : "")
-                       + (ryz_pos < name_vec.size() - 2 ? ' ' + name_vec.at(ryz_pos + 2) : "");
-            }
-            else if (ut::str::contains(name, "Intel"s) and ut::vec::contains(name_vec, "CPU"s)) {
-                auto cpu_pos = ut::vec::index(name_vec, "CPU"s);
+        rng::sort(freq_policies, {}, [](const FreqPolicy& policy) { return policy.cores.front(); });
+    }
 
-                if (cpu_pos < name_vec.size() - 1 and not
-                        name_vec.at(cpu_pos + 1).ends_with(')') and
-                    name_vec.at(cpu_pos + 1) != "@")  name = name_vec.at(cpu_pos + 1);
-                else
-                    name.clear();
-            }
-            else
-                name.clear();
+    void DataCollector::update_core_frequency() {
+        //? One read per policy covers every core in its affected_cpus
+        for (auto& policy : freq_policies) {
+            const long long khz = max(0ll, policy.reader.read_number<long long>(0));
 
-            if (name.empty() and not name_vec.empty()) {
-                for (const auto& n : name_vec) {
-                    if (n == "@") break;
-                    name += n + ' ';
-                }
+            for (const int& core : policy.cores) current_cpu.core_frequency[core] = khz;
+        }
+    }
 
-                name.pop_back();
+    double DataCollector::read_cpuinfo_frequency(std::chrono::steady_clock::time_point now) {
+        //? Reading "cpu MHz" makes the kernel sample every core, so the value is refreshed at most once per second,
+        //? and only the head of the file is read since the first core's entry is all that's used.
+        //? A missing "cpu MHz" line, as on most ARM hosts, is remembered the same way
+        if (cpuinfo_time != std::chrono::steady_clock::time_point{} and now - cpuinfo_time < 1s) return cpuinfo_hz;
 
-                for (const auto& r : {"Processor", "CPU", "(R)", "(TM)", "Intel", "AMD", "Core"}) {
-                    name = ut::str::replace(name, r, "");
-                    name = ut::str::replace(name, "  ", " ");
-                }
-                name = ut::str::trim(name);
+        cpuinfo_time = now;
+        cpuinfo_hz = 0.0;
+
+        string_view cpuinfo = cpuinfo_reader.read_head();
+
+        while (not cpuinfo.empty()) {
+            string_view line = ut::str::next_line(cpuinfo);
+
+            if (not line.starts_with("cpu MHz")) continue;
+
+            if (const size_t colon = line.find(':'); colon != string_view::npos) {
+                line.remove_prefix(colon + 1);
+                ut::str::next_number(line, cpuinfo_hz);
             }
+
+            break;
         }
 
-        return name;
+        return cpuinfo_hz;
     }
 
-    Data DataCollector::collect() {
+    size_t DataCollector::parse_stat_line(string_view line, array<long long, cpu_time_fields>& times, long long& totals, long long& idles) {
+        size_t fields = 0;
+        long long total_sum = 0;
+        long long guest_sum = 0;
+
+        for (uint64_t val; ut::str::next_number(line, val); fields++) {
+            total_sum += val;
+
+            //? Fields 8-9 and any future unknown fields are not part of the totals
+            if (fields >= 8) guest_sum += val;
+            if (fields < times.size()) times[fields] = val;
+        }
+
+        if (fields < 4) throw std::runtime_error("Malformatted /proc/stat");
+
+        totals = max(0ll, total_sum - guest_sum);
+
+        //? Add iowait field if present
+        idles = max(0ll, times[3] + (fields > 4 ? times[4] : 0));
+
+        return std::min(fields, times.size());
+    }
+
+    const Topology& DataCollector::get_topology() const {
+        return *topology;
+    }
+
+    const vector<int>& DataCollector::get_core_ids() const {
+        return core_ids;
+    }
+
+    const cgroup::Group* DataCollector::get_cgroup() const {
+        return group.get();
+    }
+
+    void DataCollector::update_cgroup_usage(std::chrono::steady_clock::time_point now) {
+        const cgroup::CpuStat& stat = group->read_cpu_stat();
+        const double limit = group->read_cpu_limit();
+
+        //? Usage is relative to what the group may use, the quota when it is below the cpuset
+        const double capacity = limit > 0 ? std::min(limit, (double) core_count) : (double) core_count;
+        const double elapsed = max(std::chrono::duration<double, std::micro>(now - cgroup_old_time).count(), 1.0) * capacity;
+
+        auto percent = [&](uint64_t value, uint64_t old) {
+            return clamp((long long) round((double) (value >= old ? value - old : 0) * 100 / elapsed), 0ll, 100ll);
+        };
+
         auto& cpu = current_cpu;
 
-        std::ifstream stream;
+        cpu.cpu_percent.fill(0);
+        cpu.cpu_percent[CpuField::total] = percent(stat.usage_usec, cgroup_old.usage_usec);
+        cpu.cpu_percent[CpuField::user] = percent(stat.user_usec, cgroup_old.user_usec);
+        cpu.cpu_percent[CpuField::system] = percent(stat.system_usec, cgroup_old.system_usec);
+        cpu.cpu_percent[CpuField::idle] = 100 - cpu.cpu_percent[CpuField::total];
+
+        cgroup_old = stat;
+        cgroup_old_time = now;
+    }
+
+    const vector<string>& DataCollector::get_available_sensors() const {
+        return available_sensors;
+    }
+
+    const ut::stats::CollectStats& DataCollector::get_collect_stats() const {
+        return collect_stats;
+    }
+
+    Data DataCollector::collect() {
+        return collect(std::chrono::steady_clock::now());
+    }
+
+    Data DataCollector::collect(std::chrono::steady_clock::time_point now) {
+        Data data;
+        collect_into(data, now);
+
+        return data;
+    }
+
+    void DataCollector::collect_into(Data& out) {
+        collect_into(out, std::chrono::steady_clock::now());
+    }
+
+    void DataCollector::collect_into(Data& out, std::chrono::steady_clock::time_point now) {
+        using ut::stats::CollectStage;
+
+        auto& cpu = current_cpu;
+        ut::stats::Scope scope(collect_stats);
 
         try {
             //? Get cpu load averages from /proc/loadavg
-            stream.open(shared::proc_path / "loadavg");
+            scope.next(CollectStage::loadavg);
+            string_view loadavg = loadavg_reader.read();
 
-            if (stream.good()) {
-                stream >> cpu.load_avg[0] >> cpu.load_avg[1] >> cpu.load_avg[2];
+            for (auto& load : cpu.load_avg) {
+                if (not ut::str::next_number(loadavg, load)) break;
             }
-            stream.close();
 
             //? Get cpu total times for all cores from /proc/stat
-            string cpu_name;
-            stream.open(shared::proc_path / "stat");
-
-            int i = 0;
-            int target = core_count;
-
-            for (; i <= target or (stream.good() and stream.peek() == 'c'); i++) {
-                //? Make sure to add zero value for missing core values if at end of file
-                if ((not stream.good() or stream.peek() != 'c') and i <= target) {
-                    if (i == 0) throw std::runtime_error("Failed to parse /proc/stat");
-                    else {
-                        cpu.core_percent.at(i-1) = 0;
-                    }
+            scope.next(CollectStage::stat);
+            string_view stat = stat_reader.read();
+
+            if (stat.empty()) throw std::runtime_error("Failed to read /proc/stat");
+
+            string_view line = ut::str::next_line(stat);
+
+            if (not line.starts_with("cpu ")) throw std::runtime_error("Failed to parse /proc/stat");
+
+            //? Expected on kernel 2.6.3> : 0=user, 1=nice, 2=system, 3=idle, 4=iowait, 5=irq, 6=softirq, 7=steal, 8=guest, 9=guest_nice
+            array<long long, cpu_time_fields> times{};
+            long long totals, idles;
+
+            //? The totals of a cgroup come from its cpu.stat, the first line of stat covers the whole host
+            if (group) {
+                update_cgroup_usage(now);
+            }
+            else {
+                //? Calculate values for totals from first line of stat
+                const size_t fields = parse_stat_line(line.substr(3), times, totals, idles);
+                const long long calc_totals = max(1ll, totals - cpu_old.totals);
+                const long long calc_idles = max(1ll, idles - cpu_old.idles);
+                cpu_old.totals = totals;
+                cpu_old.idles = idles;
+
+                //? Total usage of cpu
+                cpu.cpu_percent[CpuField::total] = clamp((long long)round((double)(calc_totals - calc_idles) * 100 / calc_totals), 0ll, 100ll);
+
+                //? Populate cpu.cpu_percent with all fields from stat
+                for (size_t ii = 0; ii < fields; ii++) {
+                    const long long val = times[ii];
+                    cpu.cpu_percent[CpuField(ii)] = clamp((long long)round((double)(val - cpu_old_times[ii]) * 100 / calc_totals), 0ll, 100ll);
+                    cpu_old_times[ii] = val;
                 }
-                else {
-                    if (i == 0) stream.ignore(ut::maxStreamSize, ' ');
-                    else {
-                        stream >> cpu_name;
-                        int cpuNum = std::stoi(cpu_name.substr(3));
-                        if (cpuNum >= target - 1) target = cpuNum + (stream.peek() == 'c' ? 2 : 1);
-
-                        //? Add zero value for core if core number is missing from /proc/stat
-                        while (i - 1 < cpuNum) {
-                            cpu.core_percent.at(i-1) = 0;
-                            i++;
-                        }
-                    }
+            }
 
-                    //? Expected on kernel 2.6.3> : 0=user, 1=nice, 2=system, 3=idle, 4=iowait, 5=irq, 6=softirq, 7=steal, 8=guest, 9=guest_nice
-                    vector<long long> times;
-                    long long total_sum = 0;
+            //? Parse the times of each core into their rows, the usage of all cores is computed afterwards in one pass
+            const auto cores = static_cast<size_t>(core_count);
+            int next_core = 0;
 
-                    for (uint64_t val; stream >> val; total_sum += val) {
-                        times.push_back(val);
-                    }
-                    stream.clear();
-                    if (times.size() < 4) throw std::runtime_error("Malformatted /proc/stat");
+            //? A core missing from /proc/stat keeps its previous times, which makes its usage 0
+            auto keep_old_times = [&](int core) {
+                for (size_t row = 0; row < kernel::time_rows; row++)
+                    core_times[row * cores + core] = core_old_times[row * cores + core];
+            };
 
-                    //? Subtract fields 8-9 and any future unknown fields
-                    const long long totals = max(0ll, total_sum - (times.size() > 8 ? std::accumulate(times.begin() + 8, times.end(), 0) : 0));
+            for (line = ut::str::next_line(stat); line.starts_with("cpu"); line = ut::str::next_line(stat)) {
+                line.remove_prefix(3);
 
-                    //? Add iowait field if present
-                    const long long idles = max(0ll, times.at(3) + (times.size() > 4 ? times.at(4) : 0));
+                int cpu_num;
 
-                    //? Calculate values for totals from first line of stat
-                    if (i == 0) {
-                        const long long calc_totals = max(1ll, totals - CpuOld.at("totals"));
-                        const long long calc_idles = max(1ll, idles - CpuOld.at("idles"));
-                        CpuOld.at("totals") = totals;
-                        CpuOld.at("idles") = idles;
+                if (not ut::str::next_number(line, cpu_num)) throw std::runtime_error("Malformatted /proc/stat");
 
-                        //? Total usage of cpu
-                        cpu.cpu_percent.at("total") = clamp((long long)round((double)(calc_totals - calc_idles) * 100 / calc_totals), 0ll, 100ll);
+                if (cpu_num < 0 or cpu_num >= (int) core_slots.size())
+                    throw std::runtime_error("Core cpu" + std::to_string(cpu_num) + " from /proc/stat is out of range");
 
-                        //? Populate cpu.cpu_percent with all fields from stat
-                        for (int ii = 0; const auto& val : times) {
-                            cpu.cpu_percent.at(time_names.at(ii)) = clamp((long long)round((double)(val - CpuOld.at(time_names.at(ii))) * 100 / calc_totals), 0ll, 100ll);
-                            CpuOld.at(time_names.at(ii)) = val;
+                //? Cores outside the cgroup's cpuset are skipped before their fields are parsed
+                const int slot = core_slots[cpu_num];
 
-                            if (++ii == 10) break;
-                        }
-                        continue;
-                    }
-                        //? Calculate cpu total for each core
-                    else {
-                        const long long calc_totals = max(0ll, totals - core_old_totals.at(i-1));
-                        const long long calc_idles = max(0ll, idles - core_old_idles.at(i-1));
-                        core_old_totals.at(i-1) = totals;
-                        core_old_idles.at(i-1) = idles;
-
-                        cpu.core_percent.at(i-1) = clamp((long long)round((double)(calc_totals - calc_idles) * 100 / calc_totals), 0ll, 100ll);
-                    }
-                }
+                if (slot < 0) continue;
+
+                for (; next_core < slot; next_core++) keep_old_times(next_core);
+
+                const int core = max(next_core++, slot);
+
+                if (core >= core_count) throw std::runtime_error("Core cpu" + std::to_string(cpu_num) + " from /proc/stat is out of range");
+
+                const size_t core_fields = parse_stat_line(line, times, totals, idles);
+
+                for (size_t field = 0; field < cpu_time_fields; field++)
+                    core_times[field * cores + core] = field < core_fields ? (double) times[field] : 0.0;
+
+                core_times[kernel::totals_row * cores + core] = (double) totals;
+                core_times[kernel::idles_row * cores + core] = (double) idles;
+
+                //? The rest of a cgroup's host cores have nothing left to be parsed for
+                if (group and next_core == core_count) break;
             }
 
+            for (; next_core < core_count; next_core++) keep_old_times(next_core);
+
+            kernel::compute_usage(core_times.data(), core_old_times.data(), cores, cpu.core_usage.data());
+            std::swap(core_times, core_old_times);
+
+            const auto core_total = cpu.core_usage.begin() + (long) (static_cast<size_t>(CpuField::total) * cores);
+            std::copy(core_total, core_total + core_count, cpu.core_percent.begin());
+
+            update_node_usage();
         }
         catch (const std::exception& e) {
-            if (stream.bad()) throw std::runtime_error("Failed to read /proc/stat");
-            else throw std::runtime_error("collect() : " + string{e.what()});
+            throw std::runtime_error("collect() : " + string{e.what()});
         }
 
+        //? Swap in the result of a finished background rescan, start one when hwmon devices came or went
+        scope.next(CollectStage::sensors);
+
+        if (rescan.valid() and rescan.wait_for(0s) == std::future_status::ready)
+            merge_sensors(rescan.get());
+
+        if (uevents.poll({"hwmon", "thermal"}))
+            rescan_sensors();
+
         if (got_sensors)
             update_sensors();
 
-        return Data {
-            CpuUsage{
-            cpu.cpu_percent.at("total"),
-            cpu.cpu_percent.at("user"),
-            cpu.cpu_percent.at("nice"),
-            cpu.cpu_percent.at("system"),
-            cpu.cpu_percent.at("idle"),
-            cpu.cpu_percent.at("iowait"),
-            cpu.cpu_percent.at("irq"),
-            cpu.cpu_percent.at("softirq"),
-            cpu.cpu_percent.at("steal"),
-            cpu.cpu_percent.at("guest"),
-            cpu.cpu_percent.at("guest_nice")
-            },
-            found_sensors.at( cpu_sensor).temp,
-            CpuAvgLoad{cpu.load_avg[0], cpu.load_avg[1], cpu.load_avg[2]},
-            cpu.core_percent,
-            get_cpu_frequency(),
-            cpu_name,
-            core_count,
-            cpu.critical_temperature
-        };
+        scope.next(CollectStage::freq);
+        update_core_frequency();
+        out.cpu_frequency = get_cpu_frequency(now);
+        scope.stop();
+
+        history.push(cpu.cpu_percent, cpu.core_percent);
+
+        //? Copy assignment keeps the capacity of <out>'s vectors, only the first fill or a grown core count allocates
+        out.cpu_usage = CpuUsage{cpu.cpu_percent};
+        out.cpu_temp = got_sensors ? found_sensors.at(cpu_sensor).temp : 0;
+        out.cpu_load_avg = CpuAvgLoad{cpu.load_avg[0], cpu.load_avg[1], cpu.load_avg[2]};
+        out.core_load = cpu.core_percent;
+        out.cpu_name = cpu_name;
+        out.core_count = core_count;
+        out.critical_temperature = cpu.critical_temperature;
+        out.core_frequency = cpu.core_frequency;
+        out.core_temp = cpu.core_temp;
+        out.core_usage = cpu.core_usage;
+        out.numa_nodes = numa_nodes;
+        out.node_usage = cpu.node_usage;
+    }
+
+    void DataCollector::index_numa_nodes() {
+        //? The sysfs scan runs once per process through the shared Topology, only the mapping to collected cores is built here
+        const auto& cores = topology->get_cores();
+        const auto& nodes = topology->get_numa_nodes();
+
+        numa_nodes.clear();
+        node_core_counts.clear();
+        core_nodes.assign(core_count, -1);
+
+        for (const int node : nodes) {
+            int count = 0;
+
+            for (int i = 0; i < core_count; i++) {
+                if (cores[core_ids[i]].numa_node != node) continue;
+
+                core_nodes[i] = (int) numa_nodes.size();
+                count++;
+            }
+
+            //? Memory only nodes and the nodes outside a cgroup's cpuset have nothing to report
+            if (count == 0) continue;
+
+            numa_nodes.push_back(node);
+            node_core_counts.push_back(count);
+        }
+
+        current_cpu.node_usage.assign(static_cast<size_t>(CpuField::count) * numa_nodes.size(), 0);
+    }
+
+    void DataCollector::update_node_usage() {
+        const size_t nodes = numa_nodes.size();
+
+        if (nodes == 0) return;
+
+        auto& usage = current_cpu.node_usage;
+        const auto cores = static_cast<size_t>(core_count);
+
+        rng::fill(usage, 0);
+
+        //? One pass over every row of core_usage, each core adds to the node the index maps it to
+        for (size_t field = 0; field < static_cast<size_t>(CpuField::count); field++) {
+            const long long* core_row = current_cpu.core_usage.data() + field * cores;
+            long long* node_row = usage.data() + field * nodes;
+
+            for (size_t core = 0; core < cores; core++)
+                if (core_nodes[core] >= 0) node_row[core_nodes[core]] += core_row[core];
+
+            for (size_t node = 0; node < nodes; node++)
+                node_row[node] = (node_row[node] + node_core_counts[node] / 2) / node_core_counts[node];
+        }
     }
 }
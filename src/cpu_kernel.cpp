@@ -0,0 +1,165 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <stdexcept>
+#include "../include/cpu_kernel.hpp"
+
+#if defined(__x86_64__) or defined(__i386__)
+#include <immintrin.h>
+#define HWINFO_KERNEL_AVX2
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HWINFO_KERNEL_NEON
+#endif
+
+namespace cpu::kernel {
+    namespace {
+        constexpr size_t total = static_cast<size_t>(CpuField::total);
+
+        //? Every variant computes round half up as floor(x + 0.5) in doubles, so they agree to the last digit
+        long long to_percent(double busy, double divisor) {
+            return static_cast<long long>(std::clamp(std::floor(busy * 100 / divisor + 0.5), 0.0, 100.0));
+        }
+
+        //* Cores [<begin>, <cores>) one at a time, the whole block for scalar and the tail for the others
+        void compute_scalar(const double* current, const double* old, size_t cores, long long* usage, size_t begin) {
+            for (size_t core = begin; core < cores; core++) {
+                auto delta = [&](size_t row) {
+                    return std::max(current[row * cores + core] - old[row * cores + core], 0.0);
+                };
+
+                const double totals = delta(totals_row);
+                const double divisor = std::max(totals, 1.0);
+
+                usage[total * cores + core] = to_percent(totals - delta(idles_row), divisor);
+
+                for (size_t field = 0; field < cpu_time_fields; field++)
+                    usage[field * cores + core] = to_percent(delta(field), divisor);
+            }
+        }
+
+#ifdef HWINFO_KERNEL_AVX2
+        //? Lambdas don't inherit the target attribute, the helpers are functions of their own
+        __attribute__((target("avx2"))) inline __m256d delta_avx2(const double* current, const double* old) {
+            return _mm256_max_pd(_mm256_sub_pd(_mm256_loadu_pd(current), _mm256_loadu_pd(old)), _mm256_setzero_pd());
+        }
+
+        __attribute__((target("avx2"))) inline void store_avx2(long long* out, __m256d busy, __m256d divisor) {
+            __m256d percent = _mm256_floor_pd(_mm256_add_pd(
+                    _mm256_div_pd(_mm256_mul_pd(busy, _mm256_set1_pd(100)), divisor), _mm256_set1_pd(0.5)));
+
+            percent = _mm256_min_pd(_mm256_max_pd(percent, _mm256_setzero_pd()), _mm256_set1_pd(100));
+
+            //? There is no double to int64 conversion before AVX-512, the clamped values fit in 32 bits
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(percent)));
+        }
+
+        __attribute__((target("avx2"))) void compute_avx2(const double* current, const double* old, size_t cores, long long* usage) {
+            size_t core = 0;
+
+            for (; core + 4 <= cores; core += 4) {
+                const __m256d totals = delta_avx2(current + totals_row * cores + core, old + totals_row * cores + core);
+                const __m256d idles = delta_avx2(current + idles_row * cores + core, old + idles_row * cores + core);
+                const __m256d divisor = _mm256_max_pd(totals, _mm256_set1_pd(1));
+
+                store_avx2(usage + total * cores + core, _mm256_sub_pd(totals, idles), divisor);
+
+                for (size_t field = 0; field < cpu_time_fields; field++) {
+                    const size_t offset = field * cores + core;
+
+                    store_avx2(usage + offset, delta_avx2(current + offset, old + offset), divisor);
+                }
+            }
+
+            compute_scalar(current, old, cores, usage, core);
+        }
+#endif
+
+#ifdef HWINFO_KERNEL_NEON
+        inline float64x2_t delta_neon(const double* current, const double* old) {
+            return vmaxq_f64(vsubq_f64(vld1q_f64(current), vld1q_f64(old)), vdupq_n_f64(0));
+        }
+
+        inline void store_neon(long long* out, float64x2_t busy, float64x2_t divisor) {
+            float64x2_t percent = vrndmq_f64(vaddq_f64(vdivq_f64(vmulq_n_f64(busy, 100), divisor), vdupq_n_f64(0.5)));
+
+            percent = vminq_f64(vmaxq_f64(percent, vdupq_n_f64(0)), vdupq_n_f64(100));
+
+            vst1q_s64(reinterpret_cast<int64_t*>(out), vcvtq_s64_f64(percent));
+        }
+
+        void compute_neon(const double* current, const double* old, size_t cores, long long* usage) {
+            size_t core = 0;
+
+            for (; core + 2 <= cores; core += 2) {
+                const float64x2_t totals = delta_neon(current + totals_row * cores + core, old + totals_row * cores + core);
+                const float64x2_t idles = delta_neon(current + idles_row * cores + core, old + idles_row * cores + core);
+                const float64x2_t divisor = vmaxq_f64(totals, vdupq_n_f64(1));
+
+                store_neon(usage + total * cores + core, vsubq_f64(totals, idles), divisor);
+
+                for (size_t field = 0; field < cpu_time_fields; field++) {
+                    const size_t offset = field * cores + core;
+
+                    store_neon(usage + offset, delta_neon(current + offset, old + offset), divisor);
+                }
+            }
+
+            compute_scalar(current, old, cores, usage, core);
+        }
+#endif
+
+        Isa detect_isa() {
+#if defined(HWINFO_KERNEL_AVX2)
+            if (__builtin_cpu_supports("avx2")) return Isa::avx2;
+#elif defined(HWINFO_KERNEL_NEON)
+            //? Advanced SIMD is part of every aarch64 cpu
+            return Isa::neon;
+#endif
+            return Isa::scalar;
+        }
+    }
+
+    Isa get_supported_isa() {
+        static const Isa isa = detect_isa();
+
+        return isa;
+    }
+
+    string_view get_isa_name(Isa isa) {
+        switch (isa) {
+            case Isa::avx2: return "avx2";
+            case Isa::neon: return "neon";
+            default: return "scalar";
+        }
+    }
+
+    void compute_usage(const double* current, const double* old, size_t cores, long long* usage, Isa isa) {
+        if (isa != Isa::scalar and isa != get_supported_isa())
+            throw std::invalid_argument("compute_usage() : " + string{get_isa_name(isa)} + " is not supported by this cpu");
+
+        switch (isa) {
+#ifdef HWINFO_KERNEL_AVX2
+            case Isa::avx2: return compute_avx2(current, old, cores, usage);
+#endif
+#ifdef HWINFO_KERNEL_NEON
+            case Isa::neon: return compute_neon(current, old, cores, usage);
+#endif
+            default: return compute_scalar(current, old, cores, usage, 0);
+        }
+    }
+}
@@ -0,0 +1,579 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "../include/exposition.hpp"
+
+using std::chrono::steady_clock;
+
+namespace bhwinfo {
+    namespace {
+        constexpr size_t max_connections = 256;
+        constexpr size_t max_request = 8192;
+        constexpr auto idle_timeout = 10s;
+
+        constexpr string_view not_found = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        constexpr string_view not_allowed = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        constexpr string_view too_large = "HTTP/1.1 431 Request Header Fields Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+        //* Label values may hold anything, the text format escapes backslashes, quotes and newlines
+        string escape(string_view value) {
+            string escaped;
+            escaped.reserve(value.size());
+
+            for (const char c : value) {
+                if (c == '\\' or c == '"') escaped += '\\';
+
+                if (c == '\n') escaped += "\\n";
+                else escaped += c;
+            }
+
+            return escaped;
+        }
+
+        string make_header(string_view name, string_view help) {
+            return "# HELP bhwinfo_" + string(name) + ' ' + string(help) + "\n# TYPE bhwinfo_" + string(name) + " gauge\n";
+        }
+
+        //* Name and labels of a series up to its value, e.g. bhwinfo_cpu_usage_percent{field="user"}
+        string make_series(string_view name, const string& labels = {}) {
+            string series = "bhwinfo_" + string(name);
+
+            if (not labels.empty()) series += '{' + labels + '}';
+
+            series += ' ';
+
+            return series;
+        }
+
+        template <typename T>
+        void append(string& out, const string& series, T value) {
+            char buf[32];
+            const auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+
+            out += series;
+            out.append(buf, end);
+            out += '\n';
+        }
+
+        bool add_to_epoll(int epoll_fd, int fd, uint32_t events, int op = EPOLL_CTL_ADD) {
+            epoll_event event{};
+            event.events = events;
+            event.data.fd = fd;
+
+            return epoll_ctl(epoll_fd, op, fd, &event) == 0;
+        }
+    }
+
+    Exposition::Exposition(const ExpositionConfig& config) : config(config) {
+        vector<string> ram;
+
+        for (const auto& name : mem::mem_field_names) ram.push_back(make_series("memory_bytes", "field=\"" + string(name) + '"'));
+
+        mem_families = {
+            {make_header("memory_bytes", "RAM and swap by use, in bytes."), std::move(ram)},
+            {make_header("memory_total_bytes", "Total RAM, in bytes."), {make_series("memory_total_bytes")}}
+        };
+
+        if (not config.listen) return;
+
+        try {
+            open_listener();
+        }
+        catch (...) {
+            close_fds();
+            throw;
+        }
+
+        server = std::thread([this]() { run(); });
+    }
+
+    Exposition::~Exposition() {
+        if (server.joinable()) {
+            const uint64_t one = 1;
+            while (write(stop_fd, &one, sizeof(one)) < 0 and errno == EINTR);
+
+            server.join();
+        }
+
+        close_fds();
+    }
+
+    const ExpositionConfig& Exposition::get_config() const {
+        return config;
+    }
+
+    const uint16_t& Exposition::get_port() const {
+        return port;
+    }
+
+    uint64_t Exposition::get_scrapes() const {
+        return scrapes.load();
+    }
+
+    string Exposition::get_text() const {
+        std::lock_guard lock(mutex);
+
+        return *cpu_section.front + *mem_section.front;
+    }
+
+    string& Exposition::begin(Section& section) {
+        //? A spare some connection is still sending stays with it, the render gets a new buffer instead
+        if (section.back == nullptr or section.back.use_count() > 1) {
+            section.back = std::make_shared<string>();
+            section.back->reserve(section.front->size());
+        }
+        else {
+            //? Pairs with the release of the last connection that dropped the buffer, its reads are done
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+
+        section.back->clear();
+
+        return *section.back;
+    }
+
+    void Exposition::publish(Section& section) {
+        std::shared_ptr<const string> published = std::move(section.back);
+
+        {
+            std::lock_guard lock(mutex);
+            std::swap(section.front, published);
+        }
+
+        //? Every buffer is created as a mutable string, only connections see them as const
+        section.back = std::const_pointer_cast<string>(published);
+    }
+
+    void Exposition::build_cpu_families(int cores, bool core_temps) {
+        cpu_cores = cores;
+        cpu_core_temps = core_temps;
+        cpu_families.clear();
+
+        Family usage{make_header("cpu_usage_percent", "Cpu time spent per field since the previous sample."), {}};
+
+        for (const auto& field : cpu::cpu_field_names)
+            usage.series.push_back(make_series("cpu_usage_percent", "field=\"" + string(field) + '"'));
+
+        Family core_usage{make_header("cpu_core_usage_percent", "Cpu time of each core spent per field since the previous sample."), {}};
+        Family core_frequency{make_header("cpu_core_frequency_hertz", "Current frequency of each core."), {}};
+        Family core_temp{make_header("cpu_core_temperature_celsius", "Temperature of each core."), {}};
+
+        for (int core = 0; core < cores; core++) {
+            const string core_label = "core=\"" + std::to_string(core) + '"';
+
+            for (const auto& field : cpu::cpu_field_names)
+                core_usage.series.push_back(make_series("cpu_core_usage_percent", core_label + ",field=\"" + string(field) + '"'));
+
+            core_frequency.series.push_back(make_series("cpu_core_frequency_hertz", core_label));
+            core_temp.series.push_back(make_series("cpu_core_temperature_celsius", core_label));
+        }
+
+        Family load{make_header("cpu_load_average", "Load average over 1, 5 and 15 minutes."), {}};
+
+        for (const auto& period : {"1m", "5m", "15m"})
+            load.series.push_back(make_series("cpu_load_average", "period=\""s + period + '"'));
+
+        cpu_families.push_back(std::move(usage));
+        cpu_families.push_back(std::move(core_usage));
+        cpu_families.push_back(std::move(core_frequency));
+        if (core_temps) cpu_families.push_back(std::move(core_temp));
+        cpu_families.push_back({make_header("cpu_temperature_celsius", "Cpu package temperature."), {make_series("cpu_temperature_celsius")}});
+        cpu_families.push_back({make_header("cpu_critical_temperature_celsius", "Critical cpu temperature, 0 when unknown."),
+                                {make_series("cpu_critical_temperature_celsius")}});
+        cpu_families.push_back(std::move(load));
+        cpu_families.push_back({make_header("cpu_frequency_hertz", "Current cpu frequency."), {make_series("cpu_frequency_hertz")}});
+    }
+
+    void Exposition::build_disk_families(const vector<mem::StorageUnit>& disks) {
+        static constexpr array<std::pair<string_view, string_view>, 11> names {{
+            {"disk_total_bytes", "Size of the filesystem, in bytes."},
+            {"disk_used_bytes", "Used space of the filesystem, in bytes."},
+            {"disk_free_bytes", "Free space of the filesystem, in bytes."},
+            {"disk_used_percent", "Used space of the filesystem, in percent."},
+            {"disk_read_bytes_per_second", "Bytes read from the device since the previous sample, per second."},
+            {"disk_write_bytes_per_second", "Bytes written to the device since the previous sample, per second."},
+            {"disk_io_activity_percent", "Time the device was busy since the previous sample, in percent."},
+            {"disk_iops", "Reads and writes completed per second."},
+            {"disk_io_in_flight", "Requests issued to the device and not completed yet."},
+            {"disk_io_weighted_ms_per_second", "Weighted time spent doing IO per second, 1000 is an average queue depth of 1."},
+            {"disk_stale", "1 when the usage values are from an earlier sample."}
+        }};
+
+        disk_labels.clear();
+        disk_families.clear();
+
+        for (const auto& [name, help] : names) disk_families.push_back({make_header(name, help), {}});
+
+        for (const auto& disk : disks) {
+            disk_labels.emplace_back(disk.get_handle(), disk.get_path().native());
+
+            const string labels = "disk=\"" + escape(disk.get_handle()) + "\",path=\"" + escape(disk.get_path().native()) + '"';
+
+            for (size_t i = 0; i < names.size(); i++) disk_families[i].series.push_back(make_series(names[i].first, labels));
+        }
+    }
+
+    void Exposition::render(const cpu::Data& cpu) {
+        const int cores = (int) cpu.get_core_load().size();
+        const bool core_temps = not cpu.get_core_temp().empty();
+
+        if (cores != cpu_cores or core_temps != cpu_core_temps) build_cpu_families(cores, core_temps);
+
+        string& out = begin(cpu_section);
+        auto family = cpu_families.begin();
+
+        auto next = [&]() -> const vector<string>& {
+            out += family->header;
+            return (family++)->series;
+        };
+
+        const auto& usage = next();
+
+        for (size_t field = 0; field < usage.size(); field++)
+            append(out, usage[field], cpu.get_cpu_usage().get_percent(cpu::CpuField(field)));
+
+        const auto& core_usage = next();
+        const size_t fields = cpu::cpu_field_names.size();
+
+        for (size_t core = 0; core < (size_t) cores; core++) {
+            for (size_t field = 0; field < fields; field++) {
+                const auto values = cpu.get_core_usage(cpu::CpuField(field));
+                const long long value = core < values.size() ? values[core]
+                        : cpu::CpuField(field) == cpu::CpuField::total ? cpu.get_core_load()[core] : 0;
+
+                append(out, core_usage[core * fields + field], value);
+            }
+        }
+
+        const auto& core_frequency = next();
+
+        for (size_t core = 0; core < (size_t) cores; core++)
+            append(out, core_frequency[core], core < cpu.get_core_frequency().size() ? cpu.get_core_frequency()[core] * 1000 : 0);
+
+        if (core_temps) {
+            const auto& core_temp = next();
+
+            for (size_t core = 0; core < (size_t) cores; core++)
+                append(out, core_temp[core], core < cpu.get_core_temp().size() ? cpu.get_core_temp()[core] : 0);
+        }
+
+        append(out, next()[0], cpu.get_cpu_temp());
+        append(out, next()[0], cpu.get_cpu_critical_temperature());
+
+        const auto& load = next();
+        const auto& average = cpu.get_average_load();
+
+        append(out, load[0], average.get_one_min());
+        append(out, load[1], average.get_five_min());
+        append(out, load[2], average.get_fifteen_min());
+
+        const auto& frequency = cpu.get_cpu_frequency();
+        const double scale = frequency.get_units() == "GHz" ? 1e9 : frequency.get_units() == "MHz" ? 1e6 : 1;
+
+        append(out, next()[0], frequency.get_value() * scale);
+
+        publish(cpu_section);
+    }
+
+    void Exposition::render(const mem::Data& mem, std::chrono::steady_clock::time_point time) {
+        const auto& disks = mem.get_disks();
+
+        bool changed = disks.size() != disk_labels.size();
+
+        for (size_t i = 0; not changed and i < disks.size(); i++)
+            changed = disks[i].get_handle() != disk_labels[i].first or disks[i].get_path().native() != disk_labels[i].second;
+
+        if (changed or disk_families.empty()) build_disk_families(disks);
+
+        //? io_read and io_write are bytes since the previous collect, rates stay 0 until there is an interval
+        const double elapsed = old_mem_time == steady_clock::time_point{} ? 0.0 : std::chrono::duration<double>(time - old_mem_time).count();
+        old_mem_time = time;
+
+        string& out = begin(mem_section);
+        const uint64_t swap_total = mem.get_swap_total_amount().get_bytes();
+        const uint64_t swap_free = std::min(mem.get_swap_free_amount().get_bytes(), swap_total);
+
+        const array<uint64_t, static_cast<size_t>(mem::MemField::count)> ram {
+            mem.get_used_ram_amount().get_bytes(), mem.get_available_ram_amount().get_bytes(),
+            mem.get_cached_ram_amount().get_bytes(), mem.get_free_ram_amount().get_bytes(),
+            swap_total, swap_total - swap_free, swap_free
+        };
+
+        out += mem_families[0].header;
+
+        for (size_t field = 0; field < ram.size(); field++) append(out, mem_families[0].series[field], ram[field]);
+
+        out += mem_families[1].header;
+        append(out, mem_families[1].series[0], mem.get_total_ram_amount().get_bytes());
+
+        auto rate = [&](long long bytes) { return elapsed > 0 ? (double) bytes / elapsed : 0.0; };
+
+        for (size_t family = 0; family < disk_families.size(); family++) {
+            out += disk_families[family].header;
+
+            for (size_t i = 0; i < disks.size(); i++) {
+                const auto& disk = disks[i];
+                const string& series = disk_families[family].series[i];
+
+                switch (family) {
+                    case 0: append(out, series, disk.get_total().get_bytes()); break;
+                    case 1: append(out, series, disk.get_used().get_bytes()); break;
+                    case 2: append(out, series, disk.get_free().get_bytes()); break;
+                    case 3: append(out, series, disk.get_used_percent()); break;
+                    case 4: append(out, series, rate(disk.get_io_read())); break;
+                    case 5: append(out, series, rate(disk.get_io_write())); break;
+                    case 6: append(out, series, disk.get_io_activity()); break;
+                    case 7: append(out, series, disk.get_iops()); break;
+                    case 8: append(out, series, disk.get_io_in_flight()); break;
+                    case 9: append(out, series, disk.get_io_weighted()); break;
+                    default: append(out, series, disk.is_stale() ? 1 : 0); break;
+                }
+            }
+        }
+
+        publish(mem_section);
+    }
+
+    void Exposition::open_listener() {
+        sockaddr_storage address{};
+        socklen_t length;
+        auto* v4 = reinterpret_cast<sockaddr_in*>(&address);
+        auto* v6 = reinterpret_cast<sockaddr_in6*>(&address);
+
+        if (inet_pton(AF_INET, config.address.c_str(), &v4->sin_addr) == 1) {
+            v4->sin_family = AF_INET;
+            v4->sin_port = htons(config.port);
+            length = sizeof(sockaddr_in);
+        }
+        else if (inet_pton(AF_INET6, config.address.c_str(), &v6->sin6_addr) == 1) {
+            v6->sin6_family = AF_INET6;
+            v6->sin6_port = htons(config.port);
+            length = sizeof(sockaddr_in6);
+        }
+        else throw std::invalid_argument("Invalid exposition address " + config.address);
+
+        const string endpoint = config.address + ':' + std::to_string(config.port);
+
+        listen_fd = socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+        if (listen_fd < 0) throw std::runtime_error("Failed to create a socket for " + endpoint);
+
+        const int one = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), length) < 0 or ::listen(listen_fd, 64) < 0)
+            throw std::runtime_error("Failed to listen on " + endpoint + ": " + std::strerror(errno));
+
+        //? The port the kernel picked when the config asked for 0
+        if (getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length) == 0)
+            port = ntohs(address.ss_family == AF_INET ? v4->sin_port : v6->sin6_port);
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (epoll_fd < 0 or stop_fd < 0 or not add_to_epoll(epoll_fd, listen_fd, EPOLLIN) or not add_to_epoll(epoll_fd, stop_fd, EPOLLIN))
+            throw std::runtime_error("Failed to set up the exposition listener");
+    }
+
+    void Exposition::close_fds() {
+        for (int* fd : {&listen_fd, &epoll_fd, &stop_fd}) {
+            if (*fd >= 0) ::close(*fd);
+            *fd = -1;
+        }
+    }
+
+    void Exposition::run() {
+        std::unordered_map<int, Connection> connections;
+        array<epoll_event, 64> events{};
+
+        for (;;) {
+            const int count = epoll_wait(epoll_fd, events.data(), (int) events.size(), 1000);
+
+            if (count < 0 and errno != EINTR) break;
+
+            const auto now = steady_clock::now();
+            bool stopping = false;
+            bool accepting = false;
+
+            for (int i = 0; i < count; i++) {
+                const int fd = events[i].data.fd;
+
+                stopping |= fd == stop_fd;
+                accepting |= fd == listen_fd;
+
+                if (fd == stop_fd or fd == listen_fd) continue;
+
+                const auto it = connections.find(fd);
+
+                if (it == connections.end()) continue;
+
+                auto& connection = it->second;
+                connection.active = now;
+
+                if (not (connection.responding ? write_response(fd, connection) : read_request(fd, connection))) {
+                    ::close(fd);
+                    connections.erase(it);
+                }
+            }
+
+            if (stopping) break;
+
+            //? Accepted after the events of this round, their fds can't be confused with ones closed above
+            if (accepting) accept_connections(connections);
+
+            //? Drop clients that stopped sending their request or reading the response
+            std::erase_if(connections, [&](const auto& entry) {
+                if (now - entry.second.active < idle_timeout) return false;
+
+                ::close(entry.first);
+                return true;
+            });
+        }
+
+        for (const auto& [fd, ignored] : connections) ::close(fd);
+    }
+
+    void Exposition::accept_connections(std::unordered_map<int, Connection>& connections) {
+        for (;;) {
+            const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+            if (fd < 0) {
+                if (errno == EINTR or errno == ECONNABORTED) continue;
+                return;
+            }
+
+            if (connections.size() >= max_connections or not add_to_epoll(epoll_fd, fd, EPOLLIN)) {
+                ::close(fd);
+                continue;
+            }
+
+            connections[fd].active = steady_clock::now();
+        }
+    }
+
+    bool Exposition::read_request(int fd, Connection& connection) {
+        char buf[2048];
+
+        for (;;) {
+            const ssize_t bytes = ::read(fd, buf, sizeof(buf));
+
+            if (bytes > 0) {
+                connection.request.append(buf, (size_t) bytes);
+
+                if (connection.request.size() > max_request) break;
+
+                continue;
+            }
+
+            if (bytes == 0) return false;
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN or errno == EWOULDBLOCK) break;
+
+            return false;
+        }
+
+        //? Everything up to the blank line is read, the request of a scraper has no body
+        if (connection.request.size() <= max_request and connection.request.find("\r\n\r\n") == string::npos) return true;
+
+        prepare_response(connection);
+
+        return write_response(fd, connection);
+    }
+
+    void Exposition::prepare_response(Connection& connection) {
+        const string_view request = connection.request;
+        connection.responding = true;
+
+        if (request.size() > max_request) {
+            connection.header = too_large;
+            return;
+        }
+
+        if (not request.starts_with("GET ")) {
+            connection.header = not_allowed;
+            return;
+        }
+
+        const string_view target = request.substr(4, request.find(' ', 4) - 4);
+
+        if (target != "/metrics" and not target.starts_with("/metrics?")) {
+            connection.header = not_found;
+            return;
+        }
+
+        {
+            std::lock_guard lock(mutex);
+            connection.cpu = cpu_section.front;
+            connection.mem = mem_section.front;
+        }
+
+        connection.header = "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: "
+                + std::to_string(connection.cpu->size() + connection.mem->size()) + "\r\nConnection: close\r\n\r\n";
+    }
+
+    bool Exposition::write_response(int fd, Connection& connection) {
+        for (;;) {
+            array<iovec, 3> parts{};
+            size_t count = 0;
+            size_t skip = connection.sent;
+
+            for (const string* part : {static_cast<const string*>(&connection.header), connection.cpu.get(), connection.mem.get()}) {
+                if (part == nullptr) continue;
+
+                if (skip >= part->size()) {
+                    skip -= part->size();
+                    continue;
+                }
+
+                parts[count++] = {const_cast<char*>(part->data()) + skip, part->size() - skip};
+                skip = 0;
+            }
+
+            if (count == 0) {
+                if (connection.cpu != nullptr) scrapes++;
+
+                shutdown(fd, SHUT_WR);
+                return false;
+            }
+
+            //? sendmsg() is writev() with MSG_NOSIGNAL, a scraper that hung up must not raise SIGPIPE
+            msghdr message{};
+            message.msg_iov = parts.data();
+            message.msg_iovlen = count;
+
+            const ssize_t bytes = sendmsg(fd, &message, MSG_NOSIGNAL);
+
+            if (bytes >= 0) {
+                connection.sent += (size_t) bytes;
+                continue;
+            }
+
+            if (errno == EINTR) continue;
+
+            if (errno == EAGAIN or errno == EWOULDBLOCK) return add_to_epoll(epoll_fd, fd, EPOLLOUT, EPOLL_CTL_MOD);
+
+            return false;
+        }
+    }
+}
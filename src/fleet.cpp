@@ -0,0 +1,545 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <bit>
+#include <cmath>
+#include <stdexcept>
+#include "../include/fleet.hpp"
+
+namespace bhwinfo {
+    namespace {
+        //? splitmix64 finalizer, source ids are often sequential and need their bits spread over the table
+        uint64_t mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ull;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebull;
+            x ^= x >> 31;
+
+            return x;
+        }
+
+        void count_group(vector<FleetTotals>& groups, uint32_t id, const FleetHost& host, bool add) {
+            if (groups.size() <= id) groups.resize(id + 1);
+
+            if (add) groups[id].add(host);
+            else groups[id].remove(host);
+        }
+    }
+
+    void FleetTotals::add(const FleetHost& host) {
+        hosts++;
+        cores += host.core_count;
+        busy_core_percent += (uint64_t) host.cpu_percent * host.core_count;
+        load_milli += host.load_milli;
+        ram_total += host.ram_total;
+        ram_used += host.ram_used;
+        disk_total += host.disk_total;
+        disk_used += host.disk_used;
+        io_read += host.io_read;
+        io_write += host.io_write;
+    }
+
+    void FleetTotals::remove(const FleetHost& host) {
+        //? Unsigned sums wrap around exactly, taking out what was added before leaves no error behind
+        hosts--;
+        cores -= host.core_count;
+        busy_core_percent -= (uint64_t) host.cpu_percent * host.core_count;
+        load_milli -= host.load_milli;
+        ram_total -= host.ram_total;
+        ram_used -= host.ram_used;
+        disk_total -= host.disk_total;
+        disk_used -= host.disk_used;
+        io_read -= host.io_read;
+        io_write -= host.io_write;
+    }
+
+    void FleetTotals::merge(const FleetTotals& other) {
+        hosts += other.hosts;
+        cores += other.cores;
+        busy_core_percent += other.busy_core_percent;
+        load_milli += other.load_milli;
+        ram_total += other.ram_total;
+        ram_used += other.ram_used;
+        disk_total += other.disk_total;
+        disk_used += other.disk_used;
+        io_read += other.io_read;
+        io_write += other.io_write;
+    }
+
+    double FleetTotals::get_cpu_percent() const {
+        return cores == 0 ? 0.0 : (double) busy_core_percent / (double) cores;
+    }
+
+    double FleetTotals::get_ram_percent() const {
+        return ram_total == 0 ? 0.0 : (double) ram_used * 100 / (double) ram_total;
+    }
+
+    FleetMerger::HostTable::HostTable(size_t capacity) {
+        const size_t slot_count = std::bit_ceil(std::max(capacity * 4 / 3 + 1, (size_t) 16));
+
+        slots.resize(slot_count);
+        used.resize(slot_count);
+        mask = slot_count - 1;
+    }
+
+    size_t FleetMerger::HostTable::locate(uint64_t source_id) const {
+        size_t i = mix(source_id) & mask;
+
+        while (used[i] and slots[i].source_id != source_id) i = (i + 1) & mask;
+
+        return i;
+    }
+
+    FleetHost* FleetMerger::HostTable::find(uint64_t source_id) {
+        const size_t i = locate(source_id);
+
+        return used[i] ? &slots[i] : nullptr;
+    }
+
+    const FleetHost* FleetMerger::HostTable::find(uint64_t source_id) const {
+        const size_t i = locate(source_id);
+
+        return used[i] ? &slots[i] : nullptr;
+    }
+
+    FleetHost& FleetMerger::HostTable::insert(uint64_t source_id, bool& inserted) {
+        size_t i = locate(source_id);
+        inserted = not used[i];
+
+        if (not inserted) return slots[i];
+
+        //? Linear probing slows down sharply beyond 3/4 full
+        if ((size + 1) * 4 > slots.size() * 3) {
+            grow();
+            i = locate(source_id);
+        }
+
+        used[i] = 1;
+        slots[i] = FleetHost{.source_id = source_id};
+        size++;
+
+        return slots[i];
+    }
+
+    bool FleetMerger::HostTable::erase(uint64_t source_id) {
+        size_t i = locate(source_id);
+
+        if (not used[i]) return false;
+
+        used[i] = 0;
+        size--;
+
+        //? Move back every following entry whose probe sequence runs through the freed slot, so lookups never stop early
+        for (size_t j = (i + 1) & mask; used[j]; j = (j + 1) & mask) {
+            const size_t home = mix(slots[j].source_id) & mask;
+
+            if (((j - home) & mask) < ((j - i) & mask)) continue;
+
+            slots[i] = slots[j];
+            used[i] = 1;
+            used[j] = 0;
+            i = j;
+        }
+
+        return true;
+    }
+
+    const size_t& FleetMerger::HostTable::get_size() const {
+        return size;
+    }
+
+    void FleetMerger::HostTable::grow() {
+        vector<FleetHost> old_slots(slots.size() * 2);
+        vector<uint8_t> old_used(used.size() * 2);
+
+        std::swap(slots, old_slots);
+        std::swap(used, old_used);
+        mask = slots.size() - 1;
+
+        for (size_t i = 0; i < old_slots.size(); i++) {
+            if (not old_used[i]) continue;
+
+            const size_t j = locate(old_slots[i].source_id);
+
+            slots[j] = old_slots[i];
+            used[j] = 1;
+        }
+    }
+
+    void FleetMerger::Shard::count(const FleetHost& host, bool add) {
+        //? A host that was only assigned so far has nothing to count
+        if (host.timestamp_ns == 0) return;
+
+        if (add) totals.add(host);
+        else totals.remove(host);
+
+        count_group(racks, host.rack, host, add);
+        count_group(clusters, host.cluster, host, add);
+    }
+
+    FleetMerger::FleetMerger(const FleetConfig& config) : config(config) {
+        if (config.batch_size == 0) throw std::invalid_argument("Fleet batch size must be at least 1");
+
+        const size_t shard_count = std::bit_ceil(std::max(config.shards, (size_t) 1));
+
+        shard_bits = (size_t) std::countr_zero(shard_count);
+
+        for (size_t i = 0; i < shard_count; i++)
+            shards.push_back(std::make_unique<Shard>(config.initial_hosts / shard_count + 1));
+
+        for (size_t i = 0; i <= config.workers; i++) queues.push_back(std::make_unique<Queue>());
+
+        for (size_t i = 0; i < config.workers; i++) workers.emplace_back(&FleetMerger::run, this, i);
+    }
+
+    FleetMerger::~FleetMerger() {
+        {
+            std::lock_guard lock(wake_mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+
+        for (auto& worker : workers) worker.join();
+    }
+
+    size_t FleetMerger::get_shard_index(uint64_t source_id) const {
+        //? The top bits pick the shard, the table inside it uses the low ones
+        return shard_bits == 0 ? 0 : (size_t) (mix(source_id) >> (64 - shard_bits));
+    }
+
+    FleetMerger::Shard& FleetMerger::get_shard(uint64_t source_id) const {
+        return *shards[get_shard_index(source_id)];
+    }
+
+    size_t FleetMerger::ingest(std::span<const std::span<const std::byte>> snapshots) {
+        if (snapshots.empty()) return 0;
+
+        const size_t task_count = (snapshots.size() + config.batch_size - 1) / config.batch_size;
+        Batch batch;
+
+        batch.snapshots = snapshots;
+        batch.remaining.store(task_count);
+
+        //? Counted before they are pushed, so a worker that sees none queued really has nothing to take
+        queued.fetch_add(task_count);
+
+        for (size_t i = 0; i < task_count; i++) {
+            auto& queue = *queues[next_queue.fetch_add(1, std::memory_order_relaxed) % queues.size()];
+            const Task task{&batch, i * config.batch_size, std::min((i + 1) * config.batch_size, snapshots.size())};
+
+            std::lock_guard lock(queue.mutex);
+            queue.tasks.push_back(task);
+        }
+
+        {
+            std::lock_guard lock(wake_mutex);
+        }
+
+        wake.notify_all();
+
+        //? The ingesting thread works through the tasks as well, and only waits for the ones still running elsewhere
+        while (batch.remaining.load() > 0 and try_run(config.workers)) {}
+
+        std::unique_lock lock(batch.mutex);
+        batch.done.wait(lock, [&]() { return batch.remaining.load() == 0; });
+
+        return batch.merged.load();
+    }
+
+    void FleetMerger::run(size_t worker) {
+        for (;;) {
+            if (try_run(worker)) continue;
+
+            std::unique_lock lock(wake_mutex);
+            wake.wait(lock, [this]() { return stopping or queued.load() > 0; });
+
+            if (stopping) return;
+        }
+    }
+
+    bool FleetMerger::try_run(size_t queue) {
+        Task task{};
+        bool found = false;
+
+        //? Own tasks are taken from the back while they are still warm, stolen ones from the front
+        for (size_t i = 0; i < queues.size() and not found; i++) {
+            auto& other = *queues[(queue + i) % queues.size()];
+            std::lock_guard lock(other.mutex);
+
+            if (other.tasks.empty()) continue;
+
+            if (i == 0) {
+                task = other.tasks.back();
+                other.tasks.pop_back();
+            }
+            else {
+                task = other.tasks.front();
+                other.tasks.pop_front();
+            }
+
+            found = true;
+            queued.fetch_sub(1);
+        }
+
+        if (not found) return false;
+
+        process(task);
+
+        return true;
+    }
+
+    void FleetMerger::process(const Task& task) {
+        thread_local vector<Update> updates;
+        Batch& batch = *task.batch;
+        size_t count = 0;
+
+        updates.clear();
+
+        for (size_t i = task.begin; i < task.end; i++) {
+            const SnapshotHeader* header;
+            std::span<const SnapshotDisk> disks;
+
+            try {
+                const SnapshotView view{batch.snapshots[i]};
+
+                header = &view.get_header();
+                disks = view.get_disks();
+            }
+            catch (const std::runtime_error&) {
+                rejected.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            if (header->timestamp_ns <= 0) {
+                rejected.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            //? io_read and io_write hold the bytes of the snapshot here, apply() turns them into rates
+            FleetHost host{header->source_id, header->sequence, header->timestamp_ns};
+
+            host.core_count = header->core_count;
+            host.cpu_percent = (int32_t) std::clamp(header->cpu_percent[cpu::CpuField::total], (int64_t) 0, (int64_t) 100);
+            host.load_milli = std::llround((double) header->load_avg[0] * 1000);
+            host.ram_total = header->ram_total;
+            host.ram_used = header->ram_bytes[mem::MemField::used];
+
+            for (const auto& disk : disks) {
+                host.disk_total += disk.total;
+                host.disk_used += disk.used;
+
+                //? IO values of a stale disk are from an earlier collect
+                if (disk.flags & snapshot_disk_stale) continue;
+
+                host.io_read += (uint64_t) std::max(disk.io_read, (int64_t) 0);
+                host.io_write += (uint64_t) std::max(disk.io_write, (int64_t) 0);
+            }
+
+            updates.push_back({get_shard_index(host.source_id), host});
+        }
+
+        //? One lock per shard the task touches, snapshots of the same host are applied oldest first
+        rng::sort(updates, [](const Update& a, const Update& b) {
+            return std::tie(a.shard, a.host.timestamp_ns, a.host.sequence) < std::tie(b.shard, b.host.timestamp_ns, b.host.sequence);
+        });
+
+        for (size_t begin = 0, end; begin < updates.size(); begin = end) {
+            for (end = begin + 1; end < updates.size() and updates[end].shard == updates[begin].shard;) end++;
+
+            count += apply(*shards[updates[begin].shard], std::span{updates}.subspan(begin, end - begin));
+        }
+
+        batch.merged.fetch_add(count);
+        merged.fetch_add(count, std::memory_order_relaxed);
+
+        //? Decremented under the lock, ingest() can't return and drop the batch before this is done with it
+        std::lock_guard lock(batch.mutex);
+
+        if (batch.remaining.fetch_sub(1) == 1) batch.done.notify_all();
+    }
+
+    size_t FleetMerger::apply(Shard& shard, std::span<const Update> updates) {
+        std::lock_guard lock(shard.mutex);
+        size_t count = 0;
+
+        for (const auto& [ignored, sample] : updates) {
+            bool inserted;
+            FleetHost& host = shard.hosts.insert(sample.source_id, inserted);
+
+            if (host.timestamp_ns != 0 and std::tie(sample.timestamp_ns, sample.sequence) <= std::tie(host.timestamp_ns, host.sequence)) {
+                outdated.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+
+            //? Disk IO of a snapshot covers the time since the previous collect of the host, taken as its previous snapshot.
+            //? The first snapshot of a host has no rate
+            const double elapsed = host.timestamp_ns == 0 ? 0.0 : (double) (sample.timestamp_ns - host.timestamp_ns) / 1e9;
+            const uint32_t rack = host.rack;
+            const uint32_t cluster = host.cluster;
+
+            shard.count(host, false);
+
+            host = sample;
+            host.rack = rack;
+            host.cluster = cluster;
+            host.io_read = elapsed > 0 ? (uint64_t) std::llround((double) sample.io_read / elapsed) : 0;
+            host.io_write = elapsed > 0 ? (uint64_t) std::llround((double) sample.io_write / elapsed) : 0;
+
+            shard.count(host, true);
+            count++;
+        }
+
+        return count;
+    }
+
+    void FleetMerger::assign(uint64_t source_id, uint32_t rack, uint32_t cluster) {
+        if (rack >= max_groups or cluster >= max_groups)
+            throw std::out_of_range("Rack and cluster ids must be below " + std::to_string(max_groups));
+
+        Shard& shard = get_shard(source_id);
+        std::lock_guard lock(shard.mutex);
+        bool inserted;
+        FleetHost& host = shard.hosts.insert(source_id, inserted);
+
+        shard.count(host, false);
+        host.rack = rack;
+        host.cluster = cluster;
+        shard.count(host, true);
+    }
+
+    bool FleetMerger::remove(uint64_t source_id) {
+        Shard& shard = get_shard(source_id);
+        std::lock_guard lock(shard.mutex);
+        const FleetHost* host = shard.hosts.find(source_id);
+
+        if (host == nullptr) return false;
+
+        shard.count(*host, false);
+
+        return shard.hosts.erase(source_id);
+    }
+
+    size_t FleetMerger::expire(int64_t before_ns) {
+        vector<uint64_t> expired;
+        size_t count = 0;
+
+        for (const auto& shard : shards) {
+            std::lock_guard lock(shard->mutex);
+
+            //? Hosts that were assigned but haven't sent a snapshot yet are kept
+            expired.clear();
+            shard->hosts.for_each([&](const FleetHost& host) {
+                if (host.timestamp_ns != 0 and host.timestamp_ns < before_ns) expired.push_back(host.source_id);
+            });
+
+            for (const auto& source_id : expired) {
+                shard->count(*shard->hosts.find(source_id), false);
+                shard->hosts.erase(source_id);
+            }
+
+            count += expired.size();
+        }
+
+        return count;
+    }
+
+    FleetTotals FleetMerger::get_totals() const {
+        FleetTotals totals;
+
+        for (const auto& shard : shards) {
+            std::lock_guard lock(shard->mutex);
+            totals.merge(shard->totals);
+        }
+
+        return totals;
+    }
+
+    void FleetMerger::get_groups(vector<FleetGroup>& out, vector<FleetTotals> Shard::* groups) const {
+        vector<FleetTotals> sums;
+
+        for (const auto& shard : shards) {
+            std::lock_guard lock(shard->mutex);
+            const auto& shard_groups = (*shard).*groups;
+
+            if (sums.size() < shard_groups.size()) sums.resize(shard_groups.size());
+
+            for (size_t i = 0; i < shard_groups.size(); i++) sums[i].merge(shard_groups[i]);
+        }
+
+        out.clear();
+
+        for (size_t i = 0; i < sums.size(); i++)
+            if (sums[i].hosts != 0) out.push_back({(uint32_t) i, sums[i]});
+    }
+
+    void FleetMerger::get_racks(vector<FleetGroup>& out) const {
+        get_groups(out, &Shard::racks);
+    }
+
+    void FleetMerger::get_clusters(vector<FleetGroup>& out) const {
+        get_groups(out, &Shard::clusters);
+    }
+
+    void FleetMerger::get_hosts(vector<FleetHost>& out) const {
+        out.clear();
+
+        for (const auto& shard : shards) {
+            std::lock_guard lock(shard->mutex);
+            shard->hosts.for_each([&](const FleetHost& host) { out.push_back(host); });
+        }
+    }
+
+    bool FleetMerger::get_host(uint64_t source_id, FleetHost& out) const {
+        const Shard& shard = get_shard(source_id);
+        std::lock_guard lock(shard.mutex);
+        const FleetHost* host = shard.hosts.find(source_id);
+
+        if (host == nullptr) return false;
+
+        out = *host;
+
+        return true;
+    }
+
+    size_t FleetMerger::get_host_count() const {
+        size_t count = 0;
+
+        for (const auto& shard : shards) {
+            std::lock_guard lock(shard->mutex);
+            count += shard->hosts.get_size();
+        }
+
+        return count;
+    }
+
+    const FleetConfig& FleetMerger::get_config() const {
+        return config;
+    }
+
+    uint64_t FleetMerger::get_merged() const {
+        return merged.load();
+    }
+
+    uint64_t FleetMerger::get_rejected() const {
+        return rejected.load();
+    }
+
+    uint64_t FleetMerger::get_outdated() const {
+        return outdated.load();
+    }
+}
@@ -0,0 +1,481 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/history_store.hpp"
+
+namespace bhwinfo {
+    namespace {
+        constexpr uint32_t history_magic = 0x48574842; // "BHWH"
+        constexpr uint16_t history_version = 2;
+        constexpr int64_t hour_ns = 3600LL * 1000000000LL;
+        constexpr size_t column_count = static_cast<size_t>(HistoryColumn::count);
+
+        constexpr size_t checksum_size = sizeof(uint32_t);
+
+        //? A zigzag varint of 64 bits takes at most 10 bytes
+        constexpr size_t max_record_size = column_count * 10 + checksum_size;
+
+        constexpr string_view segment_extension = ".bhs";
+
+        int64_t hour_of(int64_t timestamp_ns) {
+            return timestamp_ns - (timestamp_ns % hour_ns + hour_ns) % hour_ns;
+        }
+
+        //* Segments are named after the timestamp of their first record, so names sort by time
+        string segment_name(int64_t timestamp_ns) {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%020lld", static_cast<long long>(timestamp_ns));
+
+            return name + string{segment_extension};
+        }
+
+        //* First record timestamp from a segment file name, false for other files
+        bool parse_segment_name(const fs::path& path, int64_t& timestamp_ns) {
+            const string name = path.filename().string();
+
+            if (not name.ends_with(segment_extension)) return false;
+
+            const char* end = name.data() + name.size() - segment_extension.size();
+            const auto [ptr, ec] = std::from_chars(name.data(), end, timestamp_ns);
+
+            return ec == std::errc{} and ptr == end;
+        }
+
+        //? Deltas are taken in unsigned arithmetic, wrapping is fine as long as decoding wraps the same way
+        uint8_t* put_varint(uint64_t value, uint8_t* out) {
+            while (value >= 0x80) {
+                *out++ = static_cast<uint8_t>(value | 0x80);
+                value >>= 7;
+            }
+
+            *out++ = static_cast<uint8_t>(value);
+
+            return out;
+        }
+
+        bool get_varint(const uint8_t*& data, const uint8_t* end, uint64_t& value) {
+            value = 0;
+
+            for (int shift = 0; shift < 64 and data < end; shift += 7) {
+                const uint8_t byte = *data++;
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+                if ((byte & 0x80) == 0) return true;
+            }
+
+            return false;
+        }
+
+        uint64_t zigzag(uint64_t delta) {
+            return (delta << 1) ^ static_cast<uint64_t>(static_cast<int64_t>(delta) >> 63);
+        }
+
+        uint64_t unzigzag(uint64_t value) {
+            return (value >> 1) ^ (~(value & 1) + 1);
+        }
+
+        //* FNV-1a of the encoded columns, never 0 for zeroed bytes, so a page that didn't reach the disk fails it
+        uint32_t checksum(const uint8_t* data, const uint8_t* end) {
+            uint32_t hash = 2166136261u;
+
+            for (; data < end; data++) hash = (hash ^ *data) * 16777619u;
+
+            return hash;
+        }
+
+        constexpr size_t align_to(size_t size, size_t alignment) {
+            return (size + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    HistoryStore::HistoryStore(HistoryStoreConfig config) : config(std::move(config)) {
+        if (this->config.dir.empty()) throw std::invalid_argument("HistoryStore needs a directory");
+        if (this->config.max_records == 0 or this->config.keyframe_interval == 0)
+            throw std::invalid_argument("HistoryStore record and keyframe counts must be positive");
+        if (this->config.max_records / this->config.keyframe_interval >= index_capacity)
+            throw std::invalid_argument("HistoryStore segments would need more than " + std::to_string(index_capacity)
+                                        + " keyframes, raise keyframe_interval or lower max_records");
+
+        fs::create_directories(this->config.dir);
+    }
+
+    HistoryStore::~HistoryStore() {
+        sync();
+        close_segment();
+    }
+
+    HistoryRecord HistoryStore::make_record(int64_t timestamp_ns, const cpu::Data& cpu, const mem::Data& mem) {
+        HistoryRecord record{};
+
+        record[HistoryColumn::timestamp] = timestamp_ns;
+
+        const auto& usage = cpu.get_cpu_usage();
+
+        for (const auto& [column, field] : {std::pair{HistoryColumn::cpu_total, cpu::CpuField::total},
+                                            std::pair{HistoryColumn::cpu_user, cpu::CpuField::user},
+                                            std::pair{HistoryColumn::cpu_nice, cpu::CpuField::nice},
+                                            std::pair{HistoryColumn::cpu_system, cpu::CpuField::system},
+                                            std::pair{HistoryColumn::cpu_idle, cpu::CpuField::idle},
+                                            std::pair{HistoryColumn::cpu_iowait, cpu::CpuField::iowait},
+                                            std::pair{HistoryColumn::cpu_irq, cpu::CpuField::irq},
+                                            std::pair{HistoryColumn::cpu_softirq, cpu::CpuField::softirq},
+                                            std::pair{HistoryColumn::cpu_steal, cpu::CpuField::steal}}) {
+            record[column] = usage.get_percent(field);
+        }
+
+        const auto& load = cpu.get_average_load();
+
+        record[HistoryColumn::load_1] = std::llround(load.get_one_min() * 100);
+        record[HistoryColumn::load_5] = std::llround(load.get_five_min() * 100);
+        record[HistoryColumn::load_15] = std::llround(load.get_fifteen_min() * 100);
+        record[HistoryColumn::cpu_temp] = cpu.get_cpu_temp();
+
+        //? Mean of the cores cpufreq reports, the rounded display value only when there are none
+        int64_t frequency_sum = 0;
+        int64_t frequency_count = 0;
+
+        for (const auto& khz : cpu.get_core_frequency()) {
+            if (khz <= 0) continue;
+
+            frequency_sum += khz;
+            frequency_count++;
+        }
+
+        if (frequency_count > 0) {
+            record[HistoryColumn::cpu_frequency] = frequency_sum / frequency_count;
+        }
+        else {
+            const auto& frequency = cpu.get_cpu_frequency();
+            const double scale = frequency.get_units() == "GHz" ? 1000000 : frequency.get_units() == "MHz" ? 1000 : 0;
+
+            record[HistoryColumn::cpu_frequency] = std::llround(frequency.get_value() * scale);
+        }
+
+        record[HistoryColumn::ram_used] = static_cast<int64_t>(mem.get_used_ram_amount().get_bytes());
+        record[HistoryColumn::ram_available] = static_cast<int64_t>(mem.get_available_ram_amount().get_bytes());
+        record[HistoryColumn::ram_cached] = static_cast<int64_t>(mem.get_cached_ram_amount().get_bytes());
+        record[HistoryColumn::ram_free] = static_cast<int64_t>(mem.get_free_ram_amount().get_bytes());
+        record[HistoryColumn::swap_used] = static_cast<int64_t>(mem.get_swap_total_amount().get_bytes())
+                                           - static_cast<int64_t>(mem.get_swap_free_amount().get_bytes());
+        record[HistoryColumn::dirty] = static_cast<int64_t>(mem.get_dirty_amount().get_bytes());
+
+        return record;
+    }
+
+    HistoryStore::SegmentHeader& HistoryStore::header() const {
+        return *reinterpret_cast<SegmentHeader*>(map);
+    }
+
+    size_t HistoryStore::encode(const HistoryRecord& record, Cursor& cursor, std::byte* out) {
+        auto* ptr = reinterpret_cast<uint8_t*>(out);
+
+        //? The timestamp is close to periodic, so the delta of its delta is mostly zero
+        const int64_t interval = static_cast<int64_t>(static_cast<uint64_t>(record[HistoryColumn::timestamp])
+                                                      - static_cast<uint64_t>(cursor.last[HistoryColumn::timestamp]));
+
+        ptr = put_varint(zigzag(static_cast<uint64_t>(interval) - static_cast<uint64_t>(cursor.last_interval)), ptr);
+
+        for (size_t i = 1; i < column_count; i++) {
+            ptr = put_varint(zigzag(static_cast<uint64_t>(record[HistoryColumn(i)])
+                                    - static_cast<uint64_t>(cursor.last[HistoryColumn(i)])), ptr);
+        }
+
+        const uint32_t sum = checksum(reinterpret_cast<uint8_t*>(out), ptr);
+
+        std::memcpy(ptr, &sum, checksum_size);
+        ptr += checksum_size;
+
+        cursor.last = record;
+        cursor.last_interval = interval;
+
+        return ptr - reinterpret_cast<uint8_t*>(out);
+    }
+
+    bool HistoryStore::decode(const std::byte*& data, const std::byte* end, Cursor& cursor, HistoryRecord& record) {
+        auto* const start = reinterpret_cast<const uint8_t*>(data);
+        auto* ptr = start;
+        auto* stop = reinterpret_cast<const uint8_t*>(end);
+        uint64_t value;
+
+        if (not get_varint(ptr, stop, value)) return false;
+
+        const auto interval = static_cast<int64_t>(static_cast<uint64_t>(cursor.last_interval) + unzigzag(value));
+
+        record[HistoryColumn::timestamp] = static_cast<int64_t>(static_cast<uint64_t>(cursor.last[HistoryColumn::timestamp])
+                                                                + static_cast<uint64_t>(interval));
+
+        for (size_t i = 1; i < column_count; i++) {
+            if (not get_varint(ptr, stop, value)) return false;
+
+            record[HistoryColumn(i)] = static_cast<int64_t>(static_cast<uint64_t>(cursor.last[HistoryColumn(i)])
+                                                            + unzigzag(value));
+        }
+
+        uint32_t sum;
+
+        if (stop - ptr < (ptrdiff_t) checksum_size) return false;
+
+        std::memcpy(&sum, ptr, checksum_size);
+
+        if (sum != checksum(start, ptr)) return false;
+
+        ptr += checksum_size;
+        cursor.last = record;
+        cursor.last_interval = interval;
+        data = reinterpret_cast<const std::byte*>(ptr);
+
+        return true;
+    }
+
+    void HistoryStore::open_segment(int64_t timestamp_ns) {
+        const fs::path path = config.dir / segment_name(timestamp_ns);
+        const size_t data_offset = align_to(sizeof(SegmentHeader), 4096);
+        const size_t capacity = align_to((size_t) config.max_records * max_record_size, 4096);
+
+        const int segment_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+        if (segment_fd < 0) throw std::runtime_error("Failed to create " + path.string());
+
+        //? The file stays sparse, only pages that records were written to take up space
+        if (ftruncate(segment_fd, (off_t) (data_offset + capacity)) < 0) {
+            ::close(segment_fd);
+            throw std::runtime_error("Failed to size " + path.string());
+        }
+
+        void* ptr = mmap(nullptr, data_offset + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment_fd, 0);
+
+        if (ptr == MAP_FAILED) {
+            ::close(segment_fd);
+            throw std::runtime_error("Failed to map " + path.string());
+        }
+
+        fd = segment_fd;
+        map = static_cast<std::byte*>(ptr);
+        map_size = data_offset + capacity;
+        segment_path = path;
+        synced = 0;
+        cursor = {};
+
+        auto* segment = new (map) SegmentHeader{history_magic, history_version, static_cast<uint16_t>(column_count),
+                                                static_cast<uint32_t>(data_offset), config.keyframe_interval, capacity,
+                                                hour_of(timestamp_ns), {}, {}, {}, {}, {}};
+        segment->last_ns.store(0);
+        segment->committed.store(0);
+        segment->record_count.store(0);
+        segment->index_count.store(0, std::memory_order_release);
+    }
+
+    void HistoryStore::close_segment() {
+        if (map == nullptr) return;
+
+        const auto& segment = header();
+        const size_t used = segment.data_offset + segment.committed.load(std::memory_order_relaxed);
+
+        //? Give back the unused tail of the file, readers only trust the committed length anyway
+        msync(map, map_size, MS_ASYNC);
+        munmap(map, map_size);
+        ftruncate(fd, (off_t) used);
+        ::close(fd);
+
+        map = nullptr;
+        map_size = 0;
+        fd = -1;
+    }
+
+    void HistoryStore::remove_expired(int64_t now_ns) {
+        const int64_t cutoff = now_ns - std::chrono::duration_cast<std::chrono::nanoseconds>(config.retention).count();
+        std::error_code ec;
+
+        for (const auto& entry : fs::directory_iterator(config.dir, ec)) {
+            int64_t first_ns;
+
+            if (not parse_segment_name(entry.path(), first_ns) or entry.path() == segment_path) continue;
+
+            //? Segments never reach past the end of the hour their first record is in
+            if (hour_of(first_ns) + hour_ns <= cutoff) fs::remove(entry.path(), ec);
+        }
+    }
+
+    void HistoryStore::append(const HistoryRecord& record) {
+        const int64_t timestamp = record[HistoryColumn::timestamp];
+
+        //? Start a new segment on every hour, when this one is full, and when the clock went back
+        if (map == nullptr) {
+            open_segment(timestamp);
+            remove_expired(timestamp);
+        }
+        else if (const auto& segment = header();
+                 hour_of(timestamp) != segment.start_ns or timestamp < segment.last_ns.load(std::memory_order_relaxed)
+                 or segment.record_count.load(std::memory_order_relaxed) >= config.max_records
+                 or segment.capacity - segment.committed.load(std::memory_order_relaxed) < max_record_size) {
+            close_segment();
+            open_segment(timestamp);
+            remove_expired(timestamp);
+        }
+
+        auto& segment = header();
+        const uint64_t committed = segment.committed.load(std::memory_order_relaxed);
+        const uint32_t count = segment.record_count.load(std::memory_order_relaxed);
+        std::byte* out = map + segment.data_offset + committed;
+
+        //? Every keyframe restarts the deltas from zero, so decoding can start there
+        if (count % config.keyframe_interval == 0) {
+            const uint32_t index_count = segment.index_count.load(std::memory_order_relaxed);
+
+            cursor = {};
+            segment.index[index_count] = {timestamp, static_cast<uint32_t>(committed), count};
+            segment.index_count.store(index_count + 1, std::memory_order_release);
+        }
+
+        const size_t size = encode(record, cursor, out);
+
+        //? The record counts once committed covers it, a crash before that leaves the previous length intact
+        segment.last_ns.store(timestamp, std::memory_order_relaxed);
+        segment.record_count.store(count + 1, std::memory_order_relaxed);
+        segment.committed.store(committed + size, std::memory_order_release);
+    }
+
+    void HistoryStore::flush() {
+        if (map != nullptr) msync(map, map_size, MS_ASYNC);
+    }
+
+    void HistoryStore::sync() {
+        if (map == nullptr) return;
+
+        const auto& segment = header();
+        const uint64_t committed = segment.committed.load(std::memory_order_relaxed);
+
+        if (committed == synced) return;
+
+        //? Only the pages the new records are on, then the header that counts them
+        const size_t page = 4096;
+        const size_t from = (segment.data_offset + synced) / page * page;
+
+        msync(map + from, segment.data_offset + committed - from, MS_SYNC);
+        msync(map, segment.data_offset, MS_SYNC);
+
+        synced = committed;
+    }
+
+    vector<HistoryRecord> HistoryStore::query(const fs::path& dir, int64_t from_ns, int64_t to_ns) {
+        vector<std::pair<int64_t, fs::path>> segments;
+        std::error_code ec;
+
+        for (const auto& entry : fs::directory_iterator(dir, ec)) {
+            int64_t first_ns;
+
+            if (not parse_segment_name(entry.path(), first_ns)) continue;
+
+            //? Only segments whose hour overlaps the range get opened
+            if (first_ns < to_ns and hour_of(first_ns) + hour_ns > from_ns) segments.emplace_back(first_ns, entry.path());
+        }
+
+        rng::sort(segments);
+
+        vector<HistoryRecord> records;
+
+        for (const auto& [first_ns, path] : segments) {
+            const int segment_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+            if (segment_fd < 0) continue;
+
+            struct stat st{};
+
+            if (fstat(segment_fd, &st) < 0 or (size_t) st.st_size < sizeof(SegmentHeader)) {
+                ::close(segment_fd);
+                continue;
+            }
+
+            const auto size = static_cast<size_t>(st.st_size);
+            void* ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, segment_fd, 0);
+            ::close(segment_fd);
+
+            if (ptr == MAP_FAILED) continue;
+
+            const auto* base = static_cast<const std::byte*>(ptr);
+            const auto& segment = *reinterpret_cast<const SegmentHeader*>(base);
+
+            const uint64_t committed = segment.committed.load(std::memory_order_acquire);
+            const uint32_t index_count = std::min<uint32_t>(segment.index_count.load(std::memory_order_acquire),
+                                                            index_capacity);
+
+            if (segment.magic != history_magic or segment.version != history_version
+                or segment.column_count != column_count or index_count == 0
+                or committed > size - std::min<uint64_t>(size, segment.data_offset)) {
+                munmap(ptr, size);
+                continue;
+            }
+
+            //? Decode from the last keyframe at or before the start of the range, the index is ordered by time
+            const auto* index_end = segment.index.begin() + index_count;
+            auto keyframe = std::upper_bound(segment.index.begin(), index_end, from_ns,
+                                             [](int64_t ts, const IndexEntry& entry) { return ts < entry.timestamp; });
+
+            if (keyframe != segment.index.begin()) keyframe--;
+
+            const std::byte* data = base + segment.data_offset;
+            const std::byte* end = data + committed;
+            bool intact = true;
+
+            for (; intact and keyframe != index_end and keyframe->offset < committed; keyframe++) {
+                const std::byte* next = keyframe + 1 != index_end and (keyframe + 1)->offset < committed
+                                        ? data + (keyframe + 1)->offset : end;
+                const std::byte* pos = data + keyframe->offset;
+                Cursor cursor;
+                HistoryRecord record;
+
+                if (keyframe->timestamp >= to_ns) break;
+
+                //? A zeroed index entry after a power loss points back into records that were already read
+                if (next < pos) break;
+
+                while (pos < next) {
+                    //? Nothing after a bad record can be trusted, its deltas are what the following ones build on
+                    if (not decode(pos, next, cursor, record)) {
+                        intact = false;
+                        break;
+                    }
+
+                    const int64_t timestamp = record[HistoryColumn::timestamp];
+
+                    if (timestamp >= to_ns) break;
+                    if (timestamp >= from_ns) records.push_back(record);
+                }
+            }
+
+            munmap(ptr, size);
+        }
+
+        return records;
+    }
+
+    const HistoryStoreConfig& HistoryStore::get_config() const {
+        return config;
+    }
+
+    const fs::path& HistoryStore::get_segment_path() const {
+        return segment_path;
+    }
+}
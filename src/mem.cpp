@@ -16,16 +16,112 @@
  */
 
 #include "cmath"
+#include <poll.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <thread>
 #include "../include/mem.hpp"
 
 using std::clamp;
 using std::round;
 using std::max;
 
+namespace {
+    //? Seed picked offline so that every meminfo label gets its own slot, meminfo_table fails to compile otherwise
+    constexpr uint32_t meminfo_hash_seed = 415299;
+    constexpr size_t meminfo_slots = 64;
+    constexpr uint8_t meminfo_empty_slot = UINT8_MAX;
+
+    constexpr size_t meminfo_slot(string_view label) {
+        uint32_t hash = 2166136261u ^ meminfo_hash_seed;
+
+        for (const char c : label) hash = (hash ^ (unsigned char) c) * 16777619u;
+
+        return (hash ^ (hash >> 16)) % meminfo_slots;
+    }
+
+    constexpr auto meminfo_table = []() {
+        array<uint8_t, meminfo_slots> table{};
+        table.fill(meminfo_empty_slot);
+
+        for (size_t field = 0; field < mem::meminfo_field_names.size(); field++) {
+            auto& slot = table[meminfo_slot(mem::meminfo_field_names[field])];
+
+            if (slot != meminfo_empty_slot) throw std::logic_error("meminfo_hash_seed collides, pick another one");
+
+            slot = field;
+        }
+
+        return table;
+    }();
+
+    //* memory.stat keys of a cgroup and the MemInfoField each one stands in for
+    constexpr array<std::pair<string_view, mem::MemInfoField>, 16> cgroup_memory_fields {{
+        {"anon"sv, mem::MemInfoField::anon_pages}, {"file"sv, mem::MemInfoField::cached},
+        {"kernel_stack"sv, mem::MemInfoField::kernel_stack}, {"pagetables"sv, mem::MemInfoField::page_tables},
+        {"shmem"sv, mem::MemInfoField::shmem}, {"file_mapped"sv, mem::MemInfoField::mapped},
+        {"file_dirty"sv, mem::MemInfoField::dirty}, {"file_writeback"sv, mem::MemInfoField::writeback},
+        {"anon_thp"sv, mem::MemInfoField::anon_huge_pages}, {"inactive_anon"sv, mem::MemInfoField::inactive_anon},
+        {"active_anon"sv, mem::MemInfoField::active_anon}, {"inactive_file"sv, mem::MemInfoField::inactive_file},
+        {"active_file"sv, mem::MemInfoField::active_file}, {"unevictable"sv, mem::MemInfoField::unevictable},
+        {"slab_reclaimable"sv, mem::MemInfoField::sreclaimable}, {"slab_unreclaimable"sv, mem::MemInfoField::sunreclaim}
+    }};
+
+    //* Labels of the NumaField counters in a node's numastat, its vmstat uses mem::numa_field_names
+    constexpr array<string_view, static_cast<size_t>(mem::NumaField::count)> numastat_field_names {
+        "numa_hit"sv, "numa_miss"sv, "numa_foreign"sv, "interleave_hit"sv, "local_node"sv, "other_node"sv
+    };
+
+    //* Parse meminfo <lines> into <info>, skipping the "Node <n> " prefix of a node's meminfo. Returns the mask of fields found
+    uint64_t parse_meminfo_lines(string_view lines, ut::type::enum_array<mem::MemInfoField, uint64_t>& info) {
+        uint64_t present = 0;
+
+        while (not lines.empty()) {
+            string_view line = ut::str::next_line(lines);
+
+            if (line.starts_with("Node ")) {
+                line.remove_prefix(5);
+                line.remove_prefix(std::min(line.find(' ') + 1, line.size()));
+            }
+
+            const string_view label = line.substr(0, line.find(':'));
+
+            if (label.size() == line.size()) continue;
+
+            //? One hash and one compare per line, labels not in meminfo_field_names are skipped
+            const uint8_t field = meminfo_table[meminfo_slot(label)];
+
+            if (field == meminfo_empty_slot or mem::meminfo_field_names[field] != label) continue;
+
+            line.remove_prefix(label.size() + 1);
+
+            uint64_t value = 0;
+            ut::str::next_number(line, value);
+
+            //? HugePages_ counts have no unit, everything else is in kB
+            info[mem::MemInfoField(field)] = line.ends_with("kB") ? value << 10 : value;
+            present |= 1ull << field;
+        }
+
+        return present;
+    }
+
+    //? Counters restart from 0 when a device is removed and added again, report 0 for that interval
+    uint64_t advance(uint64_t value, uint64_t& previous) {
+        const uint64_t diff = value >= previous ? value - previous : 0;
+        previous = value;
+        return diff;
+    }
+}
+
 namespace mem {
     GenericMemUnit::GenericMemUnit(const uint64_t& bytes) : bytes(bytes) {};
 
+    const uint64_t& GenericMemUnit::get_bytes() const {
+        return bytes;
+    }
+
     double GenericMemUnit::to_gigabytes() const {
         return (double)bytes/(1024 * 1024 * 1024);
     }
@@ -55,19 +151,44 @@ namespace mem {
         const long long& io_read,
         const long long& io_write,
         const long long& io_activity,
-        fs::path path
+        fs::path path,
+        const bool& stale,
+        const long long& iops,
+        const long long& io_in_flight,
+        const long long& io_weighted
+    ) :
+    StorageUnit(total, used, free, usedPercent, freePercent,
+                std::make_shared<const DiskIdentity>(DiskIdentity{"", std::move(handle), std::move(fs_type), std::move(path)}),
+                io_read, io_write, io_activity, stale, iops, io_in_flight, io_weighted) {}
+
+    StorageUnit::StorageUnit(
+        const GenericMemUnit &total,
+        const GenericMemUnit &used,
+        const GenericMemUnit &free,
+        const int& usedPercent,
+        const int& freePercent,
+        std::shared_ptr<const DiskIdentity> identity,
+        const long long& io_read,
+        const long long& io_write,
+        const long long& io_activity,
+        const bool& stale,
+        const long long& iops,
+        const long long& io_in_flight,
+        const long long& io_weighted
     ) :
     total(total),
     used(used),
     free(free),
     used_percent(usedPercent),
     free_percent(freePercent),
-    handle(std::move(handle)),
-    fs_type(std::move(fs_type)),
+    identity(identity ? std::move(identity) : std::make_shared<const DiskIdentity>()),
     io_read(io_read),
     io_write(io_write),
     io_activity(io_activity),
-    path(std::move(path)) {}
+    stale(stale),
+    iops(iops),
+    io_in_flight(io_in_flight),
+    io_weighted(io_weighted) {}
 
     const GenericMemUnit& StorageUnit::get_total() const {
         return total;
@@ -90,11 +211,11 @@ namespace mem {
     }
 
     const string& StorageUnit::get_handle() const {
-        return handle;
+        return identity->handle;
     }
 
     const string& StorageUnit::get_fs_type() const {
-        return fs_type;
+        return identity->fs_type;
     }
 
     const long long int& StorageUnit::get_io_read() const {
@@ -110,22 +231,48 @@ namespace mem {
     }
 
     const fs::path& StorageUnit::get_path() const {
-        return path;
+        return identity->path;
+    }
+
+    const string& StorageUnit::get_mountpoint() const {
+        return identity->mountpoint;
+    }
+
+    const bool& StorageUnit::is_stale() const {
+        return stale;
+    }
+
+    const long long& StorageUnit::get_iops() const {
+        return iops;
+    }
+
+    const long long& StorageUnit::get_io_in_flight() const {
+        return io_in_flight;
     }
 
+    const long long& StorageUnit::get_io_weighted() const {
+        return io_weighted;
+    }
+
+    Data::Data() = default;
+
     Data::Data(
         const GenericMemUnit& total_ram_amount,
         const RamUnit& available_ram_amount,
         const RamUnit& cached_ram_amount,
         const RamUnit& free_ram_amount,
         const RamUnit& used_ram_amount,
-        const vector<StorageUnit>& disks
+        vector<StorageUnit> disks,
+        const ut::type::enum_array<MemInfoField, uint64_t>& meminfo,
+        vector<NodeMemory> numa_nodes
     ) :
     available_ram_amount(available_ram_amount),
     cached_ram_amount(cached_ram_amount),
     free_ram_amount(free_ram_amount),
     used_ram_amount(used_ram_amount),
-    disks(disks) {
+    disks(std::move(disks)),
+    meminfo(meminfo),
+    numa_nodes(std::move(numa_nodes)) {
         this->total_ram_amount = total_ram_amount;
     }
 
@@ -153,83 +300,444 @@ namespace mem {
         return disks;
     }
 
-    DataCollector::DataCollector() {
+    const vector<NodeMemory>& Data::get_numa_nodes() const {
+        return numa_nodes;
+    }
+
+    const uint64_t& Data::get_meminfo(MemInfoField field) const {
+        return meminfo[field];
+    }
+
+    GenericMemUnit Data::get_buffers_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::buffers]};
+    }
+
+    GenericMemUnit Data::get_shared_ram_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::shmem]};
+    }
+
+    GenericMemUnit Data::get_reclaimable_slab_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::sreclaimable]};
+    }
+
+    GenericMemUnit Data::get_dirty_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::dirty]};
+    }
+
+    GenericMemUnit Data::get_writeback_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::writeback]};
+    }
+
+    GenericMemUnit Data::get_swap_total_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::swap_total]};
+    }
+
+    GenericMemUnit Data::get_swap_free_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::swap_free]};
+    }
+
+    GenericMemUnit Data::get_swap_cached_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::swap_cached]};
+    }
+
+    GenericMemUnit Data::get_committed_amount() const {
+        return GenericMemUnit{meminfo[MemInfoField::committed_as]};
+    }
+
+    const uint64_t& Data::get_huge_pages_total() const {
+        return meminfo[MemInfoField::huge_pages_total];
+    }
+
+    const uint64_t& Data::get_huge_pages_free() const {
+        return meminfo[MemInfoField::huge_pages_free];
+    }
+
+    const uint64_t& Data::get_huge_pages_reserved() const {
+        return meminfo[MemInfoField::huge_pages_rsvd];
+    }
+
+    const uint64_t& Data::get_huge_pages_surplus() const {
+        return meminfo[MemInfoField::huge_pages_surp];
+    }
+
+    GenericMemUnit Data::get_huge_page_size() const {
+        return GenericMemUnit{meminfo[MemInfoField::hugepagesize]};
+    }
+
+    const GenericMemUnit& DataDelta::get_total_ram_amount() const {
+        return total_ram_amount;
+    }
+
+    const RamUnit& DataDelta::get_available_ram_amount() const {
+        return available_ram_amount;
+    }
+
+    const RamUnit& DataDelta::get_cached_ram_amount() const {
+        return cached_ram_amount;
+    }
+
+    const RamUnit& DataDelta::get_free_ram_amount() const {
+        return free_ram_amount;
+    }
+
+    const RamUnit& DataDelta::get_used_ram_amount() const {
+        return used_ram_amount;
+    }
+
+    const uint64_t& DataDelta::get_meminfo(MemInfoField field) const {
+        return meminfo[field];
+    }
+
+    const vector<DiskUpdate>& DataDelta::get_changed_disks() const {
+        return changed_disks;
+    }
+
+    const vector<DiskId>& DataDelta::get_added_disks() const {
+        return added_disks;
+    }
+
+    const vector<DiskId>& DataDelta::get_removed_disks() const {
+        return removed_disks;
+    }
+
+    DataCollector::DataCollector() : DataCollector(fs::path{}) {}
+
+    DataCollector::DataCollector(const fs::path& cgroup) {
         shared::init();
 
-        this->total_ram_amount = GenericMemUnit{this->get_total_ram_amount()};
-        this->old_uptime = ut::system_uptime();
+        if (not cgroup.empty()) group = std::make_unique<cgroup::Group>(cgroup);
+
+        meminfo_reader = ut::file::CachedReader{shared::proc_path / "meminfo"};
+        diskstats_reader = ut::file::CachedReader{shared::proc_path / "diskstats", 16384};
+
+        if (group) io_backend = IoBackend::cgroup;
+        else if (diskstats_reader.open()) io_backend = IoBackend::diskstats;
+
+        if (group) parse_cgroup_memory();
+        else parse_meminfo();
+
+        //? Nodes split the host's memory, a cgroup's share of them isn't known without its memory.numa_stat
+        if (not group and not shared::sys_path.empty()) find_numa_nodes();
+
+        this->total_ram_amount = GenericMemUnit{current_mem.meminfo[MemInfoField::mem_total]};
+        this->old_time = std::chrono::steady_clock::now();
+
+        //? Get list of "real" filesystems from /proc/filesystems, it only changes when a filesystem module is loaded
+        std::ifstream filesystems(shared::proc_path / "filesystems");
+
+        if (filesystems.good()) {
+            for (string fstype; filesystems >> fstype;) {
+                if (not ut::type::is_in(fstype, "nodev", "squashfs", "nullfs", "zfs", "wslfs", "drvfs"))
+                    fstypes.insert(fstype);
+                filesystems.ignore(ut::maxStreamSize, '\n');
+            }
+        }
+        else {
+            throw std::runtime_error("Failed to read /proc/filesystems");
+        }
+
+        //? /proc/self/mounts signals mount table changes with POLLPRI, /etc/mtab is only read when it is a regular file
+        //? and describes the same system, i.e. not when reading a host mount or snapshot through another proc root
+        mounts_reader = ut::file::CachedReader{shared::proc_path / "self/mounts", 16384};
+
+        if (std::error_code ec; shared::is_local_root() and fs::is_regular_file(fs::symlink_status("/etc/mtab", ec)))
+            mtab_reader = ut::file::CachedReader{"/etc/mtab", 16384};
+
+        if (not mounts_reader.open() or (not mtab_reader.get_path().empty() and not mtab_reader.open()))
+            throw std::runtime_error("Failed to get mounts from /etc/mtab and /proc/self/mounts");
+    }
+
+    void DataCollector::update_disk_usage(
+        const string& mountpoint,
+        DiskInfo& disk,
+        int result,
+        int error,
+        uint64_t blocks,
+        uint64_t bavail,
+        uint64_t frsize
+    ) {
+        if (result < 0) {
+            //? Mountpoints that vanished are dropped with the next mount table change, others are ignored from now on
+            if (error == ENOENT) return;
+
+            ignore_list.insert(mountpoint);
+
+            //? Parse the mount table again next time to drop the ignored disk
+            mount_table_valid = false;
+
+            return;
+        }
+
+        disk.total = blocks * frsize;
+        disk.free = bavail * frsize;
+        disk.used = disk.total - disk.free;
+        disk.used_percent = round((double) disk.used * 100 / disk.total);
+        disk.free_percent = 100 - disk.used_percent;
     }
 
-    uint64_t DataCollector::get_total_ram_amount() {
-        std::ifstream mem_info(shared::proc_path / "meminfo");
-        int64_t totalMem;
+    void DataCollector::set_parallel_disk_stats(size_t workers, std::chrono::milliseconds timeout) {
+        statvfs_pool = workers > 0 ? std::make_unique<StatvfsPool>(workers) : nullptr;
+        statvfs_timeout = timeout;
 
-        if (mem_info.good()) {
-            mem_info.ignore(ut::maxStreamSize, ':');
-            mem_info >> totalMem;
-            totalMem <<= 10;
+        //? Jobs queued on a previous pool will never run, start over with fresh ones
+        for (auto &[ignored, disk]: current_mem.disks) {
+            disk.statvfs_job.reset();
+            disk.stale = false;
         }
+    }
 
-        if (not mem_info.good() or totalMem == 0)
-            throw std::runtime_error("Could not get total memory size from /proc/meminfo");
+    DataCollector::StatvfsPool::StatvfsPool(size_t workers) : workers(workers) {
+        std::lock_guard lock(state->mutex);
+
+        state->target = workers;
 
-        return totalMem;
+        while (state->live < state->target) start();
     }
 
-    Data DataCollector::collect() {
-        auto totalMem = this->get_total_ram_amount();
-        auto &mem = current_mem;
+    DataCollector::StatvfsPool::~StatvfsPool() {
+        std::unique_lock lock(state->mutex);
 
-        mem.stats.at("swap_total") = 0;
+        state->stopping = true;
+        state->queue.clear();
+        state->queued.notify_all();
 
-        //? Read memory info from /proc/meminfo
-        std::ifstream meminfo(shared::proc_path / "meminfo");
-
-        if (meminfo.good()) {
-            bool got_avail = false;
-
-            for (string label; meminfo.peek() != 'D' and meminfo >> label;) {
-                if (label == "MemFree:") {
-                    meminfo >> mem.stats.at("free");
-                    mem.stats.at("free") <<= 10;
-                } else if (label == "MemAvailable:") {
-                    meminfo >> mem.stats.at("available");
-                    mem.stats.at("available") <<= 10;
-                    got_avail = true;
-                } else if (label == "Cached:") {
-                    meminfo >> mem.stats.at("cached");
-                    mem.stats.at("cached") <<= 10;
-                } else if (label == "SwapTotal:") {
-                    meminfo >> mem.stats.at("swap_total");
-                    mem.stats.at("swap_total") <<= 10;
-                } else if (label == "SwapFree:") {
-                    meminfo >> mem.stats.at("swap_free");
-                    mem.stats.at("swap_free") <<= 10;
-                    break;
+        const auto busy = state->busy;
+
+        lock.unlock();
+
+        //? Idle workers exit right away. One still inside statvfs64() can be stuck on a dead mount for good,
+        //? joining it would hang the owner of the collector instead, it exits on its own once the call returns
+        for (auto &thread: threads) {
+            if (rng::find(busy, thread.get_id()) == busy.end()) thread.join();
+            else thread.detach();
+        }
+    }
+
+    void DataCollector::StatvfsPool::start() {
+        state->live++;
+
+        threads.emplace_back([state = state]() {
+            std::unique_lock lock(state->mutex);
+
+            for (;;) {
+                state->queued.wait(lock, [&]() {
+                    return state->stopping or not state->queue.empty() or state->live > state->target;
+                });
+
+                if (state->stopping) return;
+
+                //? Spares started for hung jobs leave once they aren't needed any more
+                if (state->live > state->target) {
+                    state->live--;
+                    state->retired.push_back(std::this_thread::get_id());
+                    return;
                 }
 
-                meminfo.ignore(ut::maxStreamSize, '\n');
+                auto job = std::move(state->queue.front());
+                state->queue.pop_front();
+                state->busy.push_back(std::this_thread::get_id());
+
+                lock.unlock();
+
+                struct statvfs64 vfs{};
+                job->result = statvfs64(job->mountpoint.c_str(), &vfs);
+                job->error = errno;
+                job->blocks = vfs.f_blocks;
+                job->bavail = vfs.f_bavail;
+                job->frsize = vfs.f_frsize;
+
+                lock.lock();
+
+                std::erase(state->busy, std::this_thread::get_id());
+                job->pending.store(false);
+                state->finished.notify_all();
             }
-            if (not got_avail) mem.stats.at("available") = mem.stats.at("free") + mem.stats.at("cached");
-            mem.stats.at("used") = totalMem - (mem.stats.at("available") <= totalMem ? mem.stats.at("available")
-                                                                                     : mem.stats.at("free"));
+        });
+    }
 
-            if (mem.stats.at("swap_total") > 0)
-                mem.stats.at("swap_used") = mem.stats.at("swap_total") - mem.stats.at("swap_free");
-        } else {
-            throw std::runtime_error("Failed to read /proc/meminfo");
+    void DataCollector::StatvfsPool::reap() {
+        for (const auto id: state->retired) {
+            const auto it = rng::find(threads, id, &std::thread::get_id);
+
+            it->join();
+            threads.erase(it);
+        }
+
+        state->retired.clear();
+    }
+
+    void DataCollector::StatvfsPool::submit(const std::shared_ptr<StatvfsJob>& job) {
+        std::lock_guard lock(state->mutex);
+
+        state->queue.push_back(job);
+        state->queued.notify_one();
+    }
+
+    void DataCollector::StatvfsPool::set_hung(size_t hung) {
+        std::lock_guard lock(state->mutex);
+
+        reap();
+
+        state->target = workers + std::min(hung, max_spare_workers);
+
+        while (state->live < state->target) start();
+
+        //? Wake idle workers above the target so they retire
+        state->queued.notify_all();
+    }
+
+    void DataCollector::StatvfsPool::wait(
+        const vector<std::shared_ptr<StatvfsJob>>& jobs,
+        std::chrono::steady_clock::time_point deadline
+    ) {
+        std::unique_lock lock(state->mutex);
+
+        state->finished.wait_until(lock, deadline, [&]() {
+            return rng::none_of(jobs, [](const auto& job) { return job->pending.load(); });
+        });
+    }
+
+    bool DataCollector::mounts_changed() {
+        if (not mount_table_valid) return true;
+
+        //? A regular /etc/mtab can't be watched, fall back to parsing it every time
+        if (mtab_reader.is_open()) return true;
+
+        pollfd watch{mounts_reader.get_fd(), POLLPRI, 0};
+
+        return poll(&watch, 1, 0) != 0;
+    }
+
+    void DataCollector::update_fstab() {
+        std::error_code ec;
+        const auto write_time = fs::last_write_time("/etc/fstab", ec);
+
+        if (ec or write_time == fstab_time) return;
+
+        fstab_time = write_time;
+        fstab.clear();
+
+        //? Mountpoints listed in /etc/fstab are shown even if their filesystem type isn't a "real" one
+        std::ifstream fstab_read("/etc/fstab");
+
+        for (string instr; fstab_read >> instr;) {
+            if (not instr.starts_with('#')) {
+                fstab_read >> instr;
+
+                if (not ut::type::is_in(instr, "none", "swap")) fstab.insert(instr);
+            }
+
+            fstab_read.ignore(ut::maxStreamSize, '\n');
+        }
+    }
+
+    uint64_t DataCollector::parse_meminfo() {
+        string_view meminfo = meminfo_reader.read();
+
+        if (meminfo.empty()) throw std::runtime_error("Failed to read /proc/meminfo");
+
+        auto &info = current_mem.meminfo;
+
+        info.fill(0);
+
+        const uint64_t present = parse_meminfo_lines(meminfo, info);
+
+        if (info[MemInfoField::mem_total] == 0)
+            throw std::runtime_error("Could not get total memory size from /proc/meminfo");
+
+        return present;
+    }
+
+    uint64_t DataCollector::parse_cgroup_memory() {
+        parse_meminfo();
+
+        //? A group without limit, or with one above the host's memory, is bounded by the host
+        auto &info = current_mem.meminfo;
+        const uint64_t total = std::min(group->read_memory_max(), info[MemInfoField::mem_total]);
+        const uint64_t swap_total = std::min(group->read_swap_max(), info[MemInfoField::swap_total]);
+        const uint64_t current = std::min(group->read_memory_current(), total);
+        uint64_t present = 0;
+
+        info.fill(0);
+
+        auto set = [&](MemInfoField field, uint64_t value) {
+            info[field] = value;
+            present |= 1ull << static_cast<size_t>(field);
+        };
+
+        string_view stat = group->read_memory_stat();
+
+        while (not stat.empty()) {
+            string_view line = ut::str::next_line(stat);
+            const string_view key = line.substr(0, line.find(' '));
+            uint64_t value;
+
+            line.remove_prefix(key.size());
+
+            if (not ut::str::next_number(line, value)) continue;
+
+            for (const auto& [name, field] : cgroup_memory_fields) {
+                if (name == key) {
+                    set(field, value);
+                    break;
+                }
+            }
         }
 
-        meminfo.close();
+        set(MemInfoField::active, info[MemInfoField::active_anon] + info[MemInfoField::active_file]);
+        set(MemInfoField::inactive, info[MemInfoField::inactive_anon] + info[MemInfoField::inactive_file]);
+        set(MemInfoField::kreclaimable, info[MemInfoField::sreclaimable]);
+        set(MemInfoField::slab, info[MemInfoField::sreclaimable] + info[MemInfoField::sunreclaim]);
+        set(MemInfoField::mem_total, total);
+        set(MemInfoField::mem_free, total - current);
+
+        //? Like MemAvailable, inactive page cache and reclaimable slab are given back before the group hits its limit
+        set(MemInfoField::mem_available, std::min(total, total - current + info[MemInfoField::inactive_file] + info[MemInfoField::sreclaimable]));
+        set(MemInfoField::swap_total, swap_total);
+        set(MemInfoField::swap_free, swap_total - std::min(group->read_swap_current(), swap_total));
+
+        return present;
+    }
+
+    void DataCollector::update(std::chrono::steady_clock::time_point now) {
+        using ut::stats::CollectStage;
+
+        auto &mem = current_mem;
+        ut::stats::Scope scope(collect_stats);
+
+        //? Read memory info from /proc/meminfo
+        scope.next(CollectStage::meminfo);
+        const uint64_t present = group ? parse_cgroup_memory() : parse_meminfo();
+        const auto &info = mem.meminfo;
+        const uint64_t totalMem = info[MemInfoField::mem_total];
+
+        //? The limit of a cgroup can change while it runs
+        if (group) this->total_ram_amount = GenericMemUnit{totalMem};
+
+        mem.stats[MemField::free] = info[MemInfoField::mem_free];
+        mem.stats[MemField::cached] = info[MemInfoField::cached];
+        mem.stats[MemField::swap_total] = info[MemInfoField::swap_total];
+        mem.stats[MemField::swap_free] = info[MemInfoField::swap_free];
+
+        if (present & 1ull << static_cast<size_t>(MemInfoField::mem_available))
+            mem.stats[MemField::available] = info[MemInfoField::mem_available];
+        else
+            mem.stats[MemField::available] = mem.stats[MemField::free] + mem.stats[MemField::cached];
+
+        mem.stats[MemField::used] = totalMem - (mem.stats[MemField::available] <= totalMem ? mem.stats[MemField::available]
+                                                                                 : mem.stats[MemField::free]);
+
+        if (mem.stats[MemField::swap_total] > 0)
+            mem.stats[MemField::swap_used] = mem.stats[MemField::swap_total] - mem.stats[MemField::swap_free];
 
         //? Calculate percentages
         for (const auto &name: mem_names) {
-            mem.percent.at(name) = round((double) mem.stats.at(name) * 100 / totalMem);
+            mem.percent[name] = round((double) mem.stats[name] * 100 / totalMem);
         }
 
-        if (mem.stats.at("swap_total") > 0) {
+        if (mem.stats[MemField::swap_total] > 0) {
             for (const auto &name: swap_names) {
-                mem.percent.at(name) = round((double) mem.stats.at(name) * 100 / mem.stats.at("swap_total"));
+                mem.percent[name] = round((double) mem.stats[name] * 100 / mem.stats[MemField::swap_total]);
             }
 
             has_swap = true;
@@ -238,68 +746,67 @@ namespace mem {
         }
 
         //? Get disks stats
-        static vector<string> ignore_list;
-        double uptime = ut::system_uptime();
-        bool filter_exclude = false;
+        //? io_ticks only advance while the system runs, so the monotonic clock is the matching time base
+        const double elapsed = max(std::chrono::duration<double>(now - old_time).count(), 0.001);
         auto &disks = mem.disks;
-        std::ifstream diskread;
 
-        //? Get list of "real" filesystems from /proc/filesystems
-        vector<string> fstypes;
+        //? Only parse the mount table again when the kernel reports a change to it
+        scope.next(CollectStage::mounts);
+        const bool mounts_updated = mounts_changed();
 
-        diskread.open(shared::proc_path / "filesystems");
-        if (diskread.good()) {
-            for (string fstype; diskread >> fstype;) {
-                if (not ut::type::is_in(fstype, "nodev", "squashfs", "nullfs", "zfs", "wslfs", "drvfs"))
-                    fstypes.push_back(fstype);
-                diskread.ignore(ut::maxStreamSize, '\n');
-            }
-        }
-        else {
-            throw std::runtime_error("Failed to read /proc/filesystems");
-        }
+        if (mounts_updated) {
+            update_fstab();
 
-        diskread.close();
+            string_view table = mtab_reader.is_open() ? mtab_reader.read() : mounts_reader.read();
 
-        //? Get mounts from /etc/mtab or /proc/self/mounts
-        diskread.open((fs::exists("/etc/mtab") ? fs::path("/etc/mtab") : shared::proc_path / "self/mounts"));
+            if (table.empty()) throw std::runtime_error("Failed to get mounts from /etc/mtab and /proc/self/mounts");
 
-        if (diskread.good()) {
             vector<string> found;
             found.reserve(last_found.size());
-            string dev, mountpoint, fstype;
+            ut::str::string_set found_set;
 
-            while (not diskread.eof()) {
+            while (not table.empty()) {
                 std::error_code ec;
-                diskread >> dev >> mountpoint >> fstype;
-                diskread.ignore(ut::maxStreamSize, '\n');
+                string_view line = ut::str::next_line(table);
+                string_view fields[3];
+
+                for (auto& field : fields) {
+                    while (line.starts_with(' ')) line.remove_prefix(1);
+
+                    field = line.substr(0, line.find(' '));
+                    line.remove_prefix(field.size());
+                }
+
+                const auto& [dev, mountpoint, fstype] = fields;
 
-                if (ut::vec::contains(ignore_list, mountpoint) or ut::vec::contains(found, mountpoint)) continue;
+                if (mountpoint.empty() or ignore_list.contains(mountpoint) or found_set.contains(mountpoint)) continue;
 
-                if (ut::vec::contains(fstab, mountpoint) or ut::vec::contains(fstypes, fstype)) {
-                    found.push_back(mountpoint);
+                if (fstab.contains(mountpoint) or fstypes.contains(fstype)) {
+                    found.emplace_back(mountpoint);
+                    found_set.emplace(mountpoint);
 
                     //? Save mountpoint, name, fstype, dev path and path to /sys/block stat file
-                    if (not disks.contains(mountpoint)) {
-                        disks[mountpoint] = DiskInfo{fs::canonical(dev, ec),
-                                                     fs::path(mountpoint).filename(), fstype};
-                        if (disks.at(mountpoint).dev.empty()) disks.at(mountpoint).dev = dev;
-                        if (disks.at(mountpoint).name.empty())
-                            disks.at(mountpoint).name = (mountpoint == "/" ? "root" : mountpoint);
+                    if (not disks.contains(found.back())) {
+                        const string& mount = found.back();
+                        DiskInfo disk{fs::canonical(dev, ec), fs::path(mount).filename(), string{fstype}};
 
-                        string devname = disks.at(mountpoint).dev.filename();
+                        if (disk.dev.empty()) disk.dev = dev;
+                        if (disk.name.empty()) disk.name = (mount == "/" ? "root" : mount);
 
+                        auto& added = add_disk(mount, std::move(disk));
+
+                        string devname = added.dev.filename();
+                        const fs::path block = shared::sys_path / "block";
+
+                        //? Without sysfs there is no stat file, IO comes from /proc/diskstats or io.stat alone
                         int c = 0;
-                        while (devname.size() >= 2) {
-                            if (fs::exists("/sys/block/" + devname + "/stat", ec) and
-                                access(string("/sys/block/" + devname + "/stat").c_str(), R_OK) == 0) {
-                                if (c > 0 and fs::exists("/sys/block/" + devname + '/' +
-                                                         disks.at(mountpoint).dev.filename().string() +
-                                                         "/stat", ec))
-                                    disks.at(mountpoint).stat = "/sys/block/" + devname + '/' + disks.at(
-                                            mountpoint).dev.filename().string() + "/stat";
+                        while (not shared::sys_path.empty() and devname.size() >= 2) {
+                            if (fs::exists(block / devname / "stat", ec) and
+                                access((block / devname / "stat").c_str(), R_OK) == 0) {
+                                if (c > 0 and fs::exists(block / devname / added.dev.filename() / "stat", ec))
+                                    added.stat = block / devname / added.dev.filename() / "stat";
                                 else
-                                    disks.at(mountpoint).stat = "/sys/block/" + devname + "/stat";
+                                    added.stat = block / devname / "stat";
                                 break;
                                 //? Set ZFS stat filepath
                             }
@@ -307,143 +814,465 @@ namespace mem {
                             devname.resize(devname.size() - 1);
                             c++;
                         }
+
+                        if (not added.stat.empty()) {
+                            added.stat_reader = ut::file::CachedReader{added.stat, 256};
+                            added.devno = read_devno(added.stat, added.dev);
+
+                            //? The stat file of a partition sits in the directory of its disk
+                            added.disk_devno = fs::exists(added.stat.parent_path() / "partition", ec)
+                                    ? read_devno(added.stat.parent_path(), {}) : added.devno;
+                        }
                     }
                 }
             }
 
-            //? Remove disks no longer mounted or filtered out
-            if (has_swap) found.push_back("swap");
-
+            //? Remove disks no longer mounted or filtered out, swap is handled below
             for (auto it = disks.begin(); it != disks.end();) {
-                if (not ut::vec::contains(found, it->first))
+                if (it->first != "swap" and not found_set.contains(it->first)) {
+                    release_disk(it->second);
                     it = disks.erase(it);
+                }
                 else
                     it++;
             }
 
             last_found = std::move(found);
-        } else {
-            throw std::runtime_error("Failed to get mounts from /etc/mtab and /proc/self/mounts");
+            mount_table_valid = true;
+            index_disks();
         }
 
-        diskread.close();
+        if (not has_swap and disks.contains("swap")) {
+            release_disk(disks.at("swap"));
+            disks.erase("swap");
+        }
 
         //? Get disk/partition stats
-        bool new_ignored = false;
-        for (auto &[mountpoint, disk]: disks) {
-            if (std::error_code ec; not fs::exists(mountpoint, ec)
-                                    or ut::vec::contains(ignore_list, mountpoint)
-                    ) {
-                continue;
-            }
+        scope.next(CollectStage::statvfs);
 
-            struct statvfs64 vfs;
+        if (statvfs_pool) {
+            statvfs_batch.clear();
+            size_t hung = 0;
 
-            if (statvfs64(mountpoint.c_str(), &vfs) < 0) {
-                ignore_list.push_back(mountpoint);
+            for (auto &[mountpoint, disk]: disks) {
+                if (mountpoint == "swap" or ignore_list.contains(mountpoint)) continue;
 
-                new_ignored = true;
+                if (not disk.statvfs_job) {
+                    disk.statvfs_job = std::make_shared<StatvfsJob>();
+                    disk.statvfs_job->mountpoint = mountpoint;
+                }
 
-                continue;
+                //? A job still pending from an earlier collect is hung in the kernel, its disk is stale right away,
+                //? waiting for it again would hold every later collect for the full timeout
+                if (disk.statvfs_job->pending.load()) {
+                    hung++;
+                    continue;
+                }
+
+                disk.statvfs_job->pending.store(true);
+                statvfs_batch.push_back(disk.statvfs_job);
             }
 
-            disk.total = vfs.f_blocks * vfs.f_frsize;
-            disk.free = vfs.f_bavail * vfs.f_frsize;
-            disk.used = disk.total - disk.free;
-            disk.used_percent = round((double) disk.used * 100 / disk.total);
-            disk.free_percent = 100 - disk.used_percent;
+            //? Spares take over from the workers the hung jobs pin, so healthy mounts still get a worker
+            statvfs_pool->set_hung(hung);
 
+            for (const auto &job: statvfs_batch) statvfs_pool->submit(job);
 
-        }
+            statvfs_pool->wait(statvfs_batch, std::chrono::steady_clock::now() + statvfs_timeout);
 
-        //? Setup disks order in UI and add swap if enabled
-        mem.disks_order.clear();
+            for (auto &[mountpoint, disk]: disks) {
+                if (mountpoint == "swap" or ignore_list.contains(mountpoint) or not disk.statvfs_job) continue;
 
-        if (disks.contains("/")) mem.disks_order.push_back("/");
+                const auto& job = *disk.statvfs_job;
 
-        if (has_swap) {
-            mem.disks_order.push_back("swap");
+                disk.stale = job.pending.load();
+
+                if (not disk.stale)
+                    update_disk_usage(mountpoint, disk, job.result, job.error, job.blocks, job.bavail, job.frsize);
+            }
+        }
+        else {
+            for (auto &[mountpoint, disk]: disks) {
+                if (mountpoint == "swap" or ignore_list.contains(mountpoint)) continue;
 
-            if (not disks.contains("swap")) disks["swap"] = {"", "swap", "swap"};
+                struct statvfs64 vfs{};
+                const int result = statvfs64(mountpoint.c_str(), &vfs);
 
-            disks.at("swap").total = mem.stats.at("swap_total");
-            disks.at("swap").used = mem.stats.at("swap_used");
-            disks.at("swap").free = mem.stats.at("swap_free");
-            disks.at("swap").used_percent = mem.percent.at("swap_used");
-            disks.at("swap").free_percent = mem.percent.at("swap_free");
+                update_disk_usage(mountpoint, disk, result, errno, vfs.f_blocks, vfs.f_bavail, vfs.f_frsize);
+            }
         }
-        for (const auto &name: last_found)
 
-            if (not ut::type::is_in(name, "/", "swap")) mem.disks_order.push_back(name);
+        //? Add swap if enabled
+        if (has_swap) {
+            if (not disks.contains("swap")) add_disk("swap", {"", "swap", "swap"});
+
+            disks.at("swap").total = mem.stats[MemField::swap_total];
+            disks.at("swap").used = mem.stats[MemField::swap_used];
+            disks.at("swap").free = mem.stats[MemField::swap_free];
+            disks.at("swap").used_percent = mem.percent[MemField::swap_used];
+            disks.at("swap").free_percent = mem.percent[MemField::swap_free];
+        }
 
         //? Get disks IO
-        uint64_t sectors_read, sectors_write, io_ticks, io_ticks_temp;
+        scope.next(CollectStage::diskstats);
         disk_ios = 0;
+
+        for (auto &[ignored, disk]: disks) disk.io_updated = false;
+
+        if (io_backend == IoBackend::diskstats) read_diskstats(elapsed);
+        else if (io_backend == IoBackend::cgroup) read_cgroup_io(elapsed);
+
         for (auto &[ignored, disk]: disks) {
-            if (disk.stat.empty() or access(disk.stat.c_str(), R_OK) != 0) continue;
+            if (not disk.io_updated) disk.io_updated = update_disk_io(disk, disk.stat_reader.read(), elapsed);
+            if (disk.io_updated) disk_ios++;
+        }
+
+        scope.next(CollectStage::numa);
+        update_numa_nodes(elapsed);
+
+        old_time = now;
+    }
+
+    void DataCollector::find_numa_nodes() {
+        const fs::path node_path = shared::sys_path / "devices/system/node";
+        vector<int> nodes;
+        std::error_code ec;
+
+        for (const auto& d : fs::directory_iterator(node_path, ec)) {
+            const string dirname = d.path().filename();
+            string_view id = string_view{dirname};
+            int node;
+
+            if (not id.starts_with("node")) continue;
+
+            id.remove_prefix(4);
+
+            if (ut::str::next_number(id, node) and id.empty()) nodes.push_back(node);
+        }
+
+        rng::sort(nodes);
+
+        for (const int node : nodes) {
+            const fs::path dir = node_path / ("node" + std::to_string(node));
+            NodeFiles files{
+                ut::file::CachedReader{dir / "meminfo", 4096},
+                ut::file::CachedReader{dir / "vmstat", 8192},
+                ut::file::CachedReader{dir / "numastat", 512}
+            };
+            NodeMemory memory{.node = node};
+
+            //? Nodes without memory of their own, like cpu only nodes, have nothing to report
+            if (parse_meminfo_lines(files.meminfo.read(), memory.meminfo) == 0 or memory.meminfo[MemInfoField::mem_total] == 0) continue;
+
+            files.use_numastat = files.vmstat.read().find("\nnuma_hit ") == string_view::npos;
+
+            node_files.push_back(std::move(files));
+            current_mem.nodes.push_back(memory);
+        }
+
+        //? The first read only sets the counters for the rates of the next one
+        update_numa_nodes(1);
+
+        for (auto& node : current_mem.nodes) node.numa_rates = {};
+    }
+
+    void DataCollector::update_numa_nodes(double elapsed) {
+        constexpr auto numa_fields = static_cast<size_t>(NumaField::count);
+
+        for (size_t i = 0; i < node_files.size(); i++) {
+            auto& files = node_files[i];
+            auto& node = current_mem.nodes[i];
+            auto& info = node.meminfo;
 
-            diskread.open(disk.stat);
+            info.fill(0);
+            parse_meminfo_lines(files.meminfo.read(), info);
 
-            disk_ios++;
+            //? Like the cgroup estimate, inactive page cache and reclaimable slab are what the node can give back
+            node.total = info[MemInfoField::mem_total];
+            node.free = std::min(info[MemInfoField::mem_free], node.total);
+            node.available = std::min(node.total, node.free + info[MemInfoField::inactive_file] + info[MemInfoField::sreclaimable]);
+            node.used = node.total - node.available;
+            node.used_percent = node.total == 0 ? 0 : (long long) round((double) node.used * 100 / (double) node.total);
+            node.available_percent = node.total == 0 ? 0 : (long long) round((double) node.available * 100 / (double) node.total);
 
-            for (int i = 0; i < 2; i++) {
-                diskread >> std::ws;
-                diskread.ignore(ut::maxStreamSize, ' ');
+            const auto& names = files.use_numastat ? numastat_field_names : numa_field_names;
+            string_view stat = files.use_numastat ? files.numastat.read() : files.vmstat.read();
+            size_t found = 0;
+
+            //? The numa counters are near the top of vmstat, stop once all of them were read
+            while (found < numa_fields and not stat.empty()) {
+                string_view line = ut::str::next_line(stat);
+                const string_view label = line.substr(0, line.find(' '));
+                const auto field = (size_t) (rng::find(names, label) - names.begin());
+                uint64_t value;
+
+                line.remove_prefix(label.size());
+
+                if (field == numa_fields or not ut::str::next_number(line, value)) continue;
+
+                const NumaField numa_field{field};
+
+                node.numa_rates[numa_field] = (uint64_t) round((double) advance(value, files.old_numa[numa_field]) / elapsed);
+                found++;
             }
-            diskread >> sectors_read;
+        }
+    }
+
+    bool DataCollector::update_disk_io(DiskInfo& disk, string_view stat, double elapsed) {
+        //? Fields: 0=reads, 1=reads merged, 2=sectors read, 3=ms reading, 4=writes, 5=writes merged,
+        //? 6=sectors written, 7=ms writing, 8=ios in progress, 9=ms doing io, 10=weighted ms doing io
+        array<uint64_t, 11> fields{};
+        size_t count = 0;
+
+        while (count < fields.size() and ut::str::next_number(stat, fields[count])) count++;
+
+        if (count < 10) return false;
+
+        auto& old = disk.old_io;
+
+        disk.io_read = (long long) advance(fields[2], old[0]) * 512;
+        disk.io_write = (long long) advance(fields[6], old[1]) * 512;
+        disk.io_activity = clamp((long long) round((double) advance(fields[9], old[2]) / elapsed / 10), 0ll, 100ll);
+        disk.iops = (long long) round((double) advance(fields[0] + fields[4], old[3]) / elapsed);
+        disk.io_in_flight = (long long) fields[8];
+        disk.io_weighted = (long long) round((double) advance(fields[10], old[4]) / elapsed);
 
-            disk.io_read = max((uint64_t) 0, (sectors_read - disk.old_io.at(0)) * 512);
-            disk.old_io.at(0) = sectors_read;
+        return true;
+    }
+
+    uint64_t DataCollector::read_devno(const fs::path& stat, const fs::path& dev) {
+        //? The dev file next to the stat file holds "major:minor", the device node is the fallback
+        ut::file::CachedReader reader{stat.parent_path() / "dev", 64};
+        string_view str = reader.read();
+        unsigned int major, minor;
+
+        if (ut::str::next_number(str, major) and str.starts_with(':')) {
+            str.remove_prefix(1);
+
+            if (ut::str::next_number(str, minor)) return makedev(major, minor);
+        }
 
-            for (int i = 0; i < 3; i++) {
-                diskread >> std::ws;
-                diskread.ignore(ut::maxStreamSize, ' ');
+        struct stat st{};
+
+        if (::stat(dev.c_str(), &st) == 0 and S_ISBLK(st.st_mode)) return st.st_rdev;
+
+        return 0;
+    }
+
+    void DataCollector::index_disks() {
+        disks_by_devno.clear();
+        disks_by_disk_devno.clear();
+
+        for (auto &[ignored, disk]: current_mem.disks) {
+            if (disk.devno != 0) disks_by_devno.emplace(disk.devno, &disk);
+            if (disk.disk_devno != 0) disks_by_disk_devno.emplace(disk.disk_devno, &disk);
+        }
+    }
+
+    void DataCollector::read_diskstats(double elapsed) {
+        string_view diskstats = diskstats_reader.read();
+
+        //? Rows are "major minor name" followed by the same fields as a /sys/block stat file
+        while (not diskstats.empty()) {
+            string_view line = ut::str::next_line(diskstats);
+            unsigned int major, minor;
+
+            if (not ut::str::next_number(line, major) or not ut::str::next_number(line, minor)) continue;
+
+            const auto it = disks_by_devno.find(makedev(major, minor));
+
+            if (it == disks_by_devno.end()) continue;
+
+            while (line.starts_with(' ')) line.remove_prefix(1);
+            line.remove_prefix(std::min(line.find(' '), line.size()));
+
+            it->second->io_updated = update_disk_io(*it->second, line, elapsed);
+        }
+    }
+
+    void DataCollector::read_cgroup_io(double elapsed) {
+        //? Disks without a row had no IO from the group, the sysfs fallback would report the host's
+        for (auto &[ignored, disk]: current_mem.disks) {
+            disk.io_read = disk.io_write = disk.io_activity = disk.iops = disk.io_in_flight = disk.io_weighted = 0;
+            disk.io_updated = not disk.stat.empty();
+        }
+
+        //? Every partition of a disk gets the IO the group did on the whole disk
+        for (const auto& row : group->read_io_stat()) {
+            const auto [first, last] = disks_by_disk_devno.equal_range(row.devno);
+
+            for (auto it = first; it != last; it++) {
+                auto& disk = *it->second;
+                auto& old = disk.old_io;
+
+                disk.io_read = (long long) advance(row.rbytes, old[0]);
+                disk.io_write = (long long) advance(row.wbytes, old[1]);
+                disk.iops = (long long) round((double) advance(row.rios + row.wios, old[3]) / elapsed);
             }
+        }
+    }
+
+    void DataCollector::set_io_backend(IoBackend backend) {
+        if (backend == IoBackend::diskstats and not diskstats_reader.open())
+            throw std::runtime_error("Failed to open " + diskstats_reader.get_path().string());
+
+        if (backend == IoBackend::cgroup and not group)
+            throw std::runtime_error("IoBackend::cgroup needs a DataCollector for a cgroup");
+
+        //? io.stat counts bytes where the block layer counts sectors, start the counters over when switching between them
+        if ((backend == IoBackend::cgroup) != (io_backend == IoBackend::cgroup)) {
+            for (auto &[ignored, disk]: current_mem.disks) disk.old_io = {};
+        }
+
+        io_backend = backend;
+    }
+
+    const IoBackend& DataCollector::get_io_backend() const {
+        return io_backend;
+    }
+
+    const ut::stats::CollectStats& DataCollector::get_collect_stats() const {
+        return collect_stats;
+    }
+
+    const cgroup::Group* DataCollector::get_cgroup() const {
+        return group.get();
+    }
+
+    Data DataCollector::collect() {
+        return collect(std::chrono::steady_clock::now());
+    }
+
+    Data DataCollector::collect(std::chrono::steady_clock::time_point now) {
+        Data data;
+        data.disks.reserve(current_mem.disks.size() + 1);
+        collect_into(data, now);
+
+        return data;
+    }
+
+    void DataCollector::collect_into(Data& out) {
+        collect_into(out, std::chrono::steady_clock::now());
+    }
+
+    void DataCollector::collect_into(Data& out, std::chrono::steady_clock::time_point now) {
+        update(now);
 
-            diskread >> sectors_write;
+        auto &mem = current_mem;
+
+        out.total_ram_amount = this->total_ram_amount;
+        out.available_ram_amount = RamUnit{mem.stats[MemField::available], mem.percent[MemField::available]};
+        out.cached_ram_amount = RamUnit{mem.stats[MemField::cached], mem.percent[MemField::cached]};
+        out.free_ram_amount = RamUnit{mem.stats[MemField::free], mem.percent[MemField::free]};
+        out.used_ram_amount = RamUnit{mem.stats[MemField::used], mem.percent[MemField::used]};
+        out.meminfo = mem.meminfo;
+        out.numa_nodes = mem.nodes;
+
+        //? clear() keeps the capacity and the names are shared with the collector, refilling allocates nothing
+        out.disks.clear();
+
+        for (const auto &[ignored, disk]: mem.disks) {
+            out.disks.emplace_back(
+                GenericMemUnit{disk.total},
+                GenericMemUnit{disk.used},
+                GenericMemUnit{disk.free},
+                disk.used_percent,
+                disk.free_percent,
+                disk.identity,
+                disk.io_read,
+                disk.io_write,
+                disk.io_activity,
+                disk.stale,
+                disk.iops,
+                disk.io_in_flight,
+                disk.io_weighted
+            );
+        }
+    }
+
+    const DataDelta& DataCollector::collect_delta() {
+        return collect_delta(std::chrono::steady_clock::now());
+    }
 
-            disk.io_write = max((uint64_t) 0, (sectors_write - disk.old_io.at(1)) * 512);
-            disk.old_io.at(1) = sectors_write;
+    const DataDelta& DataCollector::collect_delta(std::chrono::steady_clock::time_point now) {
+        update(now);
 
-            for (int i = 0; i < 2; i++) {
-                diskread >> std::ws;
-                diskread.ignore(ut::maxStreamSize, ' ');
+        auto &mem = current_mem;
+        auto &delta = current_delta;
+
+        delta.total_ram_amount = this->total_ram_amount;
+        delta.available_ram_amount = RamUnit{mem.stats[MemField::available], mem.percent[MemField::available]};
+        delta.cached_ram_amount = RamUnit{mem.stats[MemField::cached], mem.percent[MemField::cached]};
+        delta.free_ram_amount = RamUnit{mem.stats[MemField::free], mem.percent[MemField::free]};
+        delta.used_ram_amount = RamUnit{mem.stats[MemField::used], mem.percent[MemField::used]};
+        delta.meminfo = mem.meminfo;
+
+        delta.changed_disks.clear();
+        delta.added_disks.clear();
+        //? Removals pile up over collect() calls in between, they are only done once a delta reported them
+        delta.removed_disks.assign(removed_disks.begin(), removed_disks.end());
+        removed_disks.clear();
+
+        for (auto &[ignored, disk]: mem.disks) {
+            const DiskUpdate update {
+                disk.id,
+                disk.total,
+                disk.used,
+                disk.free,
+                disk.used_percent,
+                disk.free_percent,
+                disk.io_read,
+                disk.io_write,
+                disk.io_activity,
+                disk.stale,
+                disk.iops,
+                disk.io_in_flight,
+                disk.io_weighted
+            };
+
+            if (not disk.reported) {
+                delta.added_disks.push_back(disk.id);
+            }
+            else if (update == disk.last_update) {
+                continue;
             }
-            diskread >> io_ticks;
-            disk.io_activity = clamp((long) round(
-                                             (double) (io_ticks - disk.old_io.at(2)) / (uptime - old_uptime) / 10), 0l,
-                                     100l);
-            disk.old_io.at(2) = io_ticks;
 
-            diskread.close();
+            disk.last_update = update;
+            disk.reported = true;
+            delta.changed_disks.push_back(update);
+        }
+
+        return delta;
+    }
+
+    const DiskIdentity& DataCollector::get_disk_identity(const DiskId& id) const {
+        return *disk_identities.at(id);
+    }
+
+    DataCollector::DiskInfo& DataCollector::add_disk(const string& mountpoint, DiskInfo&& disk) {
+        //? Immutable once created, every Data the disk is reported in shares it
+        auto identity = std::make_shared<const DiskIdentity>(DiskIdentity{mountpoint, disk.name, disk.fstype, disk.dev});
+
+        disk.identity = identity;
+
+        //? Reuse the slot of a disk that is no longer mounted before growing the table
+        if (not free_disk_ids.empty()) {
+            disk.id = free_disk_ids.back();
+            free_disk_ids.pop_back();
+            disk_identities.at(disk.id) = std::move(identity);
         }
-        old_uptime = uptime;
-
-        vector<StorageUnit> dsk;
-
-        for(auto& d: mem.disks) {
-            dsk.push_back(StorageUnit {
-                GenericMemUnit{d.second.total},
-                GenericMemUnit{d.second.used},
-                GenericMemUnit{d.second.free},
-                d.second.used_percent,
-                d.second.free_percent,
-                d.second.name,
-                d.second.fstype,
-                d.second.io_read,
-                d.second.io_write,
-                d.second.io_activity,
-                d.second.dev
-            });
+        else {
+            disk.id = disk_identities.size();
+            disk_identities.push_back(std::move(identity));
         }
 
-        return Data {
-            this->total_ram_amount,
-            RamUnit{mem.stats.at("available"), mem.percent.at("available")},
-            RamUnit{mem.stats.at("cached"), mem.percent.at("cached")},
-            RamUnit{mem.stats.at("free"), mem.percent.at("free")},
-            RamUnit{mem.stats.at("used"), mem.percent.at("used")},
-            dsk
-        };
+        return current_mem.disks[mountpoint] = std::move(disk);
+    }
+
+    void DataCollector::release_disk(const DiskInfo& disk) {
+        //? A disk that came and went between two deltas was never reported, there is nothing to take back
+        if (disk.reported) removed_disks.push_back(disk.id);
+
+        free_disk_ids.push_back(disk.id);
     }
 }
\ No newline at end of file
@@ -0,0 +1,304 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <bit>
+#include <cmath>
+#include "../include/net.hpp"
+
+namespace {
+    //* Column of every NetField
+    constexpr ut::type::enum_array<net::NetField, size_t> netdev_column {{0, 1, 2, 3, 8, 9, 10, 11}};
+
+    size_t hash_name(string_view name) {
+        uint64_t hash = 14695981039346656037ull;
+
+        for (const char c : name) hash = (hash ^ (unsigned char) c) * 1099511628211ull;
+
+        return hash ^ (hash >> 32);
+    }
+
+    //? Counters restart from 0 when an interface is recreated under the same name, report 0 for that interval
+    uint64_t advance(uint64_t value, uint64_t& previous) {
+        const uint64_t diff = value >= previous ? value - previous : 0;
+        previous = value;
+        return diff;
+    }
+}
+
+namespace net {
+    InterfaceUnit::InterfaceUnit(
+        const InterfaceId& id,
+        string name,
+        const ut::type::enum_array<NetField, uint64_t>& totals,
+        const ut::type::enum_array<NetField, uint64_t>& rates
+    ) : id(id), name(std::move(name)), totals(totals), rates(rates) {}
+
+    const InterfaceId& InterfaceUnit::get_id() const {
+        return id;
+    }
+
+    const string& InterfaceUnit::get_name() const {
+        return name;
+    }
+
+    const uint64_t& InterfaceUnit::get_total(NetField field) const {
+        return totals[field];
+    }
+
+    const uint64_t& InterfaceUnit::get_rate(NetField field) const {
+        return rates[field];
+    }
+
+    Data::Data() = default;
+
+    Data::Data(vector<InterfaceUnit> interfaces) : interfaces(std::move(interfaces)) {}
+
+    const vector<InterfaceUnit>& Data::get_interfaces() const {
+        return interfaces;
+    }
+
+    const InterfaceUnit* Data::find_interface(string_view name) const {
+        const auto it = rng::find(interfaces, name, &InterfaceUnit::get_name);
+
+        return it == interfaces.end() ? nullptr : &*it;
+    }
+
+    uint64_t Data::get_rate_sum(NetField field, bool include_loopback) const {
+        uint64_t sum = 0;
+
+        for (const auto& interface : interfaces)
+            if (include_loopback or interface.get_name() != "lo") sum += interface.get_rate(field);
+
+        return sum;
+    }
+
+    string_view DataCollector::InterfaceInfo::get_name() const {
+        return {name.data(), name_length};
+    }
+
+    DataCollector::DataCollector(size_t capacity) {
+        shared::init();
+
+        dev_reader = ut::file::CachedReader{shared::proc_path / "net/dev", 16384};
+
+        if (not dev_reader.open()) throw std::runtime_error("Failed to open " + dev_reader.get_path().string());
+
+        reserve(std::max(capacity, (size_t) 1));
+        pending.reserve(interfaces.size());
+
+        //? The first read only sets the counters for the rates of the next one
+        old_time = std::chrono::steady_clock::now();
+        update(old_time);
+    }
+
+    Data DataCollector::collect() {
+        return collect(std::chrono::steady_clock::now());
+    }
+
+    Data DataCollector::collect(std::chrono::steady_clock::time_point now) {
+        Data data;
+        data.interfaces.reserve(order.size());
+        collect_into(data, now);
+
+        return data;
+    }
+
+    void DataCollector::collect_into(Data& out) {
+        collect_into(out, std::chrono::steady_clock::now());
+    }
+
+    void DataCollector::collect_into(Data& out, std::chrono::steady_clock::time_point now) {
+        update(now);
+
+        out.interfaces.clear();
+
+        for (const InterfaceId id : order) {
+            const auto& info = interfaces[id];
+
+            out.interfaces.emplace_back(id, string(info.get_name()), info.old, info.rates);
+        }
+    }
+
+    size_t DataCollector::get_capacity() const {
+        return interfaces.size();
+    }
+
+    const ut::stats::CollectStats& DataCollector::get_collect_stats() const {
+        return collect_stats;
+    }
+
+    void DataCollector::update(std::chrono::steady_clock::time_point now) {
+        ut::stats::Scope scope(collect_stats);
+        scope.next(ut::stats::CollectStage::netdev);
+
+        string_view dev = dev_reader.read();
+
+        if (dev.empty()) throw std::runtime_error("Failed to read " + dev_reader.get_path().string());
+
+        //? Byte and packet counters only advance while the system runs, the monotonic clock is the matching time base
+        const double elapsed = std::max(std::chrono::duration<double>(now - old_time).count(), 0.001);
+        const size_t previous_count = order.size();
+
+        ticks++;
+        order.clear();
+        pending.clear();
+
+        //? Two header lines, then "<name>: <receive counters> <transmit counters>" per interface
+        ut::str::next_line(dev);
+        ut::str::next_line(dev);
+
+        while (not dev.empty()) {
+            string_view line = ut::str::next_line(dev);
+            const size_t colon = line.find(':');
+
+            if (colon == string_view::npos) continue;
+
+            string_view name = line.substr(0, colon);
+
+            while (name.starts_with(' ')) name.remove_prefix(1);
+
+            if (name.empty() or name.size() > max_name_length) continue;
+
+            line.remove_prefix(colon + 1);
+
+            array<uint64_t, DataCollector::netdev_columns> columns{};
+            size_t count = 0;
+
+            while (count < columns.size() and ut::str::next_number(line, columns[count])) count++;
+
+            if (count < columns.size()) continue;
+
+            const uint32_t id = index[locate(name)];
+
+            //? New interfaces wait until the ones that are gone gave their slots back
+            if (id == empty_slot) {
+                pending.push_back({name, columns, order.size()});
+                order.push_back(empty_slot);
+                continue;
+            }
+
+            auto& info = interfaces[id];
+
+            if (info.seen == ticks) continue;
+
+            info.seen = ticks;
+
+            for (size_t i = 0; i < static_cast<size_t>(NetField::count); i++) {
+                const auto field = static_cast<NetField>(i);
+                const uint64_t diff = advance(columns[netdev_column[field]], info.old[field]);
+
+                info.rates[field] = (uint64_t) std::round((double) diff / elapsed);
+            }
+
+            order.push_back(id);
+        }
+
+        //? An interface is gone when fewer of the known ones were listed than before
+        if (order.size() - pending.size() < previous_count) {
+            for (InterfaceId id = 0; id < interfaces.size(); id++)
+                if (interfaces[id].present and interfaces[id].seen != ticks) release(id);
+        }
+
+        //? Grow once up front, add() must not reallocate the table while the new interfaces are walked
+        if (const size_t present = interfaces.size() - free_ids.size() + pending.size(); present > interfaces.size())
+            reserve(std::max(present, interfaces.size() * 2));
+
+        //? The first read of an interface only sets its counters for the rates of the next one
+        for (const auto& [name, columns, position] : pending) {
+            if (index[locate(name)] != empty_slot) continue; // listed twice
+
+            const InterfaceId id = add(name);
+            auto& info = interfaces[id];
+
+            info.seen = ticks;
+
+            for (size_t i = 0; i < static_cast<size_t>(NetField::count); i++)
+                info.old[static_cast<NetField>(i)] = columns[netdev_column[static_cast<NetField>(i)]];
+
+            order[position] = id;
+        }
+
+        if (not pending.empty()) std::erase(order, empty_slot);
+
+        old_time = now;
+    }
+
+    size_t DataCollector::locate(string_view name) const {
+        size_t i = hash_name(name) & index_mask;
+
+        while (index[i] != empty_slot and interfaces[index[i]].get_name() != name) i = (i + 1) & index_mask;
+
+        return i;
+    }
+
+    InterfaceId DataCollector::add(string_view name) {
+        size_t slot = locate(name);
+
+        if (free_ids.empty()) {
+            reserve(interfaces.size() * 2);
+            slot = locate(name);
+        }
+
+        const InterfaceId id = free_ids.back();
+        auto& info = interfaces[id];
+
+        free_ids.pop_back();
+        info = InterfaceInfo{};
+        rng::copy(name, info.name.begin());
+        info.name_length = name.size();
+        info.present = true;
+        index[slot] = id;
+
+        return id;
+    }
+
+    void DataCollector::release(InterfaceId id) {
+        size_t i = locate(interfaces[id].get_name());
+
+        index[i] = empty_slot;
+        interfaces[id].present = false;
+        free_ids.push_back(id);
+
+        //? Move back every following entry whose probe sequence runs through the freed slot, so lookups never stop early
+        for (size_t j = (i + 1) & index_mask; index[j] != empty_slot; j = (j + 1) & index_mask) {
+            const size_t home = hash_name(interfaces[index[j]].get_name()) & index_mask;
+
+            if (((j - home) & index_mask) < ((j - i) & index_mask)) continue;
+
+            index[i] = index[j];
+            index[j] = empty_slot;
+            i = j;
+        }
+    }
+
+    void DataCollector::reserve(size_t capacity) {
+        const size_t previous = interfaces.size();
+
+        //? Ids are handed out from the back of free_ids, lowest first
+        interfaces.resize(capacity);
+        free_ids.reserve(capacity);
+        order.reserve(capacity);
+
+        for (size_t id = capacity; id > previous; id--) free_ids.push_back(id - 1);
+
+        //? At most half full, so probe sequences stay short
+        index.assign(std::bit_ceil(capacity * 2), empty_slot);
+        index_mask = index.size() - 1;
+
+        for (InterfaceId id = 0; id < previous; id++)
+            if (interfaces[id].present) index[locate(interfaces[id].get_name())] = id;
+    }
+}
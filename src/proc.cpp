@@ -0,0 +1,349 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "../include/proc.hpp"
+
+namespace proc {
+    namespace {
+        //* Layout of the records getdents64() fills the buffer with
+        struct linux_dirent64 {
+            ino64_t d_ino;
+            off64_t d_off;
+            unsigned short d_reclen;
+            unsigned char d_type;
+            char d_name[];
+        };
+
+        size_t hash(pid_t pid) {
+            return static_cast<size_t>((static_cast<uint64_t>(pid) * 0x9E3779B97F4A7C15ull) >> 32);
+        }
+
+        //* Read <pid>/<file> relative to the open /proc directory into <buf>, 0 on failure
+        size_t read_pid_file(int proc_fd, pid_t pid, const char* file, char* buf, size_t size) {
+            char path[32];
+            auto [end, ec] = std::to_chars(path, path + 16, pid);
+
+            *end++ = '/';
+            std::strcpy(end, file);
+
+            const int fd = openat(proc_fd, path, O_RDONLY | O_CLOEXEC);
+
+            if (fd < 0) return 0;
+
+            ut::stats::count_open();
+
+            ssize_t bytes;
+
+            do bytes = pread(fd, buf, size, 0); while (bytes < 0 and errno == EINTR);
+
+            ::close(fd);
+            ut::stats::count_read(bytes);
+
+            return bytes > 0 ? static_cast<size_t>(bytes) : 0;
+        }
+    }
+
+    Data::Data() = default;
+
+    Data::Data(vector<Process> processes, const size_t& process_count) :
+    processes(std::move(processes)),
+    process_count(process_count) {}
+
+    const vector<Process>& Data::get_processes() const {
+        return processes;
+    }
+
+    const size_t& Data::get_process_count() const {
+        return process_count;
+    }
+
+    DataCollector::DataCollector() {
+        shared::init();
+
+        proc_fd = ::open(shared::proc_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (proc_fd < 0) throw std::runtime_error("Failed to open " + shared::proc_path.string());
+
+        dirents.resize(32768);
+        rehash(1024);
+    }
+
+    DataCollector::~DataCollector() {
+        if (proc_fd >= 0) ::close(proc_fd);
+    }
+
+    void DataCollector::set_top(size_t count, SortField field) {
+        top_count = count;
+        sort_field = field;
+    }
+
+    void DataCollector::list_pids() {
+        pids.clear();
+
+        //? getdents64() continues where the last call stopped, so every scan starts over from the beginning
+        if (lseek(proc_fd, 0, SEEK_SET) < 0) throw std::runtime_error("Failed to rewind " + shared::proc_path.string());
+
+        for (;;) {
+            const long bytes = syscall(SYS_getdents64, proc_fd, dirents.data(), dirents.size());
+
+            if (bytes < 0 and errno == EINTR) continue;
+            if (bytes < 0) throw std::runtime_error("Failed to list " + shared::proc_path.string());
+            if (bytes == 0) break;
+
+            for (long offset = 0; offset < bytes;) {
+                const auto* entry = reinterpret_cast<const linux_dirent64*>(dirents.data() + offset);
+                offset += entry->d_reclen;
+
+                //? Process directories are the entries named by nothing but digits
+                const char* name = entry->d_name;
+                const size_t length = std::strlen(name);
+                pid_t pid;
+
+                if (auto [ptr, ec] = std::from_chars(name, name + length, pid);
+                    ec == std::errc{} and ptr == name + length and pid > 0)
+                    pids.push_back(pid);
+            }
+        }
+    }
+
+    DataCollector::Slot& DataCollector::find_slot(pid_t pid) {
+        const size_t mask = table.size() - 1;
+        Slot* tombstone = nullptr;
+
+        for (size_t i = hash(pid) & mask;; i = (i + 1) & mask) {
+            Slot& slot = table[i];
+
+            if (slot.pid == pid) return slot;
+
+            if (slot.pid == -1) {
+                if (tombstone == nullptr) tombstone = &slot;
+                continue;
+            }
+
+            if (slot.pid == 0) {
+                //? Not in the table, take the first tombstone passed on the way or this empty slot
+                Slot& target = tombstone != nullptr ? *tombstone : slot;
+
+                if (tombstone == nullptr) used++;
+
+                target = Slot{pid};
+                live++;
+
+                return target;
+            }
+        }
+    }
+
+    void DataCollector::rehash(size_t capacity) {
+        vector<Slot> old = std::exchange(table, vector<Slot>(capacity));
+
+        used = 0;
+        live = 0;
+
+        for (const auto& slot : old) {
+            if (slot.pid > 0) find_slot(slot.pid) = slot;
+        }
+    }
+
+    void DataCollector::sweep() {
+        for (auto& slot : table) {
+            if (slot.pid > 0 and slot.generation != generation) {
+                slot.pid = -1;
+                live--;
+            }
+        }
+    }
+
+    void DataCollector::update_users() {
+        if (shared::passwd_path.empty()) return;
+
+        std::error_code ec;
+        const auto time = fs::last_write_time(shared::passwd_path, ec);
+
+        if (ec or time == passwd_time) return;
+
+        passwd_time = time;
+        users.clear();
+
+        //? name:password:uid:gid:gecos:home:shell
+        std::ifstream file(shared::passwd_path);
+
+        for (string line; getline(file, line);) {
+            const size_t name_end = line.find(':');
+
+            if (name_end == string::npos) continue;
+
+            const size_t uid_start = line.find(':', name_end + 1);
+
+            if (uid_start == string::npos) continue;
+
+            uid_t uid;
+
+            if (auto [ptr, ec] = std::from_chars(line.data() + uid_start + 1, line.data() + line.size(), uid);
+                ec == std::errc{})
+                users.emplace(uid, line.substr(0, name_end));
+        }
+    }
+
+    string DataCollector::get_user(uid_t uid) const {
+        if (const auto it = users.find(uid); it != users.end()) return it->second;
+
+        return std::to_string(uid);
+    }
+
+    bool DataCollector::read_process(pid_t pid, Slot& slot, double elapsed_ticks) {
+        char buf[2048];
+        const size_t size = read_pid_file(proc_fd, pid, "stat", buf, sizeof(buf));
+
+        if (size == 0) return false;
+
+        //? The name is in parentheses and may contain anything, including more parentheses and blanks
+        const string_view stat{buf, size};
+        const size_t name_start = stat.find('(');
+        const size_t name_end = stat.rfind(')');
+
+        if (name_start == string_view::npos or name_end == string_view::npos or name_end < name_start
+            or name_end + 2 >= stat.size())
+            return false;
+
+        //? Fields after the name, counted from the state: 1=ppid, 11=utime, 12=stime, 17=num_threads, 19=starttime
+        string_view fields = stat.substr(name_end + 2);
+        const char state = fields.front();
+        array<long long, 20> values{};
+
+        fields.remove_prefix(1);
+
+        for (size_t i = 1; i < values.size(); i++) {
+            if (not ut::str::next_number(fields, values[i])) return false;
+        }
+
+        const auto cpu_time = static_cast<uint64_t>(values[11] + values[12]);
+        const auto start_time = static_cast<uint64_t>(values[19]);
+
+        //? A new pid or one reused by another process has no baseline yet
+        if (slot.generation == 0 or slot.start_time != start_time or elapsed_ticks <= 0 or cpu_time < slot.cpu_time)
+            slot.cpu_percent = 0;
+        else
+            slot.cpu_percent = (double) (cpu_time - slot.cpu_time) * 100 / elapsed_ticks;
+
+        slot.start_time = start_time;
+        slot.cpu_time = cpu_time;
+        slot.ppid = static_cast<pid_t>(values[1]);
+        slot.threads = static_cast<long>(values[17]);
+        slot.state = state;
+
+        const size_t name_size = std::min(name_end - name_start - 1, slot.name.size() - 1);
+        std::memcpy(slot.name.data(), buf + name_start + 1, name_size);
+        slot.name[name_size] = '\0';
+
+        //? statm: size resident shared text lib data dt, in pages
+        string_view statm{buf, read_pid_file(proc_fd, pid, "statm", buf, sizeof(buf))};
+        uint64_t pages, resident = 0, shared = 0;
+
+        if (ut::str::next_number(statm, pages) and ut::str::next_number(statm, resident))
+            ut::str::next_number(statm, shared);
+
+        slot.mem_bytes = resident * shared::page_size;
+        slot.shared_bytes = shared * shared::page_size;
+
+        return true;
+    }
+
+    Data DataCollector::collect() {
+        return collect(std::chrono::steady_clock::now());
+    }
+
+    Data DataCollector::collect(std::chrono::steady_clock::time_point now) {
+        update_users();
+
+        const double elapsed_ticks = old_time == std::chrono::steady_clock::time_point{} ? 0.0
+                : std::chrono::duration<double>(now - old_time).count() * shared::clk_tck;
+
+        old_time = now;
+        generation++;
+
+        list_pids();
+
+        //? Grow or clean out tombstones up front, so no slot moves while the scan holds indexes to them
+        if ((used + pids.size()) * 2 > table.size()) {
+            size_t capacity = 1024;
+
+            while (capacity < (live + pids.size()) * 2) capacity *= 2;
+
+            rehash(capacity);
+        }
+
+        candidates.clear();
+
+        for (const pid_t& pid : pids) {
+            Slot& slot = find_slot(pid);
+
+            if (not read_process(pid, slot, elapsed_ticks)) continue;
+
+            slot.generation = generation;
+            candidates.push_back(static_cast<uint32_t>(&slot - table.data()));
+        }
+
+        //? Pids that vanished before their stat was read still have an old generation and go here too
+        sweep();
+
+        //? Only the top entries are ordered, the rest of the scan stays unsorted
+        const size_t count = std::min(top_count, candidates.size());
+
+        auto compare = [&](uint32_t a, uint32_t b) {
+            const Slot& lhs = table[a];
+            const Slot& rhs = table[b];
+
+            switch (sort_field) {
+                case SortField::cpu:
+                    if (lhs.cpu_percent != rhs.cpu_percent) return lhs.cpu_percent > rhs.cpu_percent;
+                    return lhs.mem_bytes > rhs.mem_bytes;
+                case SortField::memory:
+                    if (lhs.mem_bytes != rhs.mem_bytes) return lhs.mem_bytes > rhs.mem_bytes;
+                    return lhs.cpu_percent > rhs.cpu_percent;
+                default:
+                    return lhs.pid < rhs.pid;
+            }
+        };
+
+        rng::partial_sort(candidates, candidates.begin() + (long) count, compare);
+
+        vector<Process> processes;
+        processes.reserve(count);
+
+        for (size_t i = 0; i < count; i++) {
+            const Slot& slot = table[candidates[i]];
+            char path[16];
+            *std::to_chars(path, path + sizeof(path) - 1, slot.pid).ptr = '\0';
+
+            //? The owner of /proc/[pid] is the effective uid of the process, so a setuid program shows its owner.
+            //? Non dumpable processes are owned by root
+            struct stat st{};
+            const bool owned = fstatat(proc_fd, path, &st, 0) == 0;
+
+            processes.push_back(Process{slot.pid, slot.ppid, string{slot.name.data()},
+                                        owned ? get_user(st.st_uid) : string{},
+                                        slot.state, slot.cpu_percent, slot.cpu_time,
+                                        slot.mem_bytes, slot.shared_bytes, slot.threads});
+        }
+
+        return Data{std::move(processes), candidates.size()};
+    }
+}
@@ -0,0 +1,346 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+#include "../include/rollup.hpp"
+
+namespace bhwinfo {
+    namespace {
+        int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+
+        template <typename E>
+        ut::type::enum_array<E, Aggregate> make_aggregates(const RollupConfig& config) {
+            ut::type::enum_array<E, Aggregate> aggregates;
+
+            aggregates.fill(Aggregate{config.relative_accuracy, config.sketch_bins});
+
+            return aggregates;
+        }
+
+        template <typename E>
+        void reset_aggregates(ut::type::enum_array<E, Aggregate>& aggregates) {
+            for (auto& aggregate : aggregates) aggregate.reset();
+        }
+    }
+
+    Aggregate::Aggregate() : Aggregate(RollupConfig{}.relative_accuracy, RollupConfig{}.sketch_bins) {}
+
+    Aggregate::Aggregate(double relative_accuracy, size_t bins) :
+    relative_accuracy(relative_accuracy),
+    gamma((1 + relative_accuracy) / (1 - relative_accuracy)),
+    log_gamma(std::log(gamma)),
+    bins(bins) {
+        if (not (relative_accuracy > 0 and relative_accuracy < 1))
+            throw std::invalid_argument("Aggregate relative accuracy must be between 0 and 1");
+
+        if (bins == 0) throw std::invalid_argument("Aggregate needs at least one sketch bin");
+    }
+
+    void Aggregate::add(double value) {
+        if (std::isnan(value)) return;
+
+        //? Welford's update, stable where the naive sum of squares cancels out
+        count++;
+        const double delta = value - mean;
+        mean += delta / (double) count;
+        m2 += delta * (value - mean);
+
+        min = count == 1 ? value : std::min(min, value);
+        max = count == 1 ? value : std::max(max, value);
+
+        if (value <= 0) {
+            zero_count++;
+            return;
+        }
+
+        //? Bin i holds the values in (gamma^(i-1), gamma^i]
+        add_key((int) std::clamp(std::ceil(std::log(value) / log_gamma), (double) INT32_MIN / 4, (double) INT32_MAX / 4));
+    }
+
+    void Aggregate::add_key(int key) {
+        const int size = (int) bins.size();
+
+        //? Center the first value, so the window can move both ways before anything collapses
+        if (binned_count++ == 0) offset = key - size / 2;
+
+        if (key < offset) {
+            bins[0]++;
+            return;
+        }
+
+        if (key >= offset + size) {
+            //? Slide the window up to <key>, the bins falling off the low end are merged into the new lowest one
+            const int shift = key - size + 1 - offset;
+            uint64_t collapsed;
+
+            if (shift >= size) {
+                collapsed = std::accumulate(bins.begin(), bins.end(), uint64_t{});
+                rng::fill(bins, 0);
+            }
+            else {
+                collapsed = std::accumulate(bins.begin(), bins.begin() + shift, uint64_t{});
+                std::move(bins.begin() + shift, bins.end(), bins.begin());
+                std::fill(bins.end() - shift, bins.end(), 0);
+            }
+
+            bins[0] += (uint32_t) collapsed;
+            offset += shift;
+        }
+
+        bins[key - offset]++;
+    }
+
+    void Aggregate::reset() {
+        count = 0;
+        mean = 0;
+        m2 = 0;
+        min = 0;
+        max = 0;
+        zero_count = 0;
+        binned_count = 0;
+        offset = 0;
+        rng::fill(bins, 0);
+    }
+
+    const uint64_t& Aggregate::get_count() const {
+        return count;
+    }
+
+    const double& Aggregate::get_mean() const {
+        return mean;
+    }
+
+    double Aggregate::get_variance() const {
+        return count > 1 ? m2 / (double) (count - 1) : 0.0;
+    }
+
+    double Aggregate::get_stddev() const {
+        return std::sqrt(get_variance());
+    }
+
+    const double& Aggregate::get_min() const {
+        return min;
+    }
+
+    const double& Aggregate::get_max() const {
+        return max;
+    }
+
+    double Aggregate::get_quantile(double q) const {
+        if (count == 0) return 0;
+
+        const auto rank = (uint64_t) (std::clamp(q, 0.0, 1.0) * (double) (count - 1));
+
+        if (rank < zero_count) return std::clamp(0.0, min, max);
+
+        uint64_t seen = zero_count;
+
+        for (size_t i = 0; i < bins.size(); i++) {
+            seen += bins[i];
+
+            if (seen <= rank) continue;
+
+            //? The estimate in the middle of the bin, in relative terms, is off by at most the relative accuracy
+            const double value = 2 * std::pow(gamma, offset + (int) i) / (gamma + 1);
+
+            return std::clamp(value, min, max);
+        }
+
+        return max;
+    }
+
+    const double& Aggregate::get_relative_accuracy() const {
+        return relative_accuracy;
+    }
+
+    size_t Aggregate::get_bin_count() const {
+        return bins.size();
+    }
+
+    RollupWindow::RollupWindow() = default;
+
+    void RollupWindow::reset(const RollupConfig& rollup_config, int64_t now) {
+        //? A window handed in by the caller may come from a default or another config, rebuild it once
+        if (config.relative_accuracy != rollup_config.relative_accuracy or config.sketch_bins != rollup_config.sketch_bins) {
+            config = rollup_config;
+            cpu_usage = make_aggregates<cpu::CpuField>(config);
+            ram = make_aggregates<mem::MemField>(config);
+            core_usage.clear();
+            core_count = 0;
+            disks.clear();
+        }
+
+        reset_aggregates(cpu_usage);
+        reset_aggregates(ram);
+
+        for (auto& aggregate : core_usage) aggregate.reset();
+
+        //? Disks that got no sample during the last window are gone, everything else keeps its storage
+        std::erase_if(disks, [](const auto& disk) { return disk.second[DiskRate::activity].get_count() == 0; });
+
+        for (auto& [ignored, aggregates] : disks) reset_aggregates(aggregates);
+
+        start_ns = now;
+        end_ns = 0;
+        first_time = {};
+        last_time = {};
+    }
+
+    void RollupWindow::resize_cores(int cores) {
+        if (cores == core_count) return;
+
+        core_count = cores;
+        core_usage.assign(static_cast<size_t>(cpu::CpuField::count) * cores, Aggregate{config.relative_accuracy, config.sketch_bins});
+    }
+
+    void RollupWindow::add_time(std::chrono::steady_clock::time_point time) {
+        if (first_time == std::chrono::steady_clock::time_point{} or time < first_time) first_time = time;
+        if (time > last_time) last_time = time;
+    }
+
+    const Aggregate& RollupWindow::get_cpu_usage(cpu::CpuField field) const {
+        return cpu_usage[field];
+    }
+
+    const Aggregate& RollupWindow::get_core_usage(int core, cpu::CpuField field) const {
+        if (core < 0 or core >= core_count) throw std::out_of_range("Core " + std::to_string(core) + " is out of range");
+
+        return core_usage[static_cast<size_t>(field) * core_count + core];
+    }
+
+    const int& RollupWindow::get_core_count() const {
+        return core_count;
+    }
+
+    const Aggregate& RollupWindow::get_ram(mem::MemField field) const {
+        return ram[field];
+    }
+
+    const ut::str::string_map<DiskAggregates>& RollupWindow::get_disks() const {
+        return disks;
+    }
+
+    const int64_t& RollupWindow::get_start_ns() const {
+        return start_ns;
+    }
+
+    const int64_t& RollupWindow::get_end_ns() const {
+        return end_ns;
+    }
+
+    std::chrono::nanoseconds RollupWindow::get_sampled_duration() const {
+        return last_time - first_time;
+    }
+
+    Rollup::Rollup(const RollupConfig& config) : config(config) {
+        //? Builds the first window's aggregates, which throws for an invalid config
+        current.reset(config, now_ns());
+    }
+
+    void Rollup::add(const cpu::Data& cpu, std::chrono::steady_clock::time_point time) {
+        std::lock_guard lock(mutex);
+
+        current.add_time(time);
+
+        for (size_t field = 0; field < static_cast<size_t>(cpu::CpuField::count); field++)
+            current.cpu_usage[cpu::CpuField(field)].add((double) cpu.get_cpu_usage().get_percent(cpu::CpuField(field)));
+
+        const int cores = (int) cpu.get_core_load().size();
+
+        current.resize_cores(cores);
+
+        for (size_t field = 0; field < static_cast<size_t>(cpu::CpuField::count); field++) {
+            const auto usage = cpu.get_core_usage(cpu::CpuField(field));
+
+            //? Data built without a per core breakdown still has its per core totals
+            const auto values = usage.empty() and cpu::CpuField(field) == cpu::CpuField::total
+                    ? std::span<const long long>{cpu.get_core_load()} : usage;
+
+            for (size_t core = 0; core < values.size() and core < (size_t) cores; core++)
+                current.core_usage[field * cores + core].add((double) values[core]);
+        }
+    }
+
+    void Rollup::add(const mem::Data& mem, std::chrono::steady_clock::time_point time) {
+        std::lock_guard lock(mutex);
+
+        current.add_time(time);
+
+        auto& ram = current.ram;
+        const uint64_t swap_total = mem.get_swap_total_amount().get_bytes();
+        const uint64_t swap_free = mem.get_swap_free_amount().get_bytes();
+
+        ram[mem::MemField::used].add((double) mem.get_used_ram_amount().get_bytes());
+        ram[mem::MemField::available].add((double) mem.get_available_ram_amount().get_bytes());
+        ram[mem::MemField::cached].add((double) mem.get_cached_ram_amount().get_bytes());
+        ram[mem::MemField::free].add((double) mem.get_free_ram_amount().get_bytes());
+        ram[mem::MemField::swap_total].add((double) swap_total);
+        ram[mem::MemField::swap_used].add((double) (swap_total - std::min(swap_free, swap_total)));
+        ram[mem::MemField::swap_free].add((double) swap_free);
+
+        //? io_read and io_write are bytes since the previous collect, which the first sample has no rate for
+        const double elapsed = old_mem_time == std::chrono::steady_clock::time_point{} ? 0.0
+                : std::chrono::duration<double>(time - old_mem_time).count();
+
+        old_mem_time = time;
+
+        for (const auto& disk : mem.get_disks()) {
+            //? IO values of a stale disk are from an earlier collect
+            if (disk.is_stale()) continue;
+
+            auto it = current.disks.find(disk.get_path().native());
+
+            if (it == current.disks.end())
+                it = current.disks.emplace(disk.get_path().native(), make_aggregates<DiskRate>(config)).first;
+
+            auto& aggregates = it->second;
+
+            if (elapsed > 0) {
+                aggregates[DiskRate::read].add((double) disk.get_io_read() / elapsed);
+                aggregates[DiskRate::write].add((double) disk.get_io_write() / elapsed);
+            }
+
+            aggregates[DiskRate::activity].add((double) disk.get_io_activity());
+            aggregates[DiskRate::iops].add((double) disk.get_iops());
+        }
+    }
+
+    void Rollup::take_window(RollupWindow& out) {
+        const int64_t now = now_ns();
+
+        std::lock_guard lock(mutex);
+
+        current.end_ns = now;
+        std::swap(current, out);
+        current.reset(config, now);
+    }
+
+    RollupWindow Rollup::take_window() {
+        RollupWindow window;
+        take_window(window);
+
+        return window;
+    }
+
+    const RollupConfig& Rollup::get_config() const {
+        return config;
+    }
+}
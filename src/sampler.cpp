@@ -0,0 +1,311 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "../include/sampler.hpp"
+
+using std::chrono::steady_clock;
+using std::chrono::system_clock;
+
+namespace bhwinfo {
+    Sampler::Sampler() : Sampler(SamplerConfig{}) {}
+
+    Sampler::Sampler(const SamplerConfig& config) :
+    config(config),
+    cpu_schedule{config.cpu_interval, config.cpu_interval.count()},
+    mem_schedule{config.mem_interval, config.mem_interval.count()},
+    cpu_collector(config.cgroup),
+    mem_collector(config.cgroup) {
+        if (config.cpu_interval <= 0ms or config.mem_interval <= 0ms)
+            throw std::invalid_argument("Sampler intervals must be positive");
+
+        if (const auto& adaptive = config.adaptive) {
+            if (not (adaptive->cpu_noise_floor > 0 and adaptive->mem_noise_floor > 0 and adaptive->io_noise_floor > 0))
+                throw std::invalid_argument("Adaptive sampling noise floors must be positive");
+
+            if (adaptive->quiet_samples == 0 or adaptive->max_backoff == 0)
+                throw std::invalid_argument("Adaptive sampling needs at least one quiet sample and a backoff of 1");
+        }
+
+        if (not config.history_dir.empty()) {
+            if (config.history_interval <= 0ms or config.history_flush_interval <= 0ms) throw std::invalid_argument("Sampler intervals must be positive");
+
+            history = std::make_unique<HistoryStore>(HistoryStoreConfig{config.history_dir, config.history_retention});
+        }
+
+        if (config.rollup) rollup = std::make_unique<Rollup>(*config.rollup);
+        if (config.exposition) exposition = std::make_unique<Exposition>(*config.exposition);
+    }
+
+    Sampler::~Sampler() {
+        stop();
+    }
+
+    void Sampler::start() {
+        if (worker.joinable()) return;
+
+        stopping = false;
+        worker = std::thread([this]() { run(); });
+    }
+
+    void Sampler::stop() {
+        if (not worker.joinable()) return;
+
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        worker.join();
+    }
+
+    bool Sampler::is_running() const {
+        return worker.joinable();
+    }
+
+    const SamplerConfig& Sampler::get_config() const {
+        return config;
+    }
+
+    cpu::Data Sampler::get_cpu_data() const {
+        return cpu_slot.load();
+    }
+
+    mem::Data Sampler::get_mem_data() const {
+        return mem_slot.load();
+    }
+
+    const SnapshotSlot<cpu::Data>& Sampler::get_cpu_slot() const {
+        return cpu_slot;
+    }
+
+    const SnapshotSlot<mem::Data>& Sampler::get_mem_slot() const {
+        return mem_slot;
+    }
+
+    uint64_t Sampler::get_failed_samples() const {
+        return failed_samples.load();
+    }
+
+    uint64_t Sampler::get_dropped_samples() const {
+        return dropped_samples.load();
+    }
+
+    std::chrono::milliseconds Sampler::get_cpu_interval() const {
+        return std::chrono::milliseconds{cpu_schedule.interval.load()};
+    }
+
+    std::chrono::milliseconds Sampler::get_mem_interval() const {
+        return std::chrono::milliseconds{mem_schedule.interval.load()};
+    }
+
+    const HistoryStore* Sampler::get_history_store() const {
+        return history.get();
+    }
+
+    Rollup* Sampler::get_rollup() {
+        return rollup.get();
+    }
+
+    const Exposition* Sampler::get_exposition() const {
+        return exposition.get();
+    }
+
+    ThresholdMonitor& Sampler::get_thresholds() {
+        return thresholds;
+    }
+
+    template <typename T, typename C>
+    void Sampler::sample(SnapshotSlot<T>& slot, C& collector, Schedule& schedule, T& data) {
+        try {
+            //? Both clocks are read right before the collect, so its rates and the published time agree
+            const SampleTime time{steady_clock::now(), std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    system_clock::now().time_since_epoch()).count()};
+
+            collector.collect_into(data, time.time);
+
+            //? Events carry the time of the sample, so they line up with the published snapshot, history and exposition
+            const bool crossed = thresholds.evaluate(data, time.timestamp_ns) > 0;
+
+            if (config.adaptive) adapt(schedule, get_activity(data), crossed);
+
+            if (rollup != nullptr) rollup->add(data, time.time);
+
+            if (exposition != nullptr) {
+                if constexpr (std::is_same_v<T, mem::Data>) exposition->render(data, time.time);
+                else exposition->render(data);
+            }
+
+            //? Copy assigned, the slot buffers keep their capacity and so does <data> for the next collect
+            if (not slot.publish([&](T& value) { value = data; }, time)) dropped_samples++;
+        }
+        catch (const std::exception&) {
+            failed_samples++;
+        }
+    }
+
+    double Sampler::get_activity(const cpu::Data& cpu) {
+        const auto& core_load = cpu.get_core_load();
+        const long long total = cpu.get_cpu_usage().get_total_percent();
+
+        //? Nothing to compare the first sample or a changed core count against
+        double delta = old_core_load.size() == core_load.size() ? (double) std::abs(total - old_cpu_total)
+                : std::numeric_limits<double>::infinity();
+
+        for (size_t i = 0; i < core_load.size() and i < old_core_load.size(); i++)
+            delta = std::max(delta, (double) std::abs(core_load[i] - old_core_load[i]));
+
+        old_core_load = core_load;
+        old_cpu_total = total;
+
+        return delta / config.adaptive->cpu_noise_floor;
+    }
+
+    double Sampler::get_activity(const mem::Data& mem) {
+        const array<long long, 2> ram_percent{mem.get_used_ram_amount().to_percent(),
+                                              mem.get_cached_ram_amount().to_percent()};
+        const auto& adaptive = *config.adaptive;
+
+        double activity = mem_slot.get_version() == 0 ? std::numeric_limits<double>::infinity() : 0.0;
+
+        for (size_t i = 0; i < ram_percent.size(); i++)
+            activity = std::max(activity, (double) std::abs(ram_percent[i] - old_ram_percent[i]) / adaptive.mem_noise_floor);
+
+        old_ram_percent = ram_percent;
+
+        mem_samples++;
+
+        for (const auto& disk : mem.get_disks()) {
+            //? Mounts sharing a device, like overlays and bind mounts, are told apart by their mountpoint
+            const string& mountpoint = disk.get_mountpoint().empty() ? disk.get_handle() : disk.get_mountpoint();
+            const auto [it, added] = old_io_activity.try_emplace(mountpoint, disk.get_io_activity(), mem_samples);
+
+            //? A disk that just appeared is a change by itself
+            if (added) {
+                activity = std::numeric_limits<double>::infinity();
+                continue;
+            }
+
+            auto& [old_activity, seen] = it->second;
+
+            activity = std::max(activity, (double) std::abs(disk.get_io_activity() - old_activity) / adaptive.io_noise_floor);
+            old_activity = disk.get_io_activity();
+            seen = mem_samples;
+        }
+
+        //? Drop unmounted disks, so mount churn on container hosts doesn't grow the map
+        if (old_io_activity.size() > mem.get_disks().size())
+            std::erase_if(old_io_activity, [&](const auto& entry) { return entry.second.second != mem_samples; });
+
+        return activity;
+    }
+
+    void Sampler::adapt(Schedule& schedule, double activity, bool crossed) {
+        const auto& adaptive = *config.adaptive;
+
+        if (crossed or activity > 1) {
+            schedule.quiet = 0;
+            schedule.interval = schedule.base.count();
+            return;
+        }
+
+        if (++schedule.quiet < adaptive.quiet_samples) return;
+
+        schedule.quiet = 0;
+        schedule.interval = std::min(schedule.interval.load() * 2, schedule.base.count() * adaptive.max_backoff);
+    }
+
+    void Sampler::record_history() {
+        //? Nothing to record until both collectors published once
+        if (cpu_slot.get_version() == 0 or mem_slot.get_version() == 0) return;
+
+        const int64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                system_clock::now().time_since_epoch()).count();
+
+        //? Built straight from the published values, nothing is copied
+        const auto record = cpu_slot.read([&](const cpu::Data& cpu) {
+            return mem_slot.read([&](const mem::Data& mem) { return HistoryStore::make_record(timestamp, cpu, mem); });
+        });
+
+        try {
+            history->append(record);
+        }
+        catch (const std::exception&) {
+            failed_samples++;
+        }
+    }
+
+    void Sampler::run() {
+        auto next_history = steady_clock::now();
+        auto next_flush = next_history + config.history_flush_interval;
+
+        cpu_schedule.next = next_history;
+        mem_schedule.next = next_history;
+
+        std::unique_lock lock(mutex);
+
+        while (not stopping) {
+            lock.unlock();
+
+            auto now = steady_clock::now();
+
+            if (now >= cpu_schedule.next) {
+                sample(cpu_slot, cpu_collector, cpu_schedule, cpu_data);
+
+                //? Keep the schedule anchored to the steady clock, skip ticks that were missed entirely.
+                //? The interval is read after sampling, so a sample that ends a backoff shortens the wait right away
+                const std::chrono::milliseconds interval{cpu_schedule.interval.load()};
+
+                cpu_schedule.next += interval;
+                if (cpu_schedule.next <= now) cpu_schedule.next = now + interval;
+            }
+
+            if (now >= mem_schedule.next) {
+                sample(mem_slot, mem_collector, mem_schedule, mem_data);
+
+                const std::chrono::milliseconds interval{mem_schedule.interval.load()};
+
+                mem_schedule.next += interval;
+                if (mem_schedule.next <= now) mem_schedule.next = now + interval;
+            }
+
+            if (history != nullptr and now >= next_history) {
+                record_history();
+
+                next_history += config.history_interval;
+                if (next_history <= now) next_history = now + config.history_interval;
+
+                //? Only starts the write back, under IO pressure waiting for the disk here would stall the next samples
+                if (now >= next_flush) {
+                    history->flush();
+                    next_flush = now + config.history_flush_interval;
+                }
+            }
+
+            const auto next = history != nullptr ? std::min({cpu_schedule.next, mem_schedule.next, next_history})
+                    : std::min(cpu_schedule.next, mem_schedule.next);
+
+            lock.lock();
+            wake.wait_until(lock, next, [this]() { return stopping; });
+        }
+
+        //? Sampling is over, stopping can wait until the records are on disk
+        if (history != nullptr) history->sync();
+    }
+}
@@ -0,0 +1,449 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../include/snapshot.hpp"
+
+namespace bhwinfo {
+    namespace {
+        constexpr size_t align8(size_t size) {
+            return (size + 7) & ~size_t{7};
+        }
+
+        bool is_aligned(const void* ptr) {
+            return reinterpret_cast<uintptr_t>(ptr) % 8 == 0;
+        }
+
+        int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    SnapshotWriter::SnapshotWriter(uint64_t source_id) : source_id(source_id) {}
+
+    size_t SnapshotWriter::get_size(const cpu::Data& cpu, const mem::Data& mem) {
+        return sizeof(SnapshotHeader)
+               + align8(cpu.get_core_load().size() * sizeof(SnapshotCore))
+               + mem.get_disks().size() * sizeof(SnapshotDisk);
+    }
+
+    uint32_t SnapshotWriter::intern(string_view str) {
+        if (str.empty()) return no_string;
+
+        if (const auto it = ids.find(str); it != ids.end()) return it->second;
+
+        const auto id = static_cast<uint32_t>(strings.size());
+
+        strings.emplace_back(str);
+        ids.emplace(strings.back(), id);
+        table_version++;
+
+        return id;
+    }
+
+    size_t SnapshotWriter::write(std::span<std::byte> buffer, const cpu::Data& cpu, const mem::Data& mem) {
+        const size_t size = get_size(cpu, mem);
+
+        if (buffer.size() < size) throw std::length_error("Snapshot needs " + std::to_string(size) + " bytes");
+        if (not is_aligned(buffer.data())) throw std::invalid_argument("Snapshot buffer must be 8 byte aligned");
+
+        //? Ids are only ever appended, so a table at least as new as a snapshot resolves all of its ids.
+        //? When the table gets too big it starts over, readers then need the table of the new version
+        if (strings.size() > max_strings) {
+            strings.clear();
+            ids.clear();
+            table_version++;
+        }
+
+        const auto& core_load = cpu.get_core_load();
+        const auto& core_frequency = cpu.get_core_frequency();
+        const auto& core_temp = cpu.get_core_temp();
+        const auto& disks = mem.get_disks();
+
+        auto* header = new (buffer.data()) SnapshotHeader{};
+
+        header->magic = snapshot_magic;
+        header->version = snapshot_version;
+        header->header_size = sizeof(SnapshotHeader);
+        header->size = static_cast<uint32_t>(size);
+        header->core_count = static_cast<uint32_t>(core_load.size());
+        header->core_offset = sizeof(SnapshotHeader);
+        header->disk_count = static_cast<uint32_t>(disks.size());
+        header->disk_offset = static_cast<uint32_t>(size - disks.size() * sizeof(SnapshotDisk));
+        header->cpu_name = intern(cpu.get_cpu_mame());
+        header->source_id = source_id;
+        header->sequence = sequence++;
+        header->timestamp_ns = now_ns();
+
+        /** cpu */
+        for (size_t i = 0; i < header->cpu_percent.size(); i++) {
+            header->cpu_percent[cpu::CpuField(i)] = cpu.get_cpu_usage().get_percent(cpu::CpuField(i));
+        }
+
+        header->cpu_temp = cpu.get_cpu_temp();
+        header->cpu_critical_temp = cpu.get_cpu_critical_temperature();
+        header->load_avg = {(float) cpu.get_average_load().get_one_min(),
+                            (float) cpu.get_average_load().get_five_min(),
+                            (float) cpu.get_average_load().get_fifteen_min()};
+        header->cpu_frequency_units = intern(cpu.get_cpu_frequency().get_units());
+        header->cpu_frequency = cpu.get_cpu_frequency().get_value();
+
+        auto* cores = reinterpret_cast<SnapshotCore*>(buffer.data() + header->core_offset);
+
+        for (size_t i = 0; i < core_load.size(); i++) {
+            new (cores + i) SnapshotCore{core_load[i],
+                                         i < core_frequency.size() ? core_frequency[i] : 0,
+                                         i < core_temp.size() ? core_temp[i] : 0};
+        }
+
+        /** mem */
+        header->ram_total = mem.get_total_ram_amount().get_bytes();
+
+        for (const auto& [field, unit] : {std::pair{mem::MemField::used, &mem.get_used_ram_amount()},
+                                          std::pair{mem::MemField::available, &mem.get_available_ram_amount()},
+                                          std::pair{mem::MemField::cached, &mem.get_cached_ram_amount()},
+                                          std::pair{mem::MemField::free, &mem.get_free_ram_amount()}}) {
+            header->ram_bytes[field] = unit->get_bytes();
+            header->ram_percent[field] = unit->to_percent();
+        }
+
+        for (size_t i = 0; i < header->meminfo.size(); i++) {
+            header->meminfo[mem::MemInfoField(i)] = mem.get_meminfo(mem::MemInfoField(i));
+        }
+
+        auto* out = reinterpret_cast<SnapshotDisk*>(buffer.data() + header->disk_offset);
+
+        for (size_t i = 0; i < disks.size(); i++) {
+            const auto& disk = disks[i];
+
+            new (out + i) SnapshotDisk{intern(disk.get_handle()), intern(disk.get_fs_type()), intern(disk.get_path().native()),
+                                       disk.is_stale() ? snapshot_disk_stale : 0,
+                                       disk.get_total().get_bytes(), disk.get_used().get_bytes(), disk.get_free().get_bytes(),
+                                       disk.get_used_percent(), disk.get_free_percent(),
+                                       disk.get_io_read(), disk.get_io_write(), disk.get_io_activity()};
+        }
+
+        //? Interning above may have changed the table, so the version is filled in last
+        header->string_table_version = table_version;
+
+        return size;
+    }
+
+    bool SnapshotWriter::strings_changed() const {
+        return table_version != written_version;
+    }
+
+    const uint64_t& SnapshotWriter::get_strings_version() const {
+        return table_version;
+    }
+
+    size_t SnapshotWriter::get_strings_size() const {
+        size_t chars = 0;
+
+        for (const auto& str : strings) chars += str.size();
+
+        return align8(sizeof(StringTableHeader) + (strings.size() + 1) * sizeof(uint32_t) + chars);
+    }
+
+    size_t SnapshotWriter::write_strings(std::span<std::byte> buffer) {
+        const size_t size = get_strings_size();
+
+        if (buffer.size() < size) throw std::length_error("String table needs " + std::to_string(size) + " bytes");
+        if (not is_aligned(buffer.data())) throw std::invalid_argument("String table buffer must be 8 byte aligned");
+
+        auto* header = new (buffer.data()) StringTableHeader{
+            string_table_magic, snapshot_version, sizeof(StringTableHeader), static_cast<uint32_t>(size),
+            static_cast<uint32_t>(strings.size()), source_id, table_version
+        };
+
+        auto* offsets = reinterpret_cast<uint32_t*>(header + 1);
+        auto* chars = reinterpret_cast<char*>(offsets + strings.size() + 1);
+        uint32_t offset = 0;
+
+        for (size_t i = 0; i < strings.size(); i++) {
+            offsets[i] = offset;
+            std::memcpy(chars + offset, strings[i].data(), strings[i].size());
+            offset += static_cast<uint32_t>(strings[i].size());
+        }
+
+        offsets[strings.size()] = offset;
+        std::memset(chars + offset, 0, buffer.data() + size - reinterpret_cast<std::byte*>(chars + offset));
+
+        written_version = table_version;
+
+        return size;
+    }
+
+    const uint64_t& SnapshotWriter::get_source_id() const {
+        return source_id;
+    }
+
+    const uint64_t& SnapshotWriter::get_sequence() const {
+        return sequence;
+    }
+
+    SnapshotView::SnapshotView(std::span<const std::byte> buffer) {
+        if (buffer.size() < sizeof(SnapshotHeader) or not is_aligned(buffer.data()))
+            throw std::runtime_error("Snapshot buffer too small or misaligned");
+
+        header = reinterpret_cast<const SnapshotHeader*>(buffer.data());
+
+        if (header->magic != snapshot_magic or header->version != snapshot_version
+            or header->header_size != sizeof(SnapshotHeader))
+            throw std::runtime_error("Not a version " + std::to_string(snapshot_version) + " snapshot");
+
+        //? Offsets and counts are checked in 64 bits so corrupt values can't wrap around
+        const uint64_t cores_end = (uint64_t) header->core_offset + (uint64_t) header->core_count * sizeof(SnapshotCore);
+        const uint64_t disks_end = (uint64_t) header->disk_offset + (uint64_t) header->disk_count * sizeof(SnapshotDisk);
+
+        if (header->size > buffer.size() or header->core_offset < sizeof(SnapshotHeader) or cores_end > header->size
+            or header->disk_offset < cores_end or disks_end > header->size
+            or header->core_offset % 8 != 0 or header->disk_offset % 8 != 0)
+            throw std::runtime_error("Malformed snapshot");
+    }
+
+    const SnapshotHeader& SnapshotView::get_header() const {
+        return *header;
+    }
+
+    std::span<const SnapshotCore> SnapshotView::get_cores() const {
+        return {reinterpret_cast<const SnapshotCore*>(reinterpret_cast<const std::byte*>(header) + header->core_offset),
+                header->core_count};
+    }
+
+    std::span<const SnapshotDisk> SnapshotView::get_disks() const {
+        return {reinterpret_cast<const SnapshotDisk*>(reinterpret_cast<const std::byte*>(header) + header->disk_offset),
+                header->disk_count};
+    }
+
+    StringTableView::StringTableView(std::span<const std::byte> buffer) {
+        if (buffer.size() < sizeof(StringTableHeader) or not is_aligned(buffer.data()))
+            throw std::runtime_error("String table buffer too small or misaligned");
+
+        header = reinterpret_cast<const StringTableHeader*>(buffer.data());
+
+        if (header->magic != string_table_magic or header->version != snapshot_version
+            or header->header_size != sizeof(StringTableHeader))
+            throw std::runtime_error("Not a version " + std::to_string(snapshot_version) + " string table");
+
+        const uint64_t chars_offset = sizeof(StringTableHeader) + ((uint64_t) header->count + 1) * sizeof(uint32_t);
+
+        if (header->size > buffer.size() or chars_offset > header->size)
+            throw std::runtime_error("Malformed string table");
+
+        offsets = reinterpret_cast<const uint32_t*>(header + 1);
+        chars = reinterpret_cast<const char*>(buffer.data()) + chars_offset;
+
+        if (offsets[header->count] > header->size - chars_offset)
+            throw std::runtime_error("Malformed string table");
+
+        for (uint32_t i = 0; i < header->count; i++) {
+            if (offsets[i] > offsets[i + 1]) throw std::runtime_error("Malformed string table");
+        }
+    }
+
+    const StringTableHeader& StringTableView::get_header() const {
+        return *header;
+    }
+
+    string_view StringTableView::get(uint32_t id) const {
+        if (id >= header->count) return {};
+
+        return {chars + offsets[id], offsets[id + 1] - offsets[id]};
+    }
+
+    SnapshotRing::SnapshotRing(const fs::path& path, uint32_t slot_size, uint32_t slot_count, uint32_t strings_size) :
+    writable(true) {
+        if (slot_count == 0 or slot_size < sizeof(SnapshotHeader) or strings_size < sizeof(StringTableHeader))
+            throw std::invalid_argument("SnapshotRing slots too small");
+
+        //? Slot sizes include their SlotHeader and keep every slot 8 byte aligned
+        const uint64_t slot_bytes = align8(sizeof(SlotHeader) + slot_size);
+        const uint64_t strings_bytes = align8(sizeof(SlotHeader) + strings_size);
+
+        map_size = align8(sizeof(RingHeader)) + strings_bytes + slot_bytes * slot_count;
+
+        const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0) throw std::runtime_error("Failed to create " + path.string());
+
+        if (ftruncate(fd, (off_t) map_size) < 0) {
+            ::close(fd);
+            throw std::runtime_error("Failed to size " + path.string());
+        }
+
+        void* ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (ptr == MAP_FAILED) throw std::runtime_error("Failed to map " + path.string());
+
+        map = static_cast<std::byte*>(ptr);
+
+        auto* header = new (map) RingHeader{snapshot_ring_magic, snapshot_version, sizeof(RingHeader),
+                                            static_cast<uint32_t>(slot_bytes), slot_count,
+                                            static_cast<uint32_t>(strings_bytes), 0, {}};
+        header->head.store(0);
+    }
+
+    SnapshotRing::SnapshotRing(const fs::path& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) throw std::runtime_error("Failed to open " + path.string());
+
+        struct stat st{};
+
+        if (fstat(fd, &st) < 0 or (size_t) st.st_size < sizeof(RingHeader)) {
+            ::close(fd);
+            throw std::runtime_error("Not a snapshot ring: " + path.string());
+        }
+
+        map_size = st.st_size;
+
+        void* ptr = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (ptr == MAP_FAILED) throw std::runtime_error("Failed to map " + path.string());
+
+        map = static_cast<std::byte*>(ptr);
+
+        const auto& header = ring();
+
+        //? The same lower bounds the writer enforces, slot sizes below them would underflow once the SlotHeader is taken off
+        if (header.magic != snapshot_ring_magic or header.version != snapshot_version or header.slot_count == 0
+            or header.header_size != sizeof(RingHeader)
+            or header.slot_size < sizeof(SlotHeader) + sizeof(SnapshotHeader) or header.slot_size % 8 != 0
+            or header.strings_size < sizeof(SlotHeader) + sizeof(StringTableHeader) or header.strings_size % 8 != 0
+            or align8(sizeof(RingHeader)) + header.strings_size + (uint64_t) header.slot_size * header.slot_count > map_size) {
+            munmap(map, map_size);
+            throw std::runtime_error("Not a snapshot ring: " + path.string());
+        }
+    }
+
+    SnapshotRing::~SnapshotRing() {
+        if (map != nullptr) munmap(map, map_size);
+    }
+
+    SnapshotRing::RingHeader& SnapshotRing::ring() const {
+        return *reinterpret_cast<RingHeader*>(map);
+    }
+
+    SnapshotRing::SlotHeader& SnapshotRing::strings_slot() const {
+        return *reinterpret_cast<SlotHeader*>(map + align8(sizeof(RingHeader)));
+    }
+
+    SnapshotRing::SlotHeader& SnapshotRing::slot(uint64_t index) const {
+        const auto& header = ring();
+
+        return *reinterpret_cast<SlotHeader*>(map + align8(sizeof(RingHeader)) + header.strings_size
+                                              + (index % header.slot_count) * header.slot_size);
+    }
+
+    void SnapshotRing::write_slot(SlotHeader& slot, const auto& fill) {
+        const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+
+        //? Odd while writing, readers that saw the old even value notice the change and retry
+        slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        slot.size = static_cast<uint32_t>(fill(reinterpret_cast<std::byte*>(&slot + 1)));
+
+        slot.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    bool SnapshotRing::read_slot(const SlotHeader& slot, size_t capacity, vector<std::byte>& out) {
+        for (int attempt = 0; attempt < 4; attempt++) {
+            const uint64_t before = slot.sequence.load(std::memory_order_acquire);
+
+            if (before == 0) return false;
+            if (before % 2 != 0 or slot.size > capacity) continue;
+
+            out.resize(slot.size);
+            std::memcpy(out.data(), &slot + 1, out.size());
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (slot.sequence.load(std::memory_order_relaxed) == before) return true;
+        }
+
+        return false;
+    }
+
+    void SnapshotRing::write(SnapshotWriter& writer, const cpu::Data& cpu, const mem::Data& mem) {
+        if (not writable) throw std::logic_error("SnapshotRing opened for reading");
+
+        auto& header = ring();
+
+        if (SnapshotWriter::get_size(cpu, mem) > get_slot_size())
+            throw std::length_error("Snapshot doesn't fit into a " + std::to_string(get_slot_size()) + " byte slot");
+
+        //? Snapshot first, so the strings it interns are part of the table written below
+        const uint64_t head = header.head.load(std::memory_order_relaxed);
+
+        write_slot(slot(head), [&](std::byte* data) {
+            return writer.write({data, get_slot_size()}, cpu, mem);
+        });
+
+        //? Tracked here rather than through strings_changed(), the writer may also feed other consumers
+        if (writer.get_strings_version() != strings_version) {
+            const size_t capacity = header.strings_size - sizeof(SlotHeader);
+
+            if (writer.get_strings_size() > capacity)
+                throw std::length_error("String table doesn't fit into " + std::to_string(capacity) + " bytes");
+
+            write_slot(strings_slot(), [&](std::byte* data) {
+                return writer.write_strings({data, capacity});
+            });
+
+            strings_version = writer.get_strings_version();
+        }
+
+        header.head.store(head + 1, std::memory_order_release);
+    }
+
+    bool SnapshotRing::read_latest(vector<std::byte>& out) const {
+        //? The writer may lap the reader, move on to the newest slot each attempt
+        for (int attempt = 0; attempt < 4; attempt++) {
+            const uint64_t head = ring().head.load(std::memory_order_acquire);
+
+            if (head == 0) return false;
+
+            if (read_slot(slot(head - 1), get_slot_size(), out)) return true;
+        }
+
+        return false;
+    }
+
+    bool SnapshotRing::read_strings(vector<std::byte>& out) const {
+        return read_slot(strings_slot(), ring().strings_size - sizeof(SlotHeader), out);
+    }
+
+    uint32_t SnapshotRing::get_slot_size() const {
+        return ring().slot_size - static_cast<uint32_t>(sizeof(SlotHeader));
+    }
+
+    uint32_t SnapshotRing::get_slot_count() const {
+        return ring().slot_count;
+    }
+
+    uint64_t SnapshotRing::get_head() const {
+        return ring().head.load(std::memory_order_acquire);
+    }
+}
@@ -0,0 +1,242 @@
+/**
+ * Copyright 2023 novakovd (danilnovakov@gmail.com)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include "../include/threshold.hpp"
+
+namespace bhwinfo {
+    namespace {
+        int64_t now_ns() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+        }
+    }
+
+    ThresholdMonitor::~ThresholdMonitor() {
+        for (const auto& subscription : subscriptions) {
+            if (subscription.fd >= 0) ::close(subscription.fd);
+        }
+    }
+
+    SubscriptionId ThresholdMonitor::add(const Threshold& threshold, std::function<void(const ThresholdEvent&)> callback, int fd) {
+        const double clear = threshold.clear.value_or(threshold.raise);
+
+        if (clear > threshold.raise) {
+            if (fd >= 0) ::close(fd);
+            throw std::invalid_argument("Threshold clear value must not be above its raise value");
+        }
+
+        std::lock_guard lock(mutex);
+
+        const SubscriptionId id = next_id++;
+        subscriptions.push_back({id, threshold, clear, std::move(callback), fd, false, {}, {}});
+
+        return id;
+    }
+
+    SubscriptionId ThresholdMonitor::subscribe(const Threshold& threshold, std::function<void(const ThresholdEvent&)> callback) {
+        if (not callback) throw std::invalid_argument("Threshold subscription needs a callback");
+
+        return add(threshold, std::move(callback), -1);
+    }
+
+    SubscriptionId ThresholdMonitor::subscribe(const Threshold& threshold) {
+        const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (fd < 0) throw std::runtime_error("Failed to create an eventfd for a threshold subscription");
+
+        return add(threshold, {}, fd);
+    }
+
+    void ThresholdMonitor::unsubscribe(SubscriptionId id) {
+        std::lock_guard lock(mutex);
+
+        const auto it = rng::find(subscriptions, id, &Subscription::id);
+
+        if (it == subscriptions.end()) return;
+
+        if (it->fd >= 0) ::close(it->fd);
+
+        subscriptions.erase(it);
+    }
+
+    int ThresholdMonitor::get_fd(SubscriptionId id) const {
+        std::lock_guard lock(mutex);
+
+        const auto it = rng::find(subscriptions, id, &Subscription::id);
+
+        return it != subscriptions.end() ? it->fd : -1;
+    }
+
+    size_t ThresholdMonitor::take_events(SubscriptionId id, vector<ThresholdEvent>& out) {
+        std::lock_guard lock(mutex);
+
+        const auto it = rng::find(subscriptions, id, &Subscription::id);
+
+        if (it == subscriptions.end() or it->fd < 0) return 0;
+
+        const size_t count = it->queued.size();
+
+        //? Reading resets the counter, the fd stays readable only while new events arrive
+        uint64_t ignored;
+        while (read(it->fd, &ignored, sizeof(ignored)) < 0 and errno == EINTR);
+
+        std::move(it->queued.begin(), it->queued.end(), std::back_inserter(out));
+        it->queued.clear();
+
+        return count;
+    }
+
+    bool ThresholdMonitor::check(Subscription& subscription, bool& active, double value, const string& disk, int64_t timestamp) {
+        const bool next = active ? value >= subscription.clear : value >= subscription.threshold.raise;
+
+        if (next == active) return false;
+
+        active = next;
+
+        deliver(subscription, {subscription.id, subscription.threshold.metric, active, value, disk, timestamp});
+
+        return true;
+    }
+
+    void ThresholdMonitor::deliver(Subscription& subscription, ThresholdEvent event) {
+        if (subscription.callback) {
+            notifications.push_back({subscription.callback, std::move(event)});
+            return;
+        }
+
+        if (subscription.queued.size() >= max_queued) subscription.queued.pop_front();
+
+        subscription.queued.push_back(std::move(event));
+
+        const uint64_t one = 1;
+        while (write(subscription.fd, &one, sizeof(one)) < 0 and errno == EINTR);
+    }
+
+    void ThresholdMonitor::notify() {
+        for (const auto& [callback, event] : notifications) callback(event);
+
+        notifications.clear();
+    }
+
+    size_t ThresholdMonitor::evaluate(const cpu::Data& cpu) {
+        return evaluate(cpu, now_ns());
+    }
+
+    size_t ThresholdMonitor::evaluate(const mem::Data& mem) {
+        return evaluate(mem, now_ns());
+    }
+
+    size_t ThresholdMonitor::evaluate(const cpu::Data& cpu, int64_t timestamp) {
+        size_t transitions = 0;
+
+        {
+            std::lock_guard lock(mutex);
+
+            if (subscriptions.empty()) return 0;
+
+            const auto& critical = cpu.get_cpu_critical_temperature();
+
+            for (auto& subscription : subscriptions) {
+                switch (subscription.threshold.metric) {
+                    case Metric::cpu_total:
+                        transitions += check(subscription, subscription.active, (double) cpu.get_cpu_usage().get_total_percent(), {}, timestamp);
+                        break;
+                    case Metric::cpu_temp:
+                        transitions += check(subscription, subscription.active, (double) cpu.get_cpu_temp(), {}, timestamp);
+                        break;
+                    case Metric::cpu_temp_critical:
+                        transitions += check(subscription, subscription.active,
+                                             critical > 0 ? (double) cpu.get_cpu_temp() * 100 / (double) critical : 0.0, {}, timestamp);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        //? Outside the lock, so callbacks may subscribe and unsubscribe. The sampling thread is the only caller
+        notify();
+
+        return transitions;
+    }
+
+    size_t ThresholdMonitor::evaluate(const mem::Data& mem, int64_t timestamp) {
+        size_t transitions = 0;
+
+        {
+            std::lock_guard lock(mutex);
+
+            if (subscriptions.empty()) return 0;
+
+            const uint64_t evaluation = ++mem_evaluations;
+
+            for (auto& subscription : subscriptions) {
+                if (subscription.threshold.metric == Metric::ram_used) {
+                    transitions += check(subscription, subscription.active, (double) mem.get_used_ram_amount().to_percent(), {}, timestamp);
+                    continue;
+                }
+
+                if (subscription.threshold.metric != Metric::disk_used) continue;
+
+                const string& filter = subscription.threshold.disk;
+
+                for (const auto& disk : mem.get_disks()) {
+                    //? Bind mounts and subvolumes share a device node, the mountpoint is what tells them apart
+                    const string& mountpoint = disk.get_mountpoint().empty() ? disk.get_handle() : disk.get_mountpoint();
+
+                    if (not filter.empty() and filter != mountpoint and filter != disk.get_handle()) continue;
+
+                    auto it = subscription.disks.find(mountpoint);
+
+                    //? Usage of a stale disk is from an earlier collect, it must not trigger or clear anything
+                    if (disk.is_stale()) {
+                        if (it != subscription.disks.end()) it->second.seen = evaluation;
+                        continue;
+                    }
+
+                    if (it == subscription.disks.end()) it = subscription.disks.emplace(mountpoint, DiskState{}).first;
+
+                    auto& state = it->second;
+
+                    state.value = (double) disk.get_used_percent();
+                    state.seen = evaluation;
+                    transitions += check(subscription, state.active, state.value, mountpoint, timestamp);
+                }
+
+                //? Unmounted disks are dropped, so mount churn doesn't grow the map. An active one clears on the way out
+                for (auto it = subscription.disks.begin(); it != subscription.disks.end();) {
+                    if (it->second.seen == evaluation) {
+                        it++;
+                        continue;
+                    }
+
+                    if (it->second.active) {
+                        deliver(subscription, {subscription.id, Metric::disk_used, false, it->second.value, it->first, timestamp});
+                        transitions++;
+                    }
+
+                    it = subscription.disks.erase(it);
+                }
+            }
+        }
+
+        notify();
+
+        return transitions;
+    }
+}